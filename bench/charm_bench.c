@@ -0,0 +1,483 @@
+#include <dirent.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "charm.h"
+#include "isolate_pool.h"
+
+#include "core/dyn_array.h"
+#include "core/memory.h"
+
+#include "ast/ast.h"
+#include "ast/lexer.h"
+
+#include "compiler/chunk.h"
+
+// Each stage of each benchmark runs `iterations` times, on a new instance, and
+// is reported by its fastest and median runs. Sources given on the command
+// line replace the corpus of bench/, which is found at build time.
+
+#define DEFAULT_ITERATIONS 5
+// Shape of the generated source, which is only parsed and compiled. Chunks
+// hold at most 256 constants, two per function in the program and two per
+// statement in a function.
+#define GENERATED_FUNCTIONS 100
+#define GENERATED_STATEMENTS 100
+
+typedef enum Stage
+{
+	STAGE_LEX,
+	STAGE_PARSE,
+	STAGE_COMPILE,
+	STAGE_VM,
+	STAGE_ISOLATES, // One run per core at the same time, see isolate_pool.h
+	STAGE_TREEWALK,
+	STAGE_COUNT,
+} Stage;
+
+static const char *stage_names[STAGE_COUNT] = {
+	"lex", "parse", "compile", "vm", "isolates", "treewalk",
+};
+
+typedef struct Benchmark
+{
+	char *name;
+	char *source;
+	bool run; // False to only lex, parse and compile the source
+
+	f64 *times[STAGE_COUNT]; // Milliseconds, one per iteration
+} Benchmark;
+
+static f64 now_ms()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static char *read_whole_file(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+
+	if (file == NULL)
+	{
+		return NULL;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+
+	char *content = mem_malloc(size + 1);
+
+	if (fread(content, 1, size, file) != (usize)size)
+	{
+		fclose(file);
+		mem_free(content);
+		return NULL;
+	}
+
+	fclose(file);
+	content[size] = '\0';
+
+	return content;
+}
+
+static char *copy_string(const char *str, usize len)
+{
+	char *copy = mem_malloc(len + 1);
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+
+	return copy;
+}
+
+// Name of the file without its directory and extension
+static char *benchmark_name(const char *path)
+{
+	const char *start = strrchr(path, '/');
+	start = start != NULL ? start + 1 : path;
+
+	const char *end = strrchr(start, '.');
+	end = end != NULL ? end : start + strlen(start);
+
+	return copy_string(start, end - start);
+}
+
+static bool add_file(Benchmark **benchmarks, const char *path)
+{
+	char *source = read_whole_file(path);
+
+	if (source == NULL)
+	{
+		printf("Could not read '%s'\n", path);
+		return false;
+	}
+
+	Benchmark benchmark = {
+		.name = benchmark_name(path),
+		.source = source,
+		.run = true,
+	};
+	arrpush(*benchmarks, benchmark);
+
+	return true;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static bool add_corpus(Benchmark **benchmarks, const char *directory)
+{
+	DIR *dir = opendir(directory);
+
+	if (dir == NULL)
+	{
+		printf("Could not open '%s'\n", directory);
+		return false;
+	}
+
+	char **paths = NULL;
+	struct dirent *entry;
+
+	while ((entry = readdir(dir)) != NULL)
+	{
+		usize len = strlen(entry->d_name);
+
+		if (len > 6 && strcmp(entry->d_name + len - 6, ".charm") == 0)
+		{
+			usize size = strlen(directory) + len + 2;
+			char *path = mem_malloc(size);
+			snprintf(path, size, "%s/%s", directory, entry->d_name);
+			arrpush(paths, path);
+		}
+	}
+
+	closedir(dir);
+
+	qsort(paths, arrlen(paths), sizeof(char *), compare_names);
+
+	bool ok = true;
+
+	for (i32 i = 0; i < arrlen(paths); i++)
+	{
+		ok = ok && add_file(benchmarks, paths[i]);
+		mem_free(paths[i]);
+	}
+
+	arrfree(paths);
+
+	return ok;
+}
+
+static void append(char **source, const char *format, ...)
+{
+	char line[128];
+
+	va_list args;
+	va_start(args, format);
+	i32 len = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+
+	memcpy(arraddnptr(*source, len), line, len);
+}
+
+static char *generate_source()
+{
+	char *source = NULL;
+
+	for (i32 i = 0; i < GENERATED_FUNCTIONS; i++)
+	{
+		append(&source, "function generated_%d(x, y) {\n", i);
+
+		for (i32 j = 0; j < GENERATED_STATEMENTS; j++)
+		{
+			if (j % 2 == 0)
+			{
+				append(&source, "    x = x * %d + y - %d;\n", j, i);
+			}
+			else
+			{
+				append(&source, "    if x > %d { y = y + %d; }\n", j, i);
+			}
+		}
+
+		append(&source, "    return x;\n}\n\n");
+	}
+
+	char *copy = copy_string(source, arrlen(source));
+	arrfree(source);
+
+	return copy;
+}
+
+// Pools are only timed while running the copies of the program
+static void run_isolates(Benchmark *benchmark, CharmVM *charm,
+						 const Chunk *chunk)
+{
+	IsolatePool *pool = isolate_pool_new(charm, 0);
+
+	if (pool == NULL)
+	{
+		return;
+	}
+
+	i32 copies = isolate_pool_worker_count(pool);
+	InterpretResult *results = mem_allocate(InterpretResult, copies);
+
+	f64 start = now_ms();
+
+	for (i32 i = 0; i < copies; i++)
+	{
+		isolate_pool_submit(pool, chunk, &results[i]);
+	}
+
+	isolate_pool_wait(pool);
+	arrpush(benchmark->times[STAGE_ISOLATES], now_ms() - start);
+
+	isolate_pool_free(pool);
+	mem_free(results);
+}
+
+static void run_once(Benchmark *benchmark)
+{
+	// Instances are not timed
+	CharmVM *charm = charm_vm_new();
+
+	f64 start = now_ms();
+	Lexer lexer = lexer_init(benchmark->source);
+
+	while (lexer_get_next_token(&lexer).type != TOKEN_EOF)
+	{
+	}
+
+	lexer_free(&lexer);
+	arrpush(benchmark->times[STAGE_LEX], now_ms() - start);
+
+	start = now_ms();
+	Program program = charm_parse(charm, benchmark->source);
+	arrpush(benchmark->times[STAGE_PARSE], now_ms() - start);
+
+	Chunk chunk;
+	chunk_init(&chunk);
+
+	start = now_ms();
+	compile_program(&chunk, program);
+	arrpush(benchmark->times[STAGE_COMPILE], now_ms() - start);
+
+	if (benchmark->run)
+	{
+		start = now_ms();
+		charm_run_chunk(charm, &chunk);
+		arrpush(benchmark->times[STAGE_VM], now_ms() - start);
+
+		run_isolates(benchmark, charm, &chunk);
+
+		start = now_ms();
+		charm_run_treewalk(charm, program);
+		arrpush(benchmark->times[STAGE_TREEWALK], now_ms() - start);
+	}
+
+	chunk_free(&chunk);
+	charm_vm_free(charm);
+}
+
+static int compare_times(const void *a, const void *b)
+{
+	f64 x = *(const f64 *)a;
+	f64 y = *(const f64 *)b;
+	return (x > y) - (x < y);
+}
+
+// Sorts the times of a stage, which is then reported by its first and middle
+static f64 *sorted_times(Benchmark *benchmark, Stage stage)
+{
+	f64 *times = benchmark->times[stage];
+	qsort(times, arrlen(times), sizeof(f64), compare_times);
+
+	return times;
+}
+
+static void print_report(Benchmark *benchmarks, i32 iterations)
+{
+	printf("\n%-16s", "benchmark");
+
+	for (i32 stage = 0; stage < STAGE_COUNT; stage++)
+	{
+		printf(" %20s", stage_names[stage]);
+	}
+
+	printf("\n%-16s", "");
+
+	for (i32 stage = 0; stage < STAGE_COUNT; stage++)
+	{
+		printf(" %20s", "min / median ms");
+	}
+
+	printf("\n");
+
+	for (i32 i = 0; i < arrlen(benchmarks); i++)
+	{
+		Benchmark *benchmark = &benchmarks[i];
+		printf("%-16s", benchmark->name);
+
+		for (i32 stage = 0; stage < STAGE_COUNT; stage++)
+		{
+			if (arrlen(benchmark->times[stage]) == 0)
+			{
+				printf(" %20s", "-");
+				continue;
+			}
+
+			f64 *times = sorted_times(benchmark, stage);
+			printf(" %9.2f / %8.2f", times[0], times[iterations / 2]);
+		}
+
+		printf("\n");
+	}
+}
+
+static void write_json(FILE *out, Benchmark *benchmarks, i32 iterations,
+					   bool debug_output)
+{
+	fprintf(out, "{\n");
+	fprintf(out, "  \"iterations\": %d,\n", iterations);
+	fprintf(out, "  \"debug_output\": %s,\n", debug_output ? "true" : "false");
+	fprintf(out, "  \"benchmarks\": [\n");
+
+	for (i32 i = 0; i < arrlen(benchmarks); i++)
+	{
+		Benchmark *benchmark = &benchmarks[i];
+		fprintf(out, "    {\n");
+		fprintf(out, "      \"name\": \"%s\",\n", benchmark->name);
+		fprintf(out, "      \"bytes\": %zu,\n", strlen(benchmark->source));
+		fprintf(out, "      \"stages\": {");
+
+		bool first = true;
+
+		for (i32 stage = 0; stage < STAGE_COUNT; stage++)
+		{
+			if (arrlen(benchmark->times[stage]) == 0)
+			{
+				continue;
+			}
+
+			f64 *times = sorted_times(benchmark, stage);
+			fprintf(out, "%s\n        \"%s\": ", first ? "" : ",",
+					stage_names[stage]);
+			fprintf(out, "{ \"min_ms\": %.4f, \"median_ms\": %.4f }",
+					times[0], times[iterations / 2]);
+			first = false;
+		}
+
+		fprintf(out, "\n      }\n");
+		fprintf(out, "    }%s\n", i + 1 < arrlen(benchmarks) ? "," : "");
+	}
+
+	fprintf(out, "  ]\n}\n");
+}
+
+static void usage(const char *program)
+{
+	printf("Usage: %s [--iterations <n>] [--json <file>] "
+		   "[<filename.charm>...]\n",
+		   program);
+}
+
+int main(int argc, char **argv)
+{
+	i32 iterations = DEFAULT_ITERATIONS;
+	const char *json_path = NULL;
+	Benchmark *benchmarks = NULL;
+
+	for (i32 i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+		{
+			iterations = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+		{
+			json_path = argv[++i];
+		}
+		else if (argv[i][0] == '-')
+		{
+			usage(argv[0]);
+			return 1;
+		}
+		else if (!add_file(&benchmarks, argv[i]))
+		{
+			return 2;
+		}
+	}
+
+	if (iterations <= 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (benchmarks == NULL)
+	{
+		if (!add_corpus(&benchmarks, CHARM_BENCH_DIR))
+		{
+			return 2;
+		}
+
+		Benchmark generated = {
+			.name = copy_string("generated", strlen("generated")),
+			.source = generate_source(),
+			.run = false,
+		};
+		arrpush(benchmarks, generated);
+	}
+
+	bool debug_output = false;
+#if defined(DEBUG_PRINT_CODE) || defined(DEBUG_TRACE_EXECUTION)
+	debug_output = true;
+	fprintf(stderr, "warning: libcharm prints debug output, which is timed "
+					"too. Configure with -DCHARM_DEBUG_PRINT_CODE=OFF "
+					"-DCHARM_DEBUG_TRACE_EXECUTION=OFF to leave it out.\n");
+#endif
+
+	for (i32 i = 0; i < arrlen(benchmarks); i++)
+	{
+		for (i32 j = 0; j < iterations; j++)
+		{
+			run_once(&benchmarks[i]);
+		}
+	}
+
+	print_report(benchmarks, iterations);
+
+	if (json_path != NULL)
+	{
+		FILE *json = fopen(json_path, "w");
+
+		if (json == NULL)
+		{
+			printf("Could not open '%s'\n", json_path);
+			return 2;
+		}
+
+		write_json(json, benchmarks, iterations, debug_output);
+		fclose(json);
+	}
+
+	for (i32 i = 0; i < arrlen(benchmarks); i++)
+	{
+		for (i32 stage = 0; stage < STAGE_COUNT; stage++)
+		{
+			arrfree(benchmarks[i].times[stage]);
+		}
+
+		mem_free(benchmarks[i].name);
+		mem_free(benchmarks[i].source);
+	}
+
+	arrfree(benchmarks);
+}
@@ -0,0 +1,926 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "charm.h"
+
+#include "core/dyn_array.h"
+#include "core/memory.h"
+
+#include "ast/ast.h"
+
+// Differential fuzzer of the two engines. Each program is generated from its
+// own seed, so that a program can be generated again from its seed alone, and
+// only uses what both engines support: numbers, booleans and strings,
+// variables, bounded loops, and functions that only call the ones declared
+// before them, so that every program ends. Strings that feed their own
+// assignments may grow past the maximum length, which both engines report as
+// a runtime error.
+//
+// Each engine runs the program in a child process, which keeps crashes and
+// endless loops of one program from stopping the others. Programs on which
+// the engines print something different, or exit differently, are saved.
+// Times can be recorded, then compared with a later run to flag programs on
+// which an engine got slower.
+
+#define DEFAULT_COUNT 200
+#define DEFAULT_TIMEOUT 5 // Seconds
+#define DEFAULT_THRESHOLD 0.25
+// Slowdowns under this many milliseconds are left to noise
+#define MIN_SLOWDOWN_MS 1.0
+
+#define MAX_FUNCTIONS 4
+#define MAX_PARAMS 3
+#define MAX_DEPTH 3 // Of nested blocks and expressions
+#define MAX_ITERATIONS 6
+// Chunks hold at most 256 constants, and every literal and name may take one.
+// Blocks stop growing past this many, leaving room for their last statement.
+#define MAX_CONSTANTS 120
+
+typedef enum Type
+{
+	TYPE_NUMBER,
+	TYPE_BOOL,
+	TYPE_STRING,
+	TYPE_COUNT,
+} Type;
+
+typedef struct Variable
+{
+	char name[16];
+	Type type;
+	bool assignable; // Loop counters are only changed by their loop
+} Variable;
+
+typedef struct Generator
+{
+	u64 state;
+	char *source;
+	i32 indent;
+
+	Variable *scope;
+	i32 names; // Variables declared so far, which all get a name of their own
+	i32 constants; // Taken in the chunk being generated, roughly
+
+	i32 function_params[MAX_FUNCTIONS];
+	i32 functions; // Callable, a function only calls the ones before it
+} Generator;
+
+// splitmix64
+static u64 next_random(Generator *gen)
+{
+	u64 z = (gen->state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static i32 random_below(Generator *gen, i32 bound)
+{
+	return (i32)(next_random(gen) % (u64)bound);
+}
+
+static bool chance(Generator *gen, i32 percent)
+{
+	return random_below(gen, 100) < percent;
+}
+
+static void append(Generator *gen, const char *format, ...)
+{
+	char buffer[256];
+
+	va_list args;
+	va_start(args, format);
+	i32 len = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	// arraddnptr gives NULL for an empty array that doesn't grow
+	if (len > 0)
+	{
+		memcpy(arraddnptr(gen->source, len), buffer, len);
+	}
+}
+
+static void line(Generator *gen, const char *format, ...)
+{
+	char buffer[256];
+
+	va_list args;
+	va_start(args, format);
+	vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	append(gen, "%*s%s\n", gen->indent * 4, "", buffer);
+}
+
+static Variable *declare(Generator *gen, Type type, bool assignable)
+{
+	Variable variable = { .type = type, .assignable = assignable };
+	snprintf(variable.name, sizeof(variable.name), "v%d", gen->names++);
+	gen->constants += 1;
+	arrpush(gen->scope, variable);
+
+	return &arrlast(gen->scope);
+}
+
+// Returns NULL if no variable of the scope fits
+static Variable *pick_variable(Generator *gen, Type type, bool assignable)
+{
+	i32 count = 0;
+
+	for (i32 i = 0; i < arrlen(gen->scope); i++)
+	{
+		Variable *variable = &gen->scope[i];
+		count += variable->type == type &&
+				 (variable->assignable || !assignable);
+	}
+
+	if (count == 0)
+	{
+		return NULL;
+	}
+
+	i32 pick = random_below(gen, count);
+
+	for (i32 i = 0;; i++)
+	{
+		Variable *variable = &gen->scope[i];
+
+		if (variable->type == type && (variable->assignable || !assignable) &&
+			pick-- == 0)
+		{
+			return variable;
+		}
+	}
+}
+
+static void expression(Generator *gen, Type type, i32 depth);
+
+static void literal(Generator *gen, Type type)
+{
+	static const char *strings[] = { "", "a", "charm", "-", "42" };
+
+	gen->constants += type != TYPE_BOOL;
+
+	switch (type)
+	{
+		case TYPE_NUMBER:
+			append(gen, "%d", random_below(gen, 10));
+			break;
+
+		case TYPE_BOOL:
+			append(gen, chance(gen, 50) ? "true" : "false");
+			break;
+
+		case TYPE_STRING:
+			append(gen, "\"%s\"", strings[random_below(gen, 5)]);
+			break;
+
+		default:
+			UNREACHABLE();
+	}
+}
+
+static void call(Generator *gen, i32 depth)
+{
+	i32 function = random_below(gen, gen->functions);
+	gen->constants += 1;
+	append(gen, "f%d(", function);
+
+	for (i32 i = 0; i < gen->function_params[function]; i++)
+	{
+		append(gen, i > 0 ? ", " : "");
+		expression(gen, TYPE_NUMBER, depth + 1);
+	}
+
+	append(gen, ")");
+}
+
+static void number_expression(Generator *gen, i32 depth)
+{
+	static const char *operators[] = { "+", "-", "*", "/" };
+
+	i32 choice = random_below(gen, 10);
+
+	if (choice < 5)
+	{
+		append(gen, "(");
+		expression(gen, TYPE_NUMBER, depth + 1);
+		append(gen, " %s ", operators[random_below(gen, 4)]);
+		expression(gen, TYPE_NUMBER, depth + 1);
+		append(gen, ")");
+	}
+	else if (choice < 7 && gen->functions > 0)
+	{
+		call(gen, depth);
+	}
+	else
+	{
+		append(gen, "-");
+		expression(gen, TYPE_NUMBER, depth + 1);
+	}
+}
+
+static void bool_expression(Generator *gen, i32 depth)
+{
+	static const char *comparisons[] = { "<", "<=", ">", ">=", "==", "!=" };
+
+	i32 choice = random_below(gen, 10);
+
+	if (choice < 5)
+	{
+		append(gen, "(");
+		expression(gen, TYPE_NUMBER, depth + 1);
+		append(gen, " %s ", comparisons[random_below(gen, 6)]);
+		expression(gen, TYPE_NUMBER, depth + 1);
+		append(gen, ")");
+	}
+	else if (choice < 7)
+	{
+		append(gen, "(");
+		expression(gen, TYPE_BOOL, depth + 1);
+		append(gen, chance(gen, 50) ? " and " : " or ");
+		expression(gen, TYPE_BOOL, depth + 1);
+		append(gen, ")");
+	}
+	else if (choice < 8)
+	{
+		append(gen, "(");
+		expression(gen, TYPE_STRING, depth + 1);
+		append(gen, chance(gen, 50) ? " == " : " != ");
+		expression(gen, TYPE_STRING, depth + 1);
+		append(gen, ")");
+	}
+	else
+	{
+		append(gen, "not ");
+		expression(gen, TYPE_BOOL, depth + 1);
+	}
+}
+
+static void string_expression(Generator *gen, i32 depth)
+{
+	append(gen, "(");
+	expression(gen, TYPE_STRING, depth + 1);
+	append(gen, " + ");
+	expression(gen, TYPE_STRING, depth + 1);
+	append(gen, ")");
+}
+
+static void expression(Generator *gen, Type type, i32 depth)
+{
+	if (depth >= MAX_DEPTH || chance(gen, 30))
+	{
+		Variable *variable =
+			chance(gen, 60) ? pick_variable(gen, type, false) : NULL;
+
+		if (variable != NULL)
+		{
+			append(gen, "%s", variable->name);
+			gen->constants += 1;
+		}
+		else
+		{
+			literal(gen, type);
+		}
+
+		return;
+	}
+
+	switch (type)
+	{
+		case TYPE_NUMBER:
+			number_expression(gen, depth);
+			break;
+
+		case TYPE_BOOL:
+			bool_expression(gen, depth);
+			break;
+
+		case TYPE_STRING:
+			string_expression(gen, depth);
+			break;
+
+		default:
+			UNREACHABLE();
+	}
+}
+
+static void start_line(Generator *gen)
+{
+	append(gen, "%*s", gen->indent * 4, "");
+}
+
+static void statement(Generator *gen, i32 depth, bool in_function);
+
+static void block(Generator *gen, i32 depth, bool in_function)
+{
+	i32 scope = (i32)arrlen(gen->scope);
+	gen->indent += 1;
+
+	for (i32 i = random_below(gen, 4);
+		 i >= 0 && gen->constants < MAX_CONSTANTS; i--)
+	{
+		statement(gen, depth + 1, in_function);
+	}
+
+	gen->indent -= 1;
+	arrsetlen(gen->scope, scope);
+}
+
+static void print_statement(Generator *gen)
+{
+	start_line(gen);
+	append(gen, "print(");
+
+	for (i32 i = random_below(gen, 3); i >= 0; i--)
+	{
+		expression(gen, (Type)random_below(gen, TYPE_COUNT), 0);
+		append(gen, i > 0 ? ", " : "");
+	}
+
+	append(gen, ");\n");
+}
+
+static void statement(Generator *gen, i32 depth, bool in_function)
+{
+	i32 choice = random_below(gen, in_function ? 11 : 10);
+	bool nested = depth < MAX_DEPTH;
+
+	if (choice < 3)
+	{
+		Type type = (Type)random_below(gen, TYPE_COUNT);
+
+		start_line(gen);
+		append(gen, "var v%d = ", gen->names);
+		expression(gen, type, 0);
+		append(gen, ";\n");
+
+		// Only visible once its initializer is done
+		declare(gen, type, true);
+	}
+	else if (choice < 5 && arrlen(gen->scope) > 0)
+	{
+		Type type = (Type)random_below(gen, TYPE_COUNT);
+		Variable *variable = pick_variable(gen, type, true);
+
+		if (variable == NULL)
+		{
+			print_statement(gen);
+			return;
+		}
+
+		start_line(gen);
+		append(gen, "%s = ", variable->name);
+		gen->constants += 1;
+		expression(gen, type, 0);
+		append(gen, ";\n");
+	}
+	else if (choice == 7 && nested)
+	{
+		start_line(gen);
+		append(gen, "if ");
+		expression(gen, TYPE_BOOL, 0);
+		append(gen, " {\n");
+		block(gen, depth, in_function);
+
+		if (chance(gen, 50))
+		{
+			line(gen, "} else {");
+			block(gen, depth, in_function);
+		}
+
+		line(gen, "}");
+	}
+	else if (choice == 8 && nested)
+	{
+		i32 scope = (i32)arrlen(gen->scope);
+		Variable *counter = declare(gen, TYPE_NUMBER, false);
+		i32 iterations = random_below(gen, MAX_ITERATIONS + 1);
+		gen->constants += 5;
+
+		line(gen, "for var %s = 0; %s < %d; %s = %s + 1 {", counter->name,
+			 counter->name, iterations, counter->name, counter->name);
+		block(gen, depth, in_function);
+		line(gen, "}");
+
+		arrsetlen(gen->scope, scope);
+	}
+	else if (choice == 9 && nested)
+	{
+		// Declared first, the name must be copied before the scope grows
+		char name[16];
+		memcpy(name, declare(gen, TYPE_NUMBER, false)->name, sizeof(name));
+		i32 iterations = random_below(gen, MAX_ITERATIONS + 1);
+		gen->constants += 7;
+
+		line(gen, "var %s = 0;", name);
+		line(gen, "while %s < %d {", name, iterations);
+		block(gen, depth, in_function);
+		gen->indent += 1;
+		line(gen, "%s = %s + 1;", name, name);
+		gen->indent -= 1;
+		line(gen, "}");
+	}
+	else if (choice == 10 && nested)
+	{
+		start_line(gen);
+		append(gen, "if ");
+		expression(gen, TYPE_BOOL, 0);
+		append(gen, " {\n");
+		gen->indent += 1;
+		start_line(gen);
+		append(gen, "return ");
+		expression(gen, TYPE_NUMBER, 0);
+		append(gen, ";\n");
+		gen->indent -= 1;
+		line(gen, "}");
+	}
+	else
+	{
+		print_statement(gen);
+	}
+}
+
+static void function(Generator *gen)
+{
+	Variable *outer = gen->scope;
+	i32 outer_constants = gen->constants;
+	gen->scope = NULL;
+	gen->constants = 0;
+
+	i32 params = random_below(gen, MAX_PARAMS + 1);
+	start_line(gen);
+	append(gen, "function f%d(", gen->functions);
+
+	for (i32 i = 0; i < params; i++)
+	{
+		append(gen, "%s%s", i > 0 ? ", " : "",
+			   declare(gen, TYPE_NUMBER, true)->name);
+	}
+
+	append(gen, ") {\n");
+	block(gen, 0, true);
+
+	gen->indent += 1;
+	start_line(gen);
+	append(gen, "return ");
+	expression(gen, TYPE_NUMBER, 0);
+	append(gen, ";\n");
+	gen->indent -= 1;
+
+	line(gen, "}");
+	line(gen, "");
+
+	arrfree(gen->scope);
+	gen->scope = outer;
+	gen->constants = outer_constants + 1;
+
+	gen->function_params[gen->functions++] = params;
+}
+
+// Returns a string to free with mem_free
+static char *generate_program(u64 seed)
+{
+	Generator gen = { .state = seed };
+
+	for (i32 i = random_below(&gen, MAX_FUNCTIONS + 1); i > 0; i--)
+	{
+		function(&gen);
+	}
+
+	for (i32 i = 4 + random_below(&gen, 9);
+		 i > 0 && gen.constants < MAX_CONSTANTS; i--)
+	{
+		statement(&gen, 0, false);
+	}
+
+	for (i32 i = 0; i < arrlen(gen.scope); i++)
+	{
+		line(&gen, "print(%s);", gen.scope[i].name);
+	}
+
+	arrpush(gen.source, '\0');
+
+	char *source = mem_malloc(arrlen(gen.source));
+	memcpy(source, gen.source, arrlen(gen.source));
+
+	arrfree(gen.source);
+	arrfree(gen.scope);
+
+	return source;
+}
+
+typedef enum Engine
+{
+	ENGINE_TREEWALK,
+	ENGINE_VM,
+	ENGINE_COUNT,
+} Engine;
+
+static const char *engine_names[ENGINE_COUNT] = { "treewalk", "vm" };
+
+typedef struct Run
+{
+	char *output; // Dynamic array, not terminated
+	i32 status; // Exit code, or the negated signal that killed the child
+	f64 ms; // Of the engine alone, negative if the child didn't tell
+} Run;
+
+static f64 now_ms()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static void run_child(const char *source, Engine engine, i32 output_fd,
+					  i32 time_fd, i32 timeout)
+{
+	dup2(output_fd, STDOUT_FILENO);
+	alarm(timeout);
+
+	CharmVM *charm = charm_vm_new();
+	Program program = charm_parse(charm, source);
+	InterpretResult result;
+
+	f64 start = now_ms();
+
+	if (engine == ENGINE_TREEWALK)
+	{
+		result = charm_run_treewalk(charm, program);
+	}
+	else
+	{
+		result = charm_run(charm, program);
+	}
+
+	f64 ms = now_ms() - start;
+
+	fflush(stdout);
+	UNUSED(write(time_fd, &ms, sizeof(ms)));
+
+	_exit(result == INTERPRET_OK ? 0 : 1);
+}
+
+static void read_all(i32 fd, char **buffer)
+{
+	char chunk[4096];
+	isize len;
+
+	while ((len = read(fd, chunk, sizeof(chunk))) != 0)
+	{
+		if (len < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (len < 0)
+		{
+			return;
+		}
+
+		memcpy(arraddnptr(*buffer, len), chunk, len);
+	}
+}
+
+static bool has_prefix(const char *line, i32 len, const char *prefix)
+{
+	i32 prefix_len = (i32)strlen(prefix);
+	return len >= prefix_len && memcmp(line, prefix, prefix_len) == 0;
+}
+
+// Only the vm follows runtime errors with a stack trace, which is left out so
+// that the outputs can be compared
+static void strip_stack_trace(Run *run)
+{
+	i32 len = (i32)arrlen(run->output);
+
+	while (len > 0)
+	{
+		i32 start = len - 1;
+
+		while (start > 0 && run->output[start - 1] != '\n')
+		{
+			start -= 1;
+		}
+
+		const char *line = &run->output[start];
+
+		if (!has_prefix(line, len - start, "[line ") &&
+			!has_prefix(line, len - start, "... "))
+		{
+			break;
+		}
+
+		len = start;
+	}
+
+	arrsetlen(run->output, len);
+}
+
+static Run run_engine(const char *source, Engine engine, i32 timeout)
+{
+	Run run = { .output = NULL, .status = 0, .ms = -1 };
+
+	i32 output[2];
+	i32 time[2];
+
+	if (pipe(output) != 0 || pipe(time) != 0)
+	{
+		printf("Could not create pipes\n");
+		exit(2);
+	}
+
+	fflush(stdout);
+	pid_t child = fork();
+
+	if (child == 0)
+	{
+		close(output[0]);
+		close(time[0]);
+		run_child(source, engine, output[1], time[1], timeout);
+	}
+
+	close(output[1]);
+	close(time[1]);
+
+	read_all(output[0], &run.output);
+
+	f64 ms;
+	if (read(time[0], &ms, sizeof(ms)) == sizeof(ms))
+	{
+		run.ms = ms;
+	}
+
+	close(output[0]);
+	close(time[0]);
+
+	i32 status;
+	waitpid(child, &status, 0);
+
+	run.status = WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+
+	if (engine == ENGINE_VM && run.status == 1)
+	{
+		strip_stack_trace(&run);
+	}
+
+	return run;
+}
+
+static bool same_runs(const Run *a, const Run *b)
+{
+	return a->status == b->status &&
+		   arrlen(a->output) == arrlen(b->output) &&
+		   memcmp(a->output, b->output, arrlen(a->output)) == 0;
+}
+
+static void save_program(const char *directory, u64 seed, const char *source,
+						 const Run *runs)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "%s/divergence_%llu.charm", directory,
+			 (unsigned long long)seed);
+
+	FILE *file = fopen(path, "w");
+
+	if (file == NULL)
+	{
+		printf("Could not save '%s'\n", path);
+		return;
+	}
+
+	fprintf(file, "%s", source);
+
+	for (i32 engine = 0; engine < ENGINE_COUNT; engine++)
+	{
+		const Run *run = &runs[engine];
+		fprintf(file, "\n// %s exited with %d, printing:\n",
+				engine_names[engine], run->status);
+		fprintf(file, "/*\n%.*s*/\n", (i32)arrlen(run->output), run->output);
+	}
+
+	fclose(file);
+
+	printf("  saved to %s\n", path);
+}
+
+// Times of an earlier run, as written by --record
+typedef struct Baseline
+{
+	u64 seed;
+	f64 ms[ENGINE_COUNT];
+} Baseline;
+
+static Baseline *read_baseline(const char *path)
+{
+	FILE *file = fopen(path, "r");
+
+	if (file == NULL)
+	{
+		printf("Could not read '%s'\n", path);
+		exit(2);
+	}
+
+	Baseline *baseline = NULL;
+	unsigned long long seed;
+	f64 treewalk;
+	f64 vm;
+
+	while (fscanf(file, "%llu %lf %lf", &seed, &treewalk, &vm) == 3)
+	{
+		Baseline entry = { .seed = seed, .ms = { treewalk, vm } };
+		arrpush(baseline, entry);
+	}
+
+	fclose(file);
+
+	return baseline;
+}
+
+static const Baseline *find_baseline(const Baseline *baseline, u64 seed)
+{
+	for (i32 i = 0; i < arrlen(baseline); i++)
+	{
+		if (baseline[i].seed == seed)
+		{
+			return &baseline[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void usage(const char *program)
+{
+	printf("Usage: %s [--seed <n>] [--count <n>] [--timeout <seconds>] "
+		   "[--save <directory>] [--record <file>] [--baseline <file>] "
+		   "[--threshold <ratio>] [--print]\n",
+		   program);
+}
+
+int main(int argc, char **argv)
+{
+	u64 first_seed = (u64)time(NULL);
+	i32 count = DEFAULT_COUNT;
+	i32 timeout = DEFAULT_TIMEOUT;
+	f64 threshold = DEFAULT_THRESHOLD;
+	const char *save_directory = ".";
+	const char *record_path = NULL;
+	const char *baseline_path = NULL;
+	bool print_only = false;
+
+	for (i32 i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+
+		if (strcmp(argv[i], "--seed") == 0 && has_value)
+		{
+			first_seed = strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--count") == 0 && has_value)
+		{
+			count = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--timeout") == 0 && has_value)
+		{
+			timeout = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--save") == 0 && has_value)
+		{
+			save_directory = argv[++i];
+		}
+		else if (strcmp(argv[i], "--record") == 0 && has_value)
+		{
+			record_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--baseline") == 0 && has_value)
+		{
+			baseline_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--threshold") == 0 && has_value)
+		{
+			threshold = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--print") == 0)
+		{
+			print_only = true;
+		}
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (print_only)
+	{
+		char *source = generate_program(first_seed);
+		printf("%s", source);
+		mem_free(source);
+		return 0;
+	}
+
+#if defined(DEBUG_PRINT_CODE) || defined(DEBUG_TRACE_EXECUTION)
+	printf("libcharm prints debug output, which the engines don't share. "
+		   "Configure with -DCHARM_DEBUG_PRINT_CODE=OFF "
+		   "-DCHARM_DEBUG_TRACE_EXECUTION=OFF.\n");
+	return 1;
+#endif
+
+	Baseline *baseline =
+		baseline_path != NULL ? read_baseline(baseline_path) : NULL;
+	FILE *record = NULL;
+
+	if (record_path != NULL && (record = fopen(record_path, "w")) == NULL)
+	{
+		printf("Could not write '%s'\n", record_path);
+		return 2;
+	}
+
+	printf("Seeds %llu to %llu\n", (unsigned long long)first_seed,
+		   (unsigned long long)(first_seed + count - 1));
+
+	i32 divergences = 0;
+	i32 regressions = 0;
+	i32 timeouts = 0;
+	f64 totals[ENGINE_COUNT] = { 0 };
+
+	for (i32 i = 0; i < count; i++)
+	{
+		u64 seed = first_seed + i;
+		char *source = generate_program(seed);
+
+		Run runs[ENGINE_COUNT];
+
+		for (i32 engine = 0; engine < ENGINE_COUNT; engine++)
+		{
+			runs[engine] = run_engine(source, engine, timeout);
+			totals[engine] += MAX(runs[engine].ms, 0);
+		}
+
+		if (runs[ENGINE_TREEWALK].status == -SIGALRM ||
+			runs[ENGINE_VM].status == -SIGALRM)
+		{
+			timeouts += 1;
+			printf("seed %llu: timed out\n", (unsigned long long)seed);
+		}
+		else if (!same_runs(&runs[ENGINE_TREEWALK], &runs[ENGINE_VM]))
+		{
+			divergences += 1;
+			printf("seed %llu: the engines diverge\n",
+				   (unsigned long long)seed);
+			save_program(save_directory, seed, source, runs);
+		}
+
+		const Baseline *before = find_baseline(baseline, seed);
+
+		for (i32 engine = 0; engine < ENGINE_COUNT && before != NULL; engine++)
+		{
+			f64 ms = runs[engine].ms;
+			f64 old = before->ms[engine];
+
+			if (old >= 0 && ms > old * (1 + threshold) &&
+				ms - old > MIN_SLOWDOWN_MS)
+			{
+				regressions += 1;
+				printf("seed %llu: %s went from %.2f to %.2f ms\n",
+					   (unsigned long long)seed, engine_names[engine], old,
+					   ms);
+			}
+		}
+
+		if (record != NULL)
+		{
+			fprintf(record, "%llu %.4f %.4f\n", (unsigned long long)seed,
+					runs[ENGINE_TREEWALK].ms, runs[ENGINE_VM].ms);
+		}
+
+		for (i32 engine = 0; engine < ENGINE_COUNT; engine++)
+		{
+			arrfree(runs[engine].output);
+		}
+
+		mem_free(source);
+	}
+
+	if (record != NULL)
+	{
+		fclose(record);
+	}
+
+	arrfree(baseline);
+
+	printf("%d programs, %d divergences, %d regressions, %d timeouts\n",
+		   count, divergences, regressions, timeouts);
+	printf("treewalk %.2f ms, vm %.2f ms\n", totals[ENGINE_TREEWALK],
+		   totals[ENGINE_VM]);
+
+	return divergences > 0 || regressions > 0 ? 1 : 0;
+}
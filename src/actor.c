@@ -0,0 +1,433 @@
+#include "actor.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "core/cell.h"
+#include "core/dyn_array.h"
+#include "core/gc.h"
+#include "core/memory.h"
+
+typedef struct Message
+{
+	_Atomic(struct Message *) next;
+	Value value;
+} Message;
+
+// Intrusive multi-producer single-consumer queue: senders only swap `head`,
+// and `tail` is only ever touched by the owner. The stub keeps the queue from
+// being empty, so that pushes never have to deal with a NULL head.
+typedef struct Mailbox
+{
+	_Atomic(Message *) head;
+	Message *tail;
+	Message stub;
+
+	// Only used to put the owner to sleep while the mailbox is empty
+	atomic_bool waiting;
+	atomic_bool closed;
+	pthread_mutex_t lock;
+	pthread_cond_t signal;
+} Mailbox;
+
+struct Actor
+{
+	Mailbox mailbox;
+	ActorRef *ref;
+	CharmVM *charm;
+	Value function;
+	pthread_t thread;
+
+	Actor *root; // Owns every actor of the tree, and itself
+
+	// Only used by roots
+	pthread_mutex_t lock;
+	Actor **spawned;
+	bool closing;
+	// Handles of the actors already joined, which scripts may still hold
+	ActorRef **retired;
+};
+
+static void mailbox_init(Mailbox *mailbox)
+{
+	atomic_init(&mailbox->stub.next, NULL);
+	atomic_init(&mailbox->head, &mailbox->stub);
+	mailbox->tail = &mailbox->stub;
+
+	atomic_init(&mailbox->waiting, false);
+	atomic_init(&mailbox->closed, false);
+	pthread_mutex_init(&mailbox->lock, NULL);
+	pthread_cond_init(&mailbox->signal, NULL);
+}
+
+static void mailbox_push(Mailbox *mailbox, Message *message)
+{
+	atomic_store_explicit(&message->next, NULL, memory_order_relaxed);
+	Message *previous = atomic_exchange(&mailbox->head, message);
+	atomic_store_explicit(&previous->next, message, memory_order_release);
+}
+
+// Returns NULL when the mailbox is empty, but also while a sender is halfway
+// through a push
+static Message *mailbox_pop(Mailbox *mailbox)
+{
+	Message *tail = mailbox->tail;
+	Message *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+	if (tail == &mailbox->stub)
+	{
+		if (next == NULL)
+		{
+			return NULL;
+		}
+
+		mailbox->tail = next;
+		tail = next;
+		next = atomic_load_explicit(&next->next, memory_order_acquire);
+	}
+
+	if (next != NULL)
+	{
+		mailbox->tail = next;
+		return tail;
+	}
+
+	if (tail != atomic_load(&mailbox->head))
+	{
+		return NULL;
+	}
+
+	// `tail` is the last message, so the stub has to take its place first
+	mailbox_push(mailbox, &mailbox->stub);
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+	if (next != NULL)
+	{
+		mailbox->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+static bool mailbox_is_empty(Mailbox *mailbox)
+{
+	return mailbox->tail == &mailbox->stub &&
+		   atomic_load(&mailbox->head) == &mailbox->stub;
+}
+
+static void mailbox_wake(Mailbox *mailbox)
+{
+	pthread_mutex_lock(&mailbox->lock);
+	pthread_cond_signal(&mailbox->signal);
+	pthread_mutex_unlock(&mailbox->lock);
+}
+
+static void mailbox_send(Mailbox *mailbox, Message *message)
+{
+	mailbox_push(mailbox, message);
+
+	if (atomic_load(&mailbox->waiting))
+	{
+		mailbox_wake(mailbox);
+	}
+}
+
+static void mailbox_close(Mailbox *mailbox)
+{
+	atomic_store(&mailbox->closed, true);
+	mailbox_wake(mailbox);
+}
+
+// Returns NULL once the mailbox is closed and empty
+static Message *mailbox_receive(Mailbox *mailbox)
+{
+	for (;;)
+	{
+		Message *message = mailbox_pop(mailbox);
+
+		if (message != NULL)
+		{
+			return message;
+		}
+
+		// Senders check `waiting` after pushing, and we check the queue after
+		// setting it, so that one of us always sees the other
+		pthread_mutex_lock(&mailbox->lock);
+		atomic_store(&mailbox->waiting, true);
+
+		while (mailbox_is_empty(mailbox) && !atomic_load(&mailbox->closed))
+		{
+			pthread_cond_wait(&mailbox->signal, &mailbox->lock);
+		}
+
+		atomic_store(&mailbox->waiting, false);
+		pthread_mutex_unlock(&mailbox->lock);
+
+		if (mailbox_is_empty(mailbox))
+		{
+			return NULL;
+		}
+	}
+}
+
+static void mailbox_free(Mailbox *mailbox)
+{
+	Message *message;
+	while ((message = mailbox_pop(mailbox)) != NULL)
+	{
+		gc_release(message->value);
+		mem_free(message);
+	}
+
+	pthread_mutex_destroy(&mailbox->lock);
+	pthread_cond_destroy(&mailbox->signal);
+}
+
+static Actor *actor_new(CharmVM *charm, Actor *root)
+{
+	Actor *actor = mem_malloc(sizeof(Actor));
+	mailbox_init(&actor->mailbox);
+	actor->ref = actor_ref_new(actor);
+	actor->charm = charm;
+	actor->function = value_nil();
+	actor->root = root != NULL ? root : actor;
+
+	pthread_mutex_init(&actor->lock, NULL);
+	actor->spawned = NULL;
+	actor->closing = false;
+	actor->retired = NULL;
+
+	charm->actor = actor;
+
+	return actor;
+}
+
+// Handles outlive their actor until the root goes, so that sends to an actor
+// that is over fail instead of reaching freed memory
+static void actor_free(Actor *actor)
+{
+	actor->charm->actor = NULL;
+	actor->ref->actor = NULL;
+
+	if (actor->root != actor)
+	{
+		arrpush(actor->root->retired, actor->ref);
+	}
+	else
+	{
+		for (i32 i = 0; i < arrlen(actor->retired); i++)
+		{
+			mem_free(actor->retired[i]);
+		}
+
+		arrfree(actor->retired);
+		mem_free(actor->ref);
+	}
+
+	mailbox_free(&actor->mailbox);
+	pthread_mutex_destroy(&actor->lock);
+	arrfree(actor->spawned);
+	mem_free(actor);
+}
+
+// The root of a program becomes an actor the first time it needs to be one
+static Actor *current_actor()
+{
+	CharmVM *charm = charm_current();
+
+	if (charm->actor == NULL)
+	{
+		actor_new(charm, NULL);
+	}
+
+	return charm->actor;
+}
+
+// Every mailbox of the tree then returns nil once empty, and so do those of
+// the actors spawned afterwards
+static void close_tree(Actor *root)
+{
+	pthread_mutex_lock(&root->lock);
+	root->closing = true;
+	for (i32 i = 0; i < arrlen(root->spawned); i++)
+	{
+		mailbox_close(&root->spawned[i]->mailbox);
+	}
+	mailbox_close(&root->mailbox);
+	pthread_mutex_unlock(&root->lock);
+}
+
+static void *actor_main(void *arg)
+{
+	Actor *actor = arg;
+
+	// Others may be waiting for replies that will never come
+	if (charm_call(actor->charm, actor->function, NULL, 0, NULL) !=
+		INTERPRET_OK)
+	{
+		close_tree(actor->root);
+	}
+
+	return NULL;
+}
+
+void actor_join_all(CharmVM *charm)
+{
+	Actor *root = charm->actor;
+
+	if (root == NULL || root->root != root)
+	{
+		return;
+	}
+
+	close_tree(root);
+
+	// Actors may keep spawning others in the meantime
+	for (i32 i = 0;; i++)
+	{
+		pthread_mutex_lock(&root->lock);
+		Actor *actor = i < arrlen(root->spawned) ? root->spawned[i] : NULL;
+		pthread_mutex_unlock(&root->lock);
+
+		if (actor == NULL)
+		{
+			break;
+		}
+
+		pthread_join(actor->thread, NULL);
+	}
+
+	for (i32 i = 0; i < arrlen(root->spawned); i++)
+	{
+		CharmVM *actor_charm = root->spawned[i]->charm;
+		actor_free(root->spawned[i]);
+		charm_vm_free(actor_charm);
+	}
+
+	arrsetlen(root->spawned, 0);
+	root->closing = false;
+	atomic_store(&root->mailbox.closed, false);
+}
+
+void actor_shutdown(CharmVM *charm)
+{
+	Actor *actor = charm->actor;
+
+	if (actor == NULL || actor->root != actor)
+	{
+		return;
+	}
+
+	actor_join_all(charm);
+	actor_free(actor);
+}
+
+static Result native_spawn_actor(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	if (!is_compiled_function(args[0]))
+	{
+		printf("Actors can only run functions compiled for the bytecode vm\n");
+		return result_none();
+	}
+
+	Actor *root = current_actor()->root;
+
+	Actor *actor = actor_new(charm_vm_new_child(charm_current()), root);
+	actor->function = args[0];
+
+	// Registered and started at once, so that joins never see an actor
+	// without a thread
+	pthread_mutex_lock(&root->lock);
+	arrpush(root->spawned, actor);
+
+	if (root->closing)
+	{
+		mailbox_close(&actor->mailbox);
+	}
+
+	if (pthread_create(&actor->thread, NULL, actor_main, actor) != 0)
+	{
+		// Retires the handle, which other actors may retire at the same time
+		arrsetlen(root->spawned, arrlen(root->spawned) - 1);
+		CharmVM *actor_charm = actor->charm;
+		actor_free(actor);
+		pthread_mutex_unlock(&root->lock);
+
+		charm_vm_free(actor_charm);
+		printf("Could not start an actor\n");
+
+		return result_none();
+	}
+
+	pthread_mutex_unlock(&root->lock);
+
+	return result_return(value_cell((Cell *)actor->ref));
+}
+
+static Result native_send(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	if (!is_actor_ref(args[0]))
+	{
+		printf("Messages can only be sent to actors\n");
+		return result_none();
+	}
+
+	Actor *actor = as_actor_ref(args[0])->actor;
+
+	if (actor == NULL)
+	{
+		return result_return(value_bool(false));
+	}
+
+	Value copy;
+	if (!value_copy_deep(args[1], &copy))
+	{
+		return result_return(value_bool(false));
+	}
+
+	Message *message = mem_malloc(sizeof(Message));
+	message->value = copy;
+	mailbox_send(&actor->mailbox, message);
+
+	return result_return(value_bool(true));
+}
+
+static Result native_receive(Value *args, i32 arg_count)
+{
+	UNUSED(args);
+	UNUSED(arg_count);
+
+	Message *message = mailbox_receive(&current_actor()->mailbox);
+
+	if (message == NULL)
+	{
+		return result_none();
+	}
+
+	Value value = message->value;
+	mem_free(message);
+
+	gc_adopt(value);
+	return result_return(value);
+}
+
+static Result native_self(Value *args, i32 arg_count)
+{
+	UNUSED(args);
+	UNUSED(arg_count);
+
+	return result_return(value_cell((Cell *)current_actor()->ref));
+}
+
+void actor_register_natives(NativeRegistry *registry)
+{
+	native_register(registry, "spawn_actor", native_spawn_actor, 1);
+	native_register(registry, "send", native_send, 2);
+	native_register(registry, "receive", native_receive, 0);
+	native_register(registry, "self", native_self, 0);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "charm.h"
+
+typedef struct Actor Actor;
+
+// Actors run a script function on a thread of their own, on an instance that
+// shares nothing with the others but compiled functions, which never change.
+// They talk through messages, copied when sent.
+//
+// spawn_actor(fn) starts an actor that sees the functions declared by its
+// spawner, but none of its other globals. send(actor, value) never blocks,
+// while receive() waits for a message, and returns nil once the mailbox is
+// empty and either the run that started the actors is over, or one of them
+// failed with a runtime error. self() is the actor running the caller, which
+// the root of a program is as well.
+void actor_register_natives(NativeRegistry *registry);
+
+// Actors belong to the instance at the root of their spawn tree, which waits
+// for them to finish before its run returns. Sends to their handles then
+// return false.
+void actor_join_all(CharmVM *charm);
+
+// Called when `charm` is freed
+void actor_shutdown(CharmVM *charm);
@@ -3,10 +3,13 @@
 #include <string.h>
 
 #include "core/common.h"
+#include "core/dyn_array.h"
+#include "core/memory.h"
+#include "core/metrics.h"
 
 static Expr *make_expr(ExprType type)
 {
-	Expr *ptr = malloc(sizeof(Expr));
+	Expr *ptr = mem_malloc_as(MEM_AST, sizeof(Expr));
 
 	if (ptr == NULL)
 	{
@@ -14,6 +17,8 @@ static Expr *make_expr(ExprType type)
 	}
 
 	ptr->type = type;
+	ptr->location = (Location){ 0 };
+	metrics_add(METRIC_AST_NODES, 1);
 	return ptr;
 }
 
@@ -69,11 +74,11 @@ Expr *ast_expr_boolean_literal(bool value)
 	return node;
 }
 
-Expr *ast_expr_cell_literal(struct Cell *value)
+Expr *ast_expr_string_literal(Value value)
 {
-	Expr *node = make_expr(EXPR_CELL_LITERAL);
+	Expr *node = make_expr(EXPR_STRING_LITERAL);
 
-	node->as.cell = value;
+	node->as.string = value;
 
 	return node;
 }
@@ -111,9 +116,80 @@ Expr *ast_expr_call(Expr *callee, Expr **arguments)
 	return node;
 }
 
+Expr *ast_expr_map_literal(Expr **keys, Expr **values)
+{
+	Expr *node = make_expr(EXPR_MAP_LITERAL);
+
+	node->as.map = (MapLiteralExpr){
+		.keys = keys,
+		.values = values,
+	};
+
+	return node;
+}
+
+Expr *ast_expr_array_literal(Expr **items)
+{
+	Expr *node = make_expr(EXPR_ARRAY_LITERAL);
+
+	node->as.array = (ArrayLiteralExpr){
+		.items = items,
+	};
+
+	return node;
+}
+
+Expr *ast_expr_index(Expr *target, Expr *index)
+{
+	Expr *node = make_expr(EXPR_INDEX);
+
+	node->as.index = (IndexExpr){
+		.target = target,
+		.index = index,
+	};
+
+	return node;
+}
+
+Expr *ast_expr_set_index(Expr *target, Expr *index, Expr *value)
+{
+	Expr *node = make_expr(EXPR_SET_INDEX);
+
+	node->as.set_index = (SetIndexExpr){
+		.target = target,
+		.index = index,
+		.value = value,
+	};
+
+	return node;
+}
+
+Expr *ast_expr_yield(Expr *value)
+{
+	Expr *node = make_expr(EXPR_YIELD);
+
+	node->as.yield = (YieldExpr){
+		.value = value,
+	};
+
+	return node;
+}
+
+Expr *ast_expr_resume(Expr *coroutine, Expr *value)
+{
+	Expr *node = make_expr(EXPR_RESUME);
+
+	node->as.resume = (ResumeExpr){
+		.coroutine = coroutine,
+		.value = value,
+	};
+
+	return node;
+}
+
 static Stmt *make_stmt(StmtType type)
 {
-	Stmt *ptr = malloc(sizeof(Stmt));
+	Stmt *ptr = mem_malloc_as(MEM_AST, sizeof(Stmt));
 
 	if (ptr == NULL)
 	{
@@ -121,6 +197,8 @@ static Stmt *make_stmt(StmtType type)
 	}
 
 	ptr->type = type;
+	ptr->location = (Location){ 0 };
+	metrics_add(METRIC_AST_NODES, 1);
 	return ptr;
 }
 
@@ -200,3 +278,183 @@ Stmt *ast_stmt_return(Expr *expr)
 
 	return node;
 }
+
+Stmt *ast_stmt_for_in(String *name, Expr *iterable, Stmt *body)
+{
+	Stmt *node = make_stmt(STMT_FOR_IN);
+
+	node->as.for_in = (ForInStmt){
+		.name = name,
+		.iterable = iterable,
+		.body = body,
+	};
+
+	return node;
+}
+
+Stmt *ast_stmt_delete(Expr *target, Expr *index)
+{
+	Stmt *node = make_stmt(STMT_DELETE);
+
+	node->as.delete_stmt = (DeleteStmt){
+		.target = target,
+		.index = index,
+	};
+
+	return node;
+}
+
+static void free_expr(Expr *expr);
+static void free_stmt(Stmt *stmt);
+
+static void free_exprs(Expr **exprs)
+{
+	for (i32 i = 0; i < arrlen(exprs); i++)
+	{
+		free_expr(exprs[i]);
+	}
+
+	arrfree(exprs);
+}
+
+static void free_stmts(Stmt **stmts)
+{
+	for (i32 i = 0; i < arrlen(stmts); i++)
+	{
+		free_stmt(stmts[i]);
+	}
+
+	arrfree(stmts);
+}
+
+static void free_expr(Expr *expr)
+{
+	if (expr == NULL)
+	{
+		return;
+	}
+
+	switch (expr->type)
+	{
+		case EXPR_BINARY:
+			free_expr(expr->as.binary.left);
+			free_expr(expr->as.binary.right);
+			break;
+
+		case EXPR_GROUPING:
+			free_expr(expr->as.grouping.expr);
+			break;
+
+		case EXPR_UNARY:
+			free_expr(expr->as.unary.right);
+			break;
+
+		case EXPR_ASSIGNMENT:
+			free_expr(expr->as.assignment.value);
+			break;
+
+		case EXPR_CALL:
+			free_expr(expr->as.call.callee);
+			free_exprs(expr->as.call.arguments);
+			break;
+
+		case EXPR_MAP_LITERAL:
+			free_exprs(expr->as.map.keys);
+			free_exprs(expr->as.map.values);
+			break;
+
+		case EXPR_ARRAY_LITERAL:
+			free_exprs(expr->as.array.items);
+			break;
+
+		case EXPR_INDEX:
+			free_expr(expr->as.index.target);
+			free_expr(expr->as.index.index);
+			break;
+
+		case EXPR_SET_INDEX:
+			free_expr(expr->as.set_index.target);
+			free_expr(expr->as.set_index.index);
+			free_expr(expr->as.set_index.value);
+			break;
+
+		case EXPR_YIELD:
+			free_expr(expr->as.yield.value);
+			break;
+
+		case EXPR_RESUME:
+			free_expr(expr->as.resume.coroutine);
+			free_expr(expr->as.resume.value);
+			break;
+
+		// Strings are interned, and belong to the string table
+		case EXPR_BOOLEAN_LITERAL:
+		case EXPR_NUMBER_LITERAL:
+		case EXPR_STRING_LITERAL:
+		case EXPR_IDENTIFIER:
+			break;
+	}
+
+	mem_free(expr);
+}
+
+static void free_stmt(Stmt *stmt)
+{
+	if (stmt == NULL)
+	{
+		return;
+	}
+
+	switch (stmt->type)
+	{
+		case STMT_EXPR:
+			free_expr(stmt->as.expression.expr);
+			break;
+
+		case STMT_VAR_DECL:
+			free_expr(stmt->as.var_decl.expr);
+			break;
+
+		case STMT_FUNCTION_DECL:
+			arrfree(stmt->as.function_decl.args);
+			free_stmt(stmt->as.function_decl.body);
+			break;
+
+		case STMT_BLOCK:
+			free_stmts(stmt->as.block.statements);
+			break;
+
+		case STMT_IF:
+			free_expr(stmt->as.if_stmt.cond);
+			free_stmt(stmt->as.if_stmt.then_branch);
+			free_stmt(stmt->as.if_stmt.else_branch);
+			break;
+
+		case STMT_WHILE:
+			free_expr(stmt->as.while_stmt.cond);
+			free_stmt(stmt->as.while_stmt.body);
+			break;
+
+		case STMT_RETURN:
+			free_expr(stmt->as.return_stmt.expr);
+			break;
+
+		case STMT_FOR_IN:
+			free_expr(stmt->as.for_in.iterable);
+			free_stmt(stmt->as.for_in.body);
+			break;
+
+		case STMT_DELETE:
+			free_expr(stmt->as.delete_stmt.target);
+			free_expr(stmt->as.delete_stmt.index);
+			break;
+	}
+
+	mem_free(stmt);
+}
+
+void ast_program_free(Program *program)
+{
+	free_stmts(program->statements);
+	program->statements = NULL;
+}
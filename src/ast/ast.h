@@ -13,10 +13,16 @@ typedef enum ExprType
 	EXPR_UNARY,
 	EXPR_BOOLEAN_LITERAL,
 	EXPR_NUMBER_LITERAL,
-	EXPR_CELL_LITERAL,
+	EXPR_STRING_LITERAL,
 	EXPR_IDENTIFIER,
 	EXPR_ASSIGNMENT,
 	EXPR_CALL,
+	EXPR_MAP_LITERAL,
+	EXPR_ARRAY_LITERAL,
+	EXPR_INDEX,
+	EXPR_SET_INDEX,
+	EXPR_YIELD,
+	EXPR_RESUME,
 } ExprType;
 
 struct Expr;
@@ -51,6 +57,42 @@ typedef struct CallExpr
 	struct Expr **arguments;
 } CallExpr;
 
+typedef struct MapLiteralExpr
+{
+	struct Expr **keys;
+	struct Expr **values;
+} MapLiteralExpr;
+
+typedef struct ArrayLiteralExpr
+{
+	struct Expr **items;
+} ArrayLiteralExpr;
+
+typedef struct IndexExpr
+{
+	struct Expr *target;
+	struct Expr *index;
+} IndexExpr;
+
+typedef struct SetIndexExpr
+{
+	struct Expr *target;
+	struct Expr *index;
+	struct Expr *value;
+} SetIndexExpr;
+
+// `value` is NULL when nothing is passed
+typedef struct YieldExpr
+{
+	struct Expr *value;
+} YieldExpr;
+
+typedef struct ResumeExpr
+{
+	struct Expr *coroutine;
+	struct Expr *value;
+} ResumeExpr;
+
 typedef struct Expr
 {
 	union
@@ -60,13 +102,20 @@ typedef struct Expr
 		UnaryExpr unary;
 		AssignmentExpr assignment;
 		CallExpr call;
+		MapLiteralExpr map;
+		ArrayLiteralExpr array;
+		IndexExpr index;
+		SetIndexExpr set_index;
+		YieldExpr yield;
+		ResumeExpr resume;
 		double number;
 		bool boolean;
-		Cell *cell;
+		Value string;
 		String *identifier;
 	} as;
 
 	ExprType type;
+	Location location;
 } Expr;
 
 typedef enum StmtType
@@ -78,6 +127,8 @@ typedef enum StmtType
 	STMT_IF,
 	STMT_WHILE,
 	STMT_RETURN,
+	STMT_FOR_IN,
+	STMT_DELETE,
 } StmtType;
 
 struct Stmt;
@@ -123,6 +174,19 @@ typedef struct ReturnStmt
 	Expr *expr;
 } ReturnStmt;
 
+typedef struct ForInStmt
+{
+	String *name;
+	Expr *iterable;
+	struct Stmt *body;
+} ForInStmt;
+
+typedef struct DeleteStmt
+{
+	Expr *target;
+	Expr *index;
+} DeleteStmt;
+
 typedef struct Stmt
 {
 	union
@@ -134,26 +198,35 @@ typedef struct Stmt
 		BlockStmt block;
 		WhileStmt while_stmt;
 		ReturnStmt return_stmt;
+		ForInStmt for_in;
+		DeleteStmt delete_stmt;
 	} as;
 
 	StmtType type;
+	Location location;
 } Stmt;
 
 typedef struct Program
 {
 	Stmt **statements;
-	HashTable strings;
+	StringTable *strings;
 } Program;
 
 Expr *ast_expr_number_literal(double value);
 Expr *ast_expr_boolean_literal(bool value);
-Expr *ast_expr_cell_literal(Cell *value);
+Expr *ast_expr_string_literal(Value value);
 Expr *ast_expr_binary(TokenType op, Expr *left, Expr *right);
 Expr *ast_expr_grouping(Expr *expr);
 Expr *ast_expr_unary(TokenType op, Expr *right);
 Expr *ast_expr_identifier(String *identifier);
 Expr *ast_expr_assignment(String *name, Expr *value);
 Expr *ast_expr_call(Expr *callee, Expr **arguments);
+Expr *ast_expr_map_literal(Expr **keys, Expr **values);
+Expr *ast_expr_array_literal(Expr **items);
+Expr *ast_expr_index(Expr *target, Expr *index);
+Expr *ast_expr_set_index(Expr *target, Expr *index, Expr *value);
+Expr *ast_expr_yield(Expr *value);
+Expr *ast_expr_resume(Expr *coroutine, Expr *value);
 
 Stmt *ast_stmt_expression(Expr *expr);
 Stmt *ast_stmt_var_decl(String *name, Expr *expr);
@@ -162,3 +235,8 @@ Stmt *ast_stmt_block(Stmt **statements);
 Stmt *ast_stmt_if(Expr *cond, Stmt *then_branch, Stmt *else_branch);
 Stmt *ast_stmt_while(Expr *cond, Stmt *body);
 Stmt *ast_stmt_return(Expr *expr);
+Stmt *ast_stmt_for_in(String *name, Expr *iterable, Stmt *body);
+Stmt *ast_stmt_delete(Expr *target, Expr *index);
+
+// Frees every node of the program, but not the strings it interned
+void ast_program_free(Program *program);
@@ -2,6 +2,8 @@
 
 #include <string.h>
 
+#include "core/metrics.h"
+
 #include "token.h"
 
 Lexer lexer_init(const char *source)
@@ -10,6 +12,8 @@ Lexer lexer_init(const char *source)
 		.input = source,
 		.start = source,
 		.current = source,
+		.line = 1,
+		.line_start = source,
 	};
 
 	return lexer;
@@ -43,6 +47,10 @@ Token lexer_get_next_token(Lexer *lexer)
 	}
 
 	lexer->start = lexer->current;
+	lexer->start_location = (Location){
+		.line = lexer->line,
+		.column = (i32)(lexer->start - lexer->line_start) + 1,
+	};
 
 	char c = advance(lexer);
 
@@ -70,6 +78,8 @@ Token lexer_get_next_token(Lexer *lexer)
 			return token(lexer, TOKEN_DOT);
 		case ';':
 			return token(lexer, TOKEN_SEMICOLON);
+		case ':':
+			return token(lexer, TOKEN_COLON);
 
 		case '-':
 			return token(lexer, TOKEN_MINUS);
@@ -113,7 +123,15 @@ Token lexer_get_next_token(Lexer *lexer)
 
 static char advance(Lexer *lexer)
 {
-	return *lexer->current++;
+	char c = *lexer->current++;
+
+	if (c == '\n')
+	{
+		lexer->line += 1;
+		lexer->line_start = lexer->current;
+	}
+
+	return c;
 }
 
 static char peek(Lexer *lexer)
@@ -132,8 +150,11 @@ static Token token(Lexer *lexer, TokenType type)
 		.type = type,
 		.lexeme_start = lexer->start,
 		.lexeme_len = (int)(lexer->current - lexer->start),
+		.location = lexer->start_location,
 	};
 
+	metrics_add(METRIC_TOKENS, 1);
+
 	return token;
 }
 
@@ -150,8 +171,6 @@ static Token equal_token(Lexer *lexer, TokenType one_char, TokenType two_char)
 
 static Token string_token(Lexer *lexer)
 {
-	advance(lexer);
-
 	while (peek(lexer) != '"')
 	{
 		if (peek(lexer) == '\0')
@@ -217,20 +236,46 @@ static Token identifier_token(Lexer *lexer)
 	{
 		case 'a':
 			return check_keyword(lexer, 1, 2, "nd", TOKEN_AND);
+		case 'd':
+			return check_keyword(lexer, 1, 5, "elete", TOKEN_DELETE);
 		case 'e':
 			return check_keyword(lexer, 1, 3, "lse", TOKEN_ELSE);
 		case 'i':
-			return check_keyword(lexer, 1, 1, "f", TOKEN_IF);
+			if (lexer->current - lexer->start > 1)
+			{
+				switch (lexer->start[1])
+				{
+					case 'f':
+						return check_keyword(lexer, 2, 0, "", TOKEN_IF);
+					case 'n':
+						return check_keyword(lexer, 2, 0, "", TOKEN_IN);
+				}
+			}
+			break;
 		case 'n':
 			return check_keyword(lexer, 1, 2, "ot", TOKEN_NOT);
 		case 'o':
 			return check_keyword(lexer, 1, 1, "r", TOKEN_OR);
 		case 'r':
-			return check_keyword(lexer, 1, 5, "eturn", TOKEN_RETURN);
+			if (lexer->current - lexer->start > 2)
+			{
+				switch (lexer->start[2])
+				{
+					case 's':
+						return check_keyword(lexer, 1, 5, "esume",
+											 TOKEN_RESUME);
+					case 't':
+						return check_keyword(lexer, 1, 5, "eturn",
+											 TOKEN_RETURN);
+				}
+			}
+			break;
 		case 'v':
 			return check_keyword(lexer, 1, 2, "ar", TOKEN_VAR);
 		case 'w':
 			return check_keyword(lexer, 1, 4, "hile", TOKEN_WHILE);
+		case 'y':
+			return check_keyword(lexer, 1, 4, "ield", TOKEN_YIELD);
 
 		case 'f':
 			if (lexer->current - lexer->start > 1)
@@ -10,6 +10,10 @@ typedef struct Lexer
 
 	const char *start;
 	const char *current;
+
+	i32 line;
+	const char *line_start;
+	Location start_location;
 } Lexer;
 
 Lexer lexer_init(const char *source);
@@ -6,6 +6,7 @@
 #include "core/common.h"
 #include "core/dyn_array.h"
 #include "core/cell.h"
+#include "core/metrics.h"
 
 #include "lexer.h"
 #include "ast.h"
@@ -15,22 +16,22 @@
 
 String *make_string(Parser *parser, Token token)
 {
-	return string_from_str(&parser->strings, token.lexeme_start,
+	return string_from_str(parser->strings, token.lexeme_start,
 						   token.lexeme_len);
 }
 
-Parser parser_init(struct Lexer *lexer)
+Parser parser_init(struct Lexer *lexer, StringTable *strings)
 {
 	Parser parser = {
 		.lexer = lexer,
+		.strings = strings,
 	};
 
-	hash_table_init(&parser.strings);
-
 	return parser;
 }
 
 static Token advance(Parser *parser);
+static Token peek_next(Parser *parser);
 static Token consume(Parser *parser, TokenType expected);
 static bool match(Parser *parser, TokenType type);
 static bool check(Parser *parser, TokenType type);
@@ -38,7 +39,8 @@ static bool check(Parser *parser, TokenType type);
 // program          -> declaration* EOF ;
 // declaration      -> var_decl | fun_decl | statement
 // statement        -> expr_stmt | print_stmt | if_stmt | block_stmt
-//                   | while_stmt | for_stmt | return_stmt ;
+//                   | while_stmt | for_stmt | for_in_stmt | return_stmt
+//                   | delete_stmt ;
 // expr_stmt        -> expression ";" ;
 // var_decl         -> "var" IDENTIFIER ( "=" expression )? ";" ;
 // function_decl    -> "function" function ;
@@ -50,7 +52,9 @@ static bool check(Parser *parser, TokenType type);
 // for_stmt         -> "for" ( var_decl | expr_stmt | ";" )
 //                     expression? ";"
 //                     expression? block_stmt ;
+// for_in_stmt      -> "for" IDENTIFIER "in" expression block_stmt ;
 // return_stmt      -> "return" expression? ";" ;
+// delete_stmt      -> "delete" call "[" expression "]" ";" ;
 static Stmt *declaration(Parser *parser);
 static Stmt *statement(Parser *parser);
 static Stmt *expr_stmt(Parser *parser);
@@ -60,10 +64,13 @@ static Stmt *if_stmt(Parser *parser);
 static Stmt *block_stmt(Parser *parser);
 static Stmt *while_stmt(Parser *parser);
 static Stmt *for_stmt(Parser *parser);
+static Stmt *for_in_stmt(Parser *parser);
 static Stmt *return_stmt(Parser *parser);
+static Stmt *delete_stmt(Parser *parser);
 
 // expression   -> assignment ;
-// assignment   -> IDENTIFIER "=" assignment | logic_or ;
+// assignment   -> ( IDENTIFIER | call "[" expression "]" ) "=" assignment
+//               | logic_or ;
 // logic_or     -> logic_and ( "or" logic_and )* ;
 // logic_and    -> equality ( "and" equality )* ;
 // equality     -> comparison ( ( "!=" | "==" ) comparison )* ;
@@ -72,10 +79,14 @@ static Stmt *return_stmt(Parser *parser);
 // factor       -> unary ( ( "/" | "*" ) unary )* ;
 // unary        -> ("not" | "-") unary
 //               | call ;
-// call         -> primary ( "(" arguments? ")" "* ;
+// call         -> primary ( "(" arguments? ")" | "[" expression "]" )* ;
 // arguments    -> expression ( "," expression )* ;
 // primary      -> NUMBER | STRING | "true" | "false" | "nil"
-//               | "(" expression ")" | IDENTIFIER;
+//               | "(" expression ")" | IDENTIFIER | map | yield | resume ;
+// map          -> "{" ( map_entry ( "," map_entry )* ","? )? "}" ;
+// map_entry    -> expression ":" expression ;
+// yield        -> "yield" "(" expression? ")" ;
+// resume       -> "resume" "(" expression ( "," expression )? ")" ;
 static Expr *expression(Parser *parser);
 static Expr *assignment(Parser *parser);
 static Expr *logic_or(Parser *parser);
@@ -90,9 +101,25 @@ static Expr *primary(Parser *parser);
 
 static void append_stmt(Program *program, Stmt *stmt);
 
+// Runtime errors and profiles point to the operator of binary expressions, the
+// opening parenthesis of calls, and so on
+static Expr *at(Expr *expr, Token token)
+{
+	expr->location = token.location;
+	return expr;
+}
+
+// Statements point to their first token
+static Stmt *stmt_at(Stmt *stmt, Location location)
+{
+	stmt->location = location;
+	return stmt;
+}
+
 struct Program parser_parse_program(Parser *parser)
 {
 	Program program = { 0 };
+	u64 start = metrics_now();
 
 	parser->curr_token = lexer_get_next_token(parser->lexer);
 
@@ -107,6 +134,8 @@ struct Program parser_parse_program(Parser *parser)
 
 	program.strings = parser->strings;
 
+	metrics_end(PHASE_PARSE, start);
+
 	return program;
 }
 
@@ -128,14 +157,24 @@ static Expr *assignment(Parser *parser)
 
 	if (match(parser, TOKEN_EQUAL))
 	{
+		Token equal = parser->prev_token;
 		Expr *value = logic_or(parser);
 
 		if (expr->type == EXPR_IDENTIFIER)
 		{
 			String *name = expr->as.identifier;
-			free(expr);
+			mem_free(expr);
+
+			return at(ast_expr_assignment(name, value), equal);
+		}
+
+		if (expr->type == EXPR_INDEX)
+		{
+			IndexExpr index = expr->as.index;
+			mem_free(expr);
 
-			return ast_expr_assignment(name, value);
+			return at(ast_expr_set_index(index.target, index.index, value),
+					  equal);
 		}
 
 		UNREACHABLE();
@@ -150,10 +189,10 @@ static Expr *logic_or(Parser *parser)
 
 	while (match(parser, TOKEN_OR))
 	{
-		TokenType op = parser->prev_token.type;
+		Token op = parser->prev_token;
 		Expr *right = logic_and(parser);
 
-		expr = ast_expr_binary(op, expr, right);
+		expr = at(ast_expr_binary(op.type, expr, right), op);
 	}
 
 	return expr;
@@ -165,10 +204,10 @@ static Expr *logic_and(Parser *parser)
 
 	while (match(parser, TOKEN_AND))
 	{
-		TokenType op = parser->prev_token.type;
+		Token op = parser->prev_token;
 		Expr *right = equality(parser);
 
-		expr = ast_expr_binary(op, expr, right);
+		expr = at(ast_expr_binary(op.type, expr, right), op);
 	}
 
 	return expr;
@@ -180,10 +219,10 @@ static Expr *equality(Parser *parser)
 
 	while (match(parser, TOKEN_BANG_EQUAL) || match(parser, TOKEN_EQUAL_EQUAL))
 	{
-		TokenType op = parser->prev_token.type;
+		Token op = parser->prev_token;
 		Expr *right = comparison(parser);
 
-		expr = ast_expr_binary(op, expr, right);
+		expr = at(ast_expr_binary(op.type, expr, right), op);
 	}
 
 	return expr;
@@ -196,10 +235,10 @@ static Expr *comparison(Parser *parser)
 	while (match(parser, TOKEN_GREATER) || match(parser, TOKEN_GREATER_EQUAL) ||
 		   match(parser, TOKEN_LESS) || match(parser, TOKEN_LESS_EQUAL))
 	{
-		TokenType op = parser->prev_token.type;
+		Token op = parser->prev_token;
 		Expr *right = term(parser);
 
-		expr = ast_expr_binary(op, expr, right);
+		expr = at(ast_expr_binary(op.type, expr, right), op);
 	}
 
 	return expr;
@@ -211,10 +250,10 @@ static Expr *term(Parser *parser)
 
 	while (match(parser, TOKEN_MINUS) || match(parser, TOKEN_PLUS))
 	{
-		TokenType op = parser->prev_token.type;
+		Token op = parser->prev_token;
 		Expr *right = factor(parser);
 
-		expr = ast_expr_binary(op, expr, right);
+		expr = at(ast_expr_binary(op.type, expr, right), op);
 	}
 
 	return expr;
@@ -226,10 +265,10 @@ static Expr *factor(Parser *parser)
 
 	while (match(parser, TOKEN_SLASH) || match(parser, TOKEN_STAR))
 	{
-		TokenType op = parser->prev_token.type;
+		Token op = parser->prev_token;
 		Expr *right = unary(parser);
 
-		expr = ast_expr_binary(op, expr, right);
+		expr = at(ast_expr_binary(op.type, expr, right), op);
 	}
 
 	return expr;
@@ -239,10 +278,10 @@ static Expr *unary(Parser *parser)
 {
 	if (match(parser, TOKEN_NOT) || match(parser, TOKEN_MINUS))
 	{
-		TokenType op = parser->prev_token.type;
+		Token op = parser->prev_token;
 		Expr *right = unary(parser);
 
-		return ast_expr_unary(op, right);
+		return at(ast_expr_unary(op.type, right), op);
 	}
 
 	return call(parser);
@@ -258,7 +297,16 @@ static Expr *call(Parser *parser)
 	{
 		if (match(parser, TOKEN_OPEN_PAREN))
 		{
-			expr = finish_call(parser, expr);
+			Token paren = parser->prev_token;
+			expr = at(finish_call(parser, expr), paren);
+		}
+		else if (match(parser, TOKEN_OPEN_BRACKET))
+		{
+			Token bracket = parser->prev_token;
+			Expr *index = expression(parser);
+			consume(parser, TOKEN_CLOSE_BRACKET);
+
+			expr = at(ast_expr_index(expr, index), bracket);
 		}
 		else
 		{
@@ -289,7 +337,16 @@ static Expr *finish_call(Parser *parser, Expr *callee)
 	return ast_expr_call(callee, arguments);
 }
 
+static Expr *literal(Parser *parser);
+
 static Expr *primary(Parser *parser)
+{
+	Token first = parser->curr_token;
+	return at(literal(parser), first);
+}
+
+// Everything that primary covers, which all start at their first token
+static Expr *literal(Parser *parser)
 {
 	switch (parser->curr_token.type)
 	{
@@ -310,8 +367,9 @@ static Expr *primary(Parser *parser)
 		{
 			Token tk = advance(parser);
 
-			String *string = make_string(parser, tk);
-			return ast_expr_cell_literal((Cell *)string);
+			Value string = string_literal(parser->strings, tk.lexeme_start,
+										  tk.lexeme_len);
+			return ast_expr_string_literal(string);
 		}
 		break;
 
@@ -351,9 +409,94 @@ static Expr *primary(Parser *parser)
 		}
 		break;
 
+		case TOKEN_OPEN_SQUIRLY:
+		{
+			advance(parser);
+
+			Expr **keys = NULL;
+			Expr **values = NULL;
+
+			if (!check(parser, TOKEN_CLOSE_SQUIRLY))
+			{
+				do
+				{
+					// NOLINTNEXTLINE(bugprone-sizeof-expression)
+					arrpush(keys, expression(parser));
+					consume(parser, TOKEN_COLON);
+					// NOLINTNEXTLINE(bugprone-sizeof-expression)
+					arrpush(values, expression(parser));
+				} while (match(parser, TOKEN_COMMA) &&
+						 !check(parser, TOKEN_CLOSE_SQUIRLY));
+			}
+
+			consume(parser, TOKEN_CLOSE_SQUIRLY);
+
+			return ast_expr_map_literal(keys, values);
+		}
+		break;
+
+		case TOKEN_OPEN_BRACKET:
+		{
+			advance(parser);
+
+			Expr **items = NULL;
+
+			if (!check(parser, TOKEN_CLOSE_BRACKET))
+			{
+				do
+				{
+					// NOLINTNEXTLINE(bugprone-sizeof-expression)
+					arrpush(items, expression(parser));
+				} while (match(parser, TOKEN_COMMA) &&
+						 !check(parser, TOKEN_CLOSE_BRACKET));
+			}
+
+			consume(parser, TOKEN_CLOSE_BRACKET);
+
+			return ast_expr_array_literal(items);
+		}
+		break;
+
+		case TOKEN_YIELD:
+		{
+			advance(parser);
+			consume(parser, TOKEN_OPEN_PAREN);
+
+			Expr *value = NULL;
+			if (!check(parser, TOKEN_CLOSE_PAREN))
+			{
+				value = expression(parser);
+			}
+
+			consume(parser, TOKEN_CLOSE_PAREN);
+
+			return ast_expr_yield(value);
+		}
+		break;
+
+		case TOKEN_RESUME:
+		{
+			advance(parser);
+			consume(parser, TOKEN_OPEN_PAREN);
+
+			Expr *coroutine = expression(parser);
+			Expr *value = NULL;
+			if (match(parser, TOKEN_COMMA))
+			{
+				value = expression(parser);
+			}
+
+			consume(parser, TOKEN_CLOSE_PAREN);
+
+			return ast_expr_resume(coroutine, value);
+		}
+		break;
+
 		default:
-			printf("Unexpected token %s\n",
-				   debug_get_token_type_str(parser->curr_token.type));
+			printf("Unexpected token %s at %d:%d\n",
+				   debug_get_token_type_str(parser->curr_token.type),
+				   parser->curr_token.location.line,
+				   parser->curr_token.location.column);
 			UNREACHABLE();
 	}
 }
@@ -370,17 +513,19 @@ static Stmt *declaration(Parser *parser)
 		return NULL;
 	}
 
+	Location location = parser->curr_token.location;
+
 	if (match(parser, TOKEN_VAR))
 	{
-		return var_decl(parser);
+		return stmt_at(var_decl(parser), location);
 	}
 
 	if (match(parser, TOKEN_FUNCTION))
 	{
-		return function(parser);
+		return stmt_at(function(parser), location);
 	}
 
-	return statement(parser);
+	return stmt_at(statement(parser), location);
 }
 
 static Stmt *statement(Parser *parser)
@@ -410,6 +555,11 @@ static Stmt *statement(Parser *parser)
 		return return_stmt(parser);
 	}
 
+	if (match(parser, TOKEN_DELETE))
+	{
+		return delete_stmt(parser);
+	}
+
 	return expr_stmt(parser);
 }
 
@@ -517,6 +667,11 @@ static Stmt *while_stmt(Parser *parser)
 
 static Stmt *for_stmt(Parser *parser)
 {
+	if (check(parser, TOKEN_IDENTIFIER) && peek_next(parser).type == TOKEN_IN)
+	{
+		return for_in_stmt(parser);
+	}
+
 	Stmt *initializer = NULL;
 	if (match(parser, TOKEN_SEMICOLON))
 	{
@@ -575,6 +730,21 @@ static Stmt *for_stmt(Parser *parser)
 	return ast_stmt_block(while_stmts);
 }
 
+static Stmt *for_in_stmt(Parser *parser)
+{
+	Token name_token = consume(parser, TOKEN_IDENTIFIER);
+	String *name = make_string(parser, name_token);
+
+	consume(parser, TOKEN_IN);
+
+	Expr *iterable = expression(parser);
+
+	consume(parser, TOKEN_OPEN_SQUIRLY);
+	Stmt *body = block_stmt(parser);
+
+	return ast_stmt_for_in(name, iterable, body);
+}
+
 static Stmt *return_stmt(Parser *parser)
 {
 	Expr *return_expr = NULL;
@@ -589,6 +759,24 @@ static Stmt *return_stmt(Parser *parser)
 	return ast_stmt_return(return_expr);
 }
 
+static Stmt *delete_stmt(Parser *parser)
+{
+	Expr *expr = call(parser);
+
+	if (expr->type != EXPR_INDEX)
+	{
+		printf("Expected an index expression after `delete`\n");
+		UNREACHABLE();
+	}
+
+	consume(parser, TOKEN_SEMICOLON);
+
+	Stmt *stmt = ast_stmt_delete(expr->as.index.target, expr->as.index.index);
+	mem_free(expr);
+
+	return stmt;
+}
+
 static bool match(Parser *parser, TokenType type)
 {
 	if (parser->curr_token.type == type)
@@ -613,12 +801,21 @@ static Token consume(Parser *parser, TokenType expected)
 		return advance(parser);
 	}
 
-	printf("Expected token type `%s`, found `%s`\n",
+	printf("Expected token type `%s`, found `%s` at %d:%d\n",
 		   debug_get_token_type_str(expected),
-		   debug_get_token_type_str(parser->curr_token.type));
+		   debug_get_token_type_str(parser->curr_token.type),
+		   parser->curr_token.location.line,
+		   parser->curr_token.location.column);
 	UNREACHABLE();
 }
 
+static Token peek_next(Parser *parser)
+{
+	// Lexing has no side effect, so a copy of the lexer can look ahead
+	Lexer lexer = *parser->lexer;
+	return lexer_get_next_token(&lexer);
+}
+
 static Token advance(Parser *parser)
 {
 	if (parser->curr_token.type != TOKEN_EOF)
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "core/hash_table.h"
+#include "core/cell.h"
 
 #include "token.h"
 
@@ -11,9 +11,11 @@ typedef struct Parser
 	Token curr_token;
 	Token prev_token;
 
-	HashTable strings;
+	StringTable *strings;
 } Parser;
 
-Parser parser_init(struct Lexer *lexer);
+// Identifiers and literals are interned in `strings`, which must outlive the
+// parsed program
+Parser parser_init(struct Lexer *lexer, StringTable *strings);
 
 struct Program parser_parse_program(Parser *parser);
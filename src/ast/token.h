@@ -1,5 +1,7 @@
 #pragma once
 
+#include "core/common.h"
+
 typedef enum TokenType
 {
 	TOKEN_EOF,
@@ -16,6 +18,7 @@ typedef enum TokenType
 	TOKEN_COMMA,
 	TOKEN_DOT,
 	TOKEN_SEMICOLON,
+	TOKEN_COLON,
 
 	// TODO: Add += -= *= /=
 	TOKEN_MINUS,
@@ -36,28 +39,40 @@ typedef enum TokenType
 	TOKEN_NUMBER,
 
 	TOKEN_AND,
+	TOKEN_DELETE,
 	TOKEN_ELSE,
 	TOKEN_FALSE,
 	TOKEN_FOR,
 	TOKEN_FUNCTION,
 	TOKEN_IF,
+	TOKEN_IN,
 	TOKEN_NIL,
 	TOKEN_NOT,
 	TOKEN_OR,
+	TOKEN_RESUME,
 	TOKEN_RETURN,
 	TOKEN_STRUCT,
 	TOKEN_TRUE,
 	TOKEN_VAR,
 	TOKEN_WHILE,
+	TOKEN_YIELD,
 
 	// Remove at some point
 	TOKEN_SUPER,
 	TOKEN_THIS,
 } TokenType;
 
+// Both start at 1, a line of 0 meaning that the location is unknown
+typedef struct Location
+{
+	i32 line;
+	i32 column;
+} Location;
+
 typedef struct Token
 {
 	const char *lexeme_start;
 	TokenType type;
 	int lexeme_len;
+	Location location; // Of the first character of the lexeme
 } Token;
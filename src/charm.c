@@ -0,0 +1,216 @@
+#include "charm.h"
+
+#include "actor.h"
+#include "parallel.h"
+
+#include "core/cell.h"
+#include "core/dyn_array.h"
+#include "core/gc.h"
+#include "core/memory.h"
+
+#include "ast/ast.h"
+#include "ast/lexer.h"
+#include "ast/parser.h"
+
+#include "compiler/chunk.h"
+#include "compiler/chunk_cache.h"
+#include "compiler/compiler.h"
+
+#include "interpreter/treewalk.h"
+
+static _Thread_local CharmVM *running = NULL;
+
+static CharmVM *charm_vm_create(StringTable *shared,
+								NativeRegistry *natives)
+{
+	CharmVM *charm = mem_malloc(sizeof(CharmVM));
+
+	string_table_init(&charm->strings, shared);
+	native_registry_init(&charm->natives);
+	vm_init(&charm->vm, &charm->strings, &charm->natives);
+	charm->actor = NULL;
+	charm->chunks = NULL;
+
+	for (i32 i = 0; i < arrlen(natives->decls); i++)
+	{
+		NativeDecl decl = natives->decls[i];
+		charm_register_native(charm, decl.name, decl.native.function,
+							  decl.native.arity);
+	}
+
+	return charm;
+}
+
+CharmVM *charm_vm_new()
+{
+	NativeRegistry builtins;
+	native_registry_init(&builtins);
+	native_register_builtins(&builtins);
+	actor_register_natives(&builtins);
+	parallel_register_natives(&builtins);
+
+	CharmVM *charm = charm_vm_create(NULL, &builtins);
+
+	native_registry_free(&builtins);
+
+	return charm;
+}
+
+CharmVM *charm_vm_new_isolate(CharmVM *parent)
+{
+	return charm_vm_create(&parent->strings, &parent->natives);
+}
+
+CharmVM *charm_vm_new_child(CharmVM *parent)
+{
+	// Created from natives, while the heap of `parent` is current
+	Heap *previous = gc_enter(NULL);
+
+	CharmVM *charm = charm_vm_create(NULL, &parent->natives);
+
+	i32 cursor = 0;
+	Entry *entry;
+
+	while ((entry = hash_table_next(&parent->vm.globals, &cursor)) != NULL)
+	{
+		if (is_string(entry->key) && is_compiled_function(entry->value))
+		{
+			String *name = as_string(entry->key);
+			String *global =
+				string_from_str(&charm->strings, name->str, name->len);
+			vm_define_global(&charm->vm, global, entry->value);
+		}
+	}
+
+	gc_enter(previous);
+
+	return charm;
+}
+
+CharmVM *charm_current()
+{
+	return running;
+}
+
+void charm_vm_free(CharmVM *charm)
+{
+	actor_shutdown(charm);
+
+	vm_free(&charm->vm);
+	native_registry_free(&charm->natives);
+	string_table_free(&charm->strings);
+
+	for (i32 i = 0; i < arrlen(charm->chunks); i++)
+	{
+		chunk_free(charm->chunks[i]);
+		mem_free(charm->chunks[i]);
+	}
+
+	arrfree(charm->chunks);
+
+	mem_free(charm);
+}
+
+void charm_register_native(CharmVM *charm, const char *name,
+						   NativeFunction function, i32 arity)
+{
+	native_register(&charm->natives, name, function, arity);
+
+	String *global = string_from_cstr(&charm->strings, name);
+	vm_define_global(&charm->vm, global,
+					 value_native_function(function, arity));
+}
+
+Program charm_parse(CharmVM *charm, const char *source)
+{
+	Lexer lexer = lexer_init(source);
+	Parser parser = parser_init(&lexer, &charm->strings);
+
+	MemCategory previous = mem_enter(MEM_AST);
+	Program program = parser_parse_program(&parser);
+	mem_enter(previous);
+
+	return program;
+}
+
+InterpretResult charm_run(CharmVM *charm, Program program)
+{
+	Chunk *chunk = mem_malloc(sizeof(Chunk));
+	chunk_init(chunk);
+
+	if (compile_program(chunk, program) != COMPILE_OK)
+	{
+		chunk_free(chunk);
+		mem_free(chunk);
+		return INTERPRET_COMPILE_ERROR;
+	}
+
+	arrpush(charm->chunks, chunk);
+
+	return charm_run_chunk(charm, chunk);
+}
+
+CompileResult charm_compile(CharmVM *charm, const char *source, Chunk *chunk)
+{
+	Program program = charm_parse(charm, source);
+	CompileResult result = compile_program(chunk, program);
+	ast_program_free(&program);
+
+	return result;
+}
+
+InterpretResult charm_run_chunk(CharmVM *charm, const Chunk *chunk)
+{
+	CharmVM *previous = running;
+	running = charm;
+
+	InterpretResult result = vm_interpret(&charm->vm, chunk);
+
+	running = previous;
+
+	// Actors may run functions of the chunk, which can go once the run is over
+	if (previous == NULL)
+	{
+		actor_join_all(charm);
+	}
+
+	return result;
+}
+
+InterpretResult charm_call(CharmVM *charm, Value function, Value *args,
+						   i32 arg_count, Value *result)
+{
+	CharmVM *previous = running;
+	running = charm;
+
+	InterpretResult status =
+		vm_call(&charm->vm, function, args, arg_count, result);
+
+	running = previous;
+
+	return status;
+}
+
+InterpretResult charm_run_treewalk(CharmVM *charm, Program program)
+{
+	CharmVM *previous = running;
+	running = charm;
+
+	bool ok = treewalk_interpreter_run(program, &charm->natives);
+
+	running = previous;
+
+	return ok ? INTERPRET_OK : INTERPRET_RUNTIME_ERROR;
+}
+
+InterpretResult charm_interpret(CharmVM *charm, const char *source)
+{
+	const Chunk *chunk = chunk_cache_get(source);
+
+	if (chunk == NULL)
+	{
+		return INTERPRET_COMPILE_ERROR;
+	}
+
+	return charm_run_chunk(charm, chunk);
+}
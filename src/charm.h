@@ -0,0 +1,75 @@
+#pragma once
+
+#include "core/common.h"
+#include "core/cell.h"
+#include "core/value.h"
+
+#include "compiler/compiler.h"
+
+#include "interpreter/native.h"
+#include "interpreter/vm.h"
+
+struct Actor;
+struct Chunk;
+struct Program;
+
+// A self-contained interpreter instance. Instances don't share any state, so
+// a host can run as many of them as it wants, e.g. one per worker thread, as
+// long as a given instance is only used by one thread at a time.
+typedef struct CharmVM
+{
+	StringTable strings;
+	NativeRegistry natives;
+	Vm vm;
+
+	struct Actor *actor; // Created once the program uses actors
+
+	// Compiled by charm_run, and kept as long as the globals may hold their
+	// functions
+	struct Chunk **chunks;
+} CharmVM;
+
+// Builtin natives are already registered on new instances
+CharmVM *charm_vm_new();
+void charm_vm_free(CharmVM *charm);
+
+// Creates an instance with its own globals and heap, that inherits the natives
+// of `parent` and reads its interned strings. Programs parsed or compiled by
+// `parent` can then run on the isolate as long as `parent` doesn't intern new
+// strings in the meantime.
+CharmVM *charm_vm_new_isolate(CharmVM *parent);
+
+// Creates an instance that inherits the natives of `parent`, and the functions
+// it compiled, which never change. Unlike an isolate, it doesn't read anything
+// from `parent` once created, so both can run at the same time.
+CharmVM *charm_vm_new_child(CharmVM *parent);
+
+// Instance running a program on the calling thread, if any, so that natives
+// can reach the instance that called them
+CharmVM *charm_current();
+
+void charm_register_native(CharmVM *charm, const char *name,
+						   NativeFunction function, i32 arity);
+
+struct Program charm_parse(CharmVM *charm, const char *source);
+
+// Compiles `program` and runs it on the bytecode vm
+InterpretResult charm_run(CharmVM *charm, struct Program program);
+
+// `chunk` must be initialized. It is only read when running, so a chunk can be
+// run by several instances at the same time. The functions it declares are
+// freed along with it, after which instances that ran it must not run anything
+// else.
+CompileResult charm_compile(CharmVM *charm, const char *source,
+							struct Chunk *chunk);
+InterpretResult charm_run_chunk(CharmVM *charm, const struct Chunk *chunk);
+
+// Calls a function of a program compiled for `charm`, see vm_call
+InterpretResult charm_call(CharmVM *charm, Value function, Value *args,
+						   i32 arg_count, Value *result);
+
+InterpretResult charm_run_treewalk(CharmVM *charm, struct Program program);
+
+// Compiles `source` once per process, see chunk_cache_get, and runs it on
+// `charm`. Returns INTERPRET_COMPILE_ERROR when it doesn't compile.
+InterpretResult charm_interpret(CharmVM *charm, const char *source);
@@ -1,36 +1,103 @@
 #include "chunk.h"
 
+#include "core/cell.h"
 #include "core/value.h"
 #include "core/dyn_array.h"
+#include "core/memory.h"
+#include "core/metrics.h"
 
 void chunk_init(Chunk *chunk)
 {
 	chunk->code = NULL;
 	chunk->constants = NULL;
+	chunk->lines = NULL;
+	chunk->caches = NULL;
+	chunk->functions = NULL;
 }
 
 void chunk_free(Chunk *chunk)
 {
+	// Functions are never tracked by a heap, see compile_function
+	for (i32 i = 0; i < arrlen(chunk->functions); i++)
+	{
+		CompiledFunction *function = chunk->functions[i];
+		chunk_free(function->chunk);
+		mem_free(function->chunk);
+		mem_free(function);
+	}
+
+	arrfree(chunk->functions);
 	arrfree(chunk->constants);
 	arrfree(chunk->code);
+	arrfree(chunk->lines);
+	arrfree(chunk->caches);
 }
 
-void chunk_write(Chunk *chunk, u8 byte)
+void chunk_write(Chunk *chunk, u8 byte, i32 line)
 {
+	i32 runs = (i32)arrlen(chunk->lines);
+
+	if (runs == 0 || chunk->lines[runs - 1].line != line)
+	{
+		LineRun run = { .offset = (i32)arrlen(chunk->code), .line = line };
+		arrpush(chunk->lines, run);
+	}
+
 	arrpush(chunk->code, byte);
+	metrics_add(METRIC_BYTECODE_BYTES, 1);
 }
 
-void chunk_write_constant(Chunk *chunk, Value value)
+void chunk_write_constant(Chunk *chunk, Value value, i32 line)
 {
 	u16 loc = chunk_add_constant(chunk, value);
 	assert(loc < 256 && "TODO: Handle more than 256 constants");
 
-	chunk_write(chunk, OP_CONSTANT);
-	chunk_write(chunk, (u8)loc);
+	chunk_write(chunk, OP_CONSTANT, line);
+	chunk_write(chunk, (u8)loc, line);
 }
 
 u16 chunk_add_constant(Chunk *chunk, struct Value value)
 {
+	MemCategory previous = mem_enter(MEM_CONSTANTS);
 	arrpush(chunk->constants, value);
+	mem_enter(previous);
+
+	metrics_add(METRIC_CONSTANTS, 1);
+
 	return (u16)arrlen(chunk->constants) - 1;
 }
+
+u16 chunk_add_cache(Chunk *chunk)
+{
+	assert(arrlen(chunk->caches) < CHUNK_MAX_CACHES);
+
+	MemCategory previous = mem_enter(MEM_CHUNKS);
+	InlineCache *cache = arraddnptr(chunk->caches, 1);
+	atomic_init(&cache->global, -1);
+	mem_enter(previous);
+
+	return (u16)arrlen(chunk->caches) - 1;
+}
+
+i32 chunk_get_line(const Chunk *chunk, i32 offset)
+{
+	i32 low = 0;
+	i32 high = (i32)arrlen(chunk->lines);
+
+	// Finds the last run starting at or before `offset`
+	while (high - low > 1)
+	{
+		i32 mid = low + (high - low) / 2;
+
+		if (chunk->lines[mid].offset <= offset)
+		{
+			low = mid;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	return high == 0 ? 0 : chunk->lines[low].line;
+}
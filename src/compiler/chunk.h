@@ -1,7 +1,10 @@
 #pragma once
 
+#include <stdatomic.h>
+
 #include "core/common.h"
 
+struct CompiledFunction;
 struct Value;
 
 typedef enum OpCode
@@ -20,29 +23,73 @@ typedef enum OpCode
 	OP_OR,
 	OP_EQUAL,
 	OP_GREATER,
+	OP_GREATER_EQUAL,
 	OP_LESS,
+	OP_LESS_EQUAL,
 	OP_POP,
 	// TODO: Add a OP_POPN for batch popping
 	OP_DEFINE_GLOBAL,
-	OP_GET_GLOBAL,
-	OP_SET_GLOBAL,
+	OP_GET_GLOBAL, // Followed by a 16 bits inline cache index
+	OP_SET_GLOBAL, // Followed by a 16 bits inline cache index
 	OP_SET_LOCAL,
 	OP_GET_LOCAL,
 	OP_JUMP,
 	OP_JUMP_IF_FALSE,
 	OP_LOOP,
+	OP_CALL,
+	OP_TAIL_CALL, // Replaces the frame of the caller, then acts as OP_CALL
+	OP_MAP,
+	OP_ARRAY,
+	OP_GET_INDEX,
+	OP_SET_INDEX,
+	OP_DELETE_INDEX,
+	OP_MAP_NEXT,
+	OP_YIELD,
+	OP_RESUME,
 	OP_RETURN,
+	OP_COUNT, // Not an instruction
 } OpCode;
 
+// Bytes from `offset` up to the next run come from `line`
+typedef struct LineRun
+{
+	i32 offset;
+	i32 line;
+} LineRun;
+
+// Entry of the global last used by an instruction, in the globals of the vm
+// that ran it. Vms check that the entry still holds the global before using
+// it, so that slots never go stale, even when several vms run the chunk.
+typedef struct InlineCache
+{
+	atomic_int global; // -1 until filled
+} InlineCache;
+
+// Caches are indexed by 16 bits operands
+#define CHUNK_MAX_CACHES (UINT16_MAX + 1)
+
 typedef struct Chunk
 {
 	u8 *code;
 	struct Value *constants;
+	LineRun *lines; // Sorted by offset, one run per change of line
+	InlineCache *caches;
+
+	// Declared in the code of the chunk, along with their own chunks
+	struct CompiledFunction **functions;
 } Chunk;
 
 void chunk_init(Chunk *chunk);
+// Frees the functions of the chunk too, which can't be called anymore
 void chunk_free(Chunk *chunk);
 
-void chunk_write(Chunk *chunk, u8 byte);
+// `line` is 0 when unknown
+void chunk_write(Chunk *chunk, u8 byte, i32 line);
 
 u16 chunk_add_constant(Chunk *chunk, struct Value value);
+// The compiler reports chunks that would need more than CHUNK_MAX_CACHES
+u16 chunk_add_cache(Chunk *chunk);
+
+// Line of the byte at `offset`, or 0 when unknown. Doesn't allocate, so that
+// it can be used from signal handlers.
+i32 chunk_get_line(const Chunk *chunk, i32 offset);
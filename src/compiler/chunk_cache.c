@@ -0,0 +1,161 @@
+#include "chunk_cache.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include "core/cell.h"
+#include "core/dyn_array.h"
+#include "core/hash_table.h"
+#include "core/memory.h"
+
+#include "ast/ast.h"
+#include "ast/lexer.h"
+#include "ast/parser.h"
+
+#include "chunk.h"
+#include "compiler.h"
+
+typedef struct CachedChunk
+{
+	u32 hash;
+	i32 len;
+	char *source;
+
+	StringTable strings;
+	Chunk chunk;
+
+	struct CachedChunk *next;
+} CachedChunk;
+
+// Sources are bucketed by hash, collisions being chained through `next`
+static struct
+{
+	u32 key;
+	CachedChunk *value;
+} *cache = NULL;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_entry(CachedChunk *entry)
+{
+	chunk_free(&entry->chunk);
+	string_table_free(&entry->strings);
+	mem_free(entry->source);
+	mem_free(entry);
+}
+
+// NULL when the source doesn't compile
+static CachedChunk *compile_entry(const char *source, i32 len, u32 hash)
+{
+	CachedChunk *entry = mem_malloc(sizeof(CachedChunk));
+	entry->hash = hash;
+	entry->len = len;
+	entry->source = mem_malloc(len + 1);
+	entry->next = NULL;
+
+	memcpy(entry->source, source, len + 1);
+
+	string_table_init(&entry->strings, NULL);
+	chunk_init(&entry->chunk);
+
+	Lexer lexer = lexer_init(entry->source);
+	Parser parser = parser_init(&lexer, &entry->strings);
+
+	MemCategory previous = mem_enter(MEM_AST);
+	Program program = parser_parse_program(&parser);
+	mem_enter(previous);
+
+	CompileResult result = compile_program(&entry->chunk, program);
+	ast_program_free(&program);
+
+	if (result != COMPILE_OK)
+	{
+		free_entry(entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+static CachedChunk *find_entry(const char *source, i32 len, u32 hash)
+{
+	CachedChunk *entry = hmget(cache, hash);
+
+	for (; entry != NULL; entry = entry->next)
+	{
+		if (entry->len == len && memcmp(entry->source, source, len) == 0)
+		{
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+const Chunk *chunk_cache_get(const char *source)
+{
+	i32 len = (i32)strlen(source);
+	u32 hash = hash_string(source, len);
+
+	pthread_mutex_lock(&cache_lock);
+	CachedChunk *entry = find_entry(source, len, hash);
+	pthread_mutex_unlock(&cache_lock);
+
+	if (entry != NULL)
+	{
+		return &entry->chunk;
+	}
+
+	// Compile outside of the lock, so that compiling a script doesn't block
+	// instances that run other ones
+	CachedChunk *compiled = compile_entry(source, len, hash);
+
+	if (compiled == NULL)
+	{
+		return NULL;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+
+	entry = find_entry(source, len, hash);
+
+	if (entry == NULL)
+	{
+		compiled->next = hmget(cache, hash);
+		hmput(cache, hash, compiled);
+
+		entry = compiled;
+		compiled = NULL;
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	// Another thread compiled the same source in the meantime
+	if (compiled != NULL)
+	{
+		free_entry(compiled);
+	}
+
+	return &entry->chunk;
+}
+
+void chunk_cache_clear()
+{
+	pthread_mutex_lock(&cache_lock);
+
+	for (i32 i = 0; i < hmlen(cache); i++)
+	{
+		CachedChunk *entry = cache[i].value;
+
+		while (entry != NULL)
+		{
+			CachedChunk *next = entry->next;
+			free_entry(entry);
+			entry = next;
+		}
+	}
+
+	hmfree(cache);
+
+	pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+struct Chunk;
+
+// Process-wide cache of compiled chunks, keyed by their source.
+// Each chunk is compiled against a string table of its own, and neither is
+// modified until the cache is cleared, so that any number of instances can run
+// a cached chunk at the same time, from any thread.
+// Returns NULL when the source doesn't compile, which isn't cached, so the
+// errors are reported again by the next call.
+const struct Chunk *chunk_cache_get(const char *source);
+
+// Frees every cached chunk and the functions they declare. None of them may be
+// in use anymore, and the instances that ran them mustn't be used again, as
+// their globals may hold those functions.
+void chunk_cache_clear();
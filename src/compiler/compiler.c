@@ -6,6 +6,9 @@
 #include "core/value.h"
 #include "core/common.h"
 #include "core/dyn_array.h"
+#include "core/gc.h"
+#include "core/memory.h"
+#include "core/metrics.h"
 
 #include "ast/ast.h"
 #include "ast/token.h"
@@ -14,8 +17,6 @@
 
 #include "debug/debug.h"
 
-#define DEBUG_PRINT_CODE
-
 #define UINT8_COUNT UINT8_MAX + 1
 
 typedef struct
@@ -26,88 +27,121 @@ typedef struct
 
 typedef struct
 {
+	Chunk *chunk;
+
 	Local locals[UINT8_COUNT];
 	i32 local_count;
 	i32 scope_depth;
+	bool in_function; // Only the frames of functions can be replaced
+	bool had_error;
+
+	i32 line; // Of the node being compiled, given to the bytes it emits
 } Compiler;
 
-static Chunk *compiling_chunk;
-static Compiler compiler;
+static Chunk *current_chunk(Compiler *compiler)
+{
+	return compiler->chunk;
+}
 
-static Chunk *current_chunk()
+// Nodes built without a location keep the line of their parent
+static i32 enter_location(Compiler *compiler, Location location)
 {
-	return compiling_chunk;
+	i32 previous = compiler->line;
+
+	if (location.line != 0)
+	{
+		compiler->line = location.line;
+	}
+
+	return previous;
 }
 
-static void emit_byte(u8 byte)
+static void emit_byte(Compiler *compiler, u8 byte)
 {
-	chunk_write(current_chunk(), byte);
+	chunk_write(current_chunk(compiler), byte, compiler->line);
 }
 
-static void emit_bytes(i32 count, ...)
+static void emit_bytes(Compiler *compiler, i32 count, ...)
 {
 	va_list args;
 	va_start(args, count);
 	for (i32 i = 0; i < count; i++)
 	{
-		chunk_write(current_chunk(), (u8)va_arg(args, int));
+		chunk_write(current_chunk(compiler), (u8)va_arg(args, int),
+					compiler->line);
 	}
 	va_end(args);
 }
 
-static usize emit_jump(u8 instruction)
+static usize emit_jump(Compiler *compiler, u8 instruction)
 {
-	emit_bytes(3, instruction, 0xFF, 0xFF);
-	return arrlen(current_chunk()->code) - 2;
+	emit_bytes(compiler, 3, instruction, 0xFF, 0xFF);
+	return arrlen(current_chunk(compiler)->code) - 2;
 }
 
-static void patch_jump(usize offset)
+static void patch_jump(Compiler *compiler, usize offset)
 {
-	usize jump = arrlen(current_chunk()->code) - offset - 2;
+	usize jump = arrlen(current_chunk(compiler)->code) - offset - 2;
 
 	assert(jump <= UINT16_MAX);
 
-	current_chunk()->code[offset] = (jump >> 8) & 0xFF;
-	current_chunk()->code[offset + 1] = jump & 0xFF;
+	current_chunk(compiler)->code[offset] = (jump >> 8) & 0xFF;
+	current_chunk(compiler)->code[offset + 1] = jump & 0xFF;
 }
 
-static void emit_loop(usize loop_start)
+static void emit_loop(Compiler *compiler, usize loop_start)
 {
-	emit_byte(OP_LOOP);
+	emit_byte(compiler, OP_LOOP);
 
-	usize offset = arrlen(current_chunk()->code) - loop_start + 2;
+	usize offset = arrlen(current_chunk(compiler)->code) - loop_start + 2;
 	assert(offset <= UINT16_MAX);
 
-	emit_bytes(2, (offset >> 8) & 0xFF, offset & 0xFF);
+	emit_bytes(compiler, 2, (offset >> 8) & 0xFF, offset & 0xFF);
 }
 
-static u16 make_constant(Value constant)
+static u16 make_constant(Compiler *compiler, Value constant)
 {
-	u16 id = chunk_add_constant(current_chunk(), constant);
+	u16 id = chunk_add_constant(current_chunk(compiler), constant);
 	assert(id < 256 && "TODO: Handle more than 256 constants");
 	return id;
 }
 
-static void emit_constant(Value constant)
+static void emit_constant(Compiler *compiler, Value constant)
 {
-	emit_bytes(2, OP_CONSTANT, make_constant(constant));
+	emit_bytes(compiler, 2, OP_CONSTANT, make_constant(compiler, constant));
 }
 
-static u16 identifier_constant(String *identifier)
+// Names are interned, so that every use of a global in a chunk shares the
+// constant of its name
+static u16 identifier_constant(Compiler *compiler, String *identifier)
 {
-	return make_constant(value_cell((Cell *)identifier));
+	Value *constants = current_chunk(compiler)->constants;
+
+	for (i32 i = 0; i < arrlen(constants); i++)
+	{
+		if (is_cell(constants[i]) && as_cell(constants[i]) == &identifier->cell)
+		{
+			return (u16)i;
+		}
+	}
+
+	return make_constant(compiler, value_cell((Cell *)identifier));
 }
 
 //static void define_variable(u8 global_variable);
 //static u8 identifier_constant();
 
-static CompileResult compile_stmt(Stmt *stmt);
-static CompileResult compile_expr(Expr *expr);
+static CompileResult compile_stmt(Compiler *compiler, Stmt *stmt);
+static CompileResult compile_expr(Compiler *compiler, Expr *expr);
+static void compile_call(Compiler *compiler, CallExpr *call, OpCode op);
 
 CompileResult compile_program(struct Chunk *chunk, Program program)
 {
-	compiler = (Compiler){ .local_count = 0, .scope_depth = 0 };
-	compiling_chunk = chunk;
+	Compiler compiler_state = { .chunk = chunk };
+	Compiler *compiler = &compiler_state;
+
+	MemCategory previous = mem_enter(MEM_CHUNKS);
+	u64 start = metrics_now();
 
 	i32 count = (i32)arrlen(program.statements);
 
@@ -115,91 +149,154 @@ CompileResult compile_program(struct Chunk *chunk, Program program)
 
 	for (int i = 0; i < count; i++)
 	{
-		result |= compile_stmt(program.statements[i]);
+		result |= compile_stmt(compiler, program.statements[i]);
 	}
 
-	emit_byte(OP_RETURN);
+	emit_bytes(compiler, 2, OP_NIL, OP_RETURN);
+
+	if (compiler->had_error)
+	{
+		result = COMPILE_ERROR;
+	}
 
 #ifdef DEBUG_PRINT_CODE
 	printf("\n-*-*-*- Compiled Bytecode -*-*-*-\n");
-	debug_disassemble_chunk(current_chunk(), "code");
+	debug_disassemble_chunk(current_chunk(compiler), "code");
 #endif
 
+	metrics_end(PHASE_COMPILE, start);
+	mem_enter(previous);
+
 	return result;
 }
 
-static void mark_initialized()
+static void mark_initialized(Compiler *compiler)
 {
-	if (compiler.scope_depth == 0)
+	if (compiler->scope_depth == 0)
 	{
 		return;
 	}
 
-	compiler.locals[compiler.local_count - 1].depth = compiler.scope_depth;
+	compiler->locals[compiler->local_count - 1].depth = compiler->scope_depth;
 }
 
-static void define_variable(u16 identifier)
+static void define_variable(Compiler *compiler, u16 identifier)
 {
-	if (compiler.scope_depth > 0)
+	if (compiler->scope_depth > 0)
 	{
-		mark_initialized();
+		mark_initialized(compiler);
 		return;
 	}
 
-	emit_bytes(2, OP_DEFINE_GLOBAL, identifier);
+	emit_bytes(compiler, 2, OP_DEFINE_GLOBAL, identifier);
 }
 
-static void add_local(String *name)
+static void add_local(Compiler *compiler, String *name)
 {
-	if (compiler.local_count == UINT8_COUNT)
+	if (compiler->local_count == UINT8_COUNT)
 	{
 		printf("Too many locals in function\n");
 		return;
 	}
 
-	Local *local = &compiler.locals[compiler.local_count++];
+	Local *local = &compiler->locals[compiler->local_count++];
 	local->name = name;
 	local->depth = -1;
 }
 
-static void declare_variable(String *name)
+static void declare_variable(Compiler *compiler, String *name)
 {
-	if (compiler.scope_depth == 0)
+	if (compiler->scope_depth == 0)
 	{
 		return;
 	}
 
-	add_local(name);
+	add_local(compiler, name);
 }
 
-static void begin_scope()
+static void begin_scope(Compiler *compiler)
 {
-	compiler.scope_depth += 1;
+	compiler->scope_depth += 1;
 }
 
-static void end_scope()
+static void end_scope(Compiler *compiler)
 {
-	compiler.scope_depth -= 1;
+	compiler->scope_depth -= 1;
 
-	while (compiler.local_count > 0 &&
-		   compiler.locals[compiler.local_count - 1].depth >
-			   compiler.scope_depth)
+	while (compiler->local_count > 0 &&
+		   compiler->locals[compiler->local_count - 1].depth >
+			   compiler->scope_depth)
 	{
-		emit_byte(OP_POP);
-		compiler.local_count -= 1;
+		emit_byte(compiler, OP_POP);
+		compiler->local_count -= 1;
 	}
 }
 
-static CompileResult compile_stmt(Stmt *stmt)
+static CompileResult compile_function(Compiler *compiler,
+									  FunctionDecl *decl)
+{
+	i32 arity = (i32)arrlen(decl->args);
+	assert(arity <= UINT8_MAX && "TODO: Handle more arguments");
+
+	Chunk *chunk = mem_malloc(sizeof(Chunk));
+	chunk_init(chunk);
+
+	// Functions can't see the locals of enclosing scopes yet, so each one gets
+	// a fresh compiler
+	Compiler function_state = {
+		.chunk = chunk,
+		.in_function = true,
+		.line = compiler->line,
+	};
+	Compiler *function_compiler = &function_state;
+
+	begin_scope(function_compiler);
+
+	add_local(function_compiler, NULL);
+	mark_initialized(function_compiler);
+
+	for (i32 i = 0; i < arity; i++)
+	{
+		add_local(function_compiler, decl->args[i]);
+		mark_initialized(function_compiler);
+	}
+
+	CompileResult result = compile_stmt(function_compiler, decl->body);
+
+	emit_bytes(function_compiler, 2, OP_NIL, OP_RETURN);
+
+	if (function_compiler->had_error)
+	{
+		compiler->had_error = true;
+	}
+
+#ifdef DEBUG_PRINT_CODE
+	debug_disassemble_chunk(chunk, decl->name->str);
+#endif
+
+	// Owned by the enclosing chunk, even if a vm is running
+	Heap *previous = gc_enter(NULL);
+	CompiledFunction *function =
+		compiled_function_new(decl->name, arity, chunk);
+	gc_enter(previous);
+
+	arrpush(current_chunk(compiler)->functions, function);
+	emit_constant(compiler, value_cell((Cell *)function));
+
+	return result;
+}
+
+static CompileResult compile_stmt(Compiler *compiler, Stmt *stmt)
 {
 	CompileResult result = COMPILE_OK;
+	i32 line = enter_location(compiler, stmt->location);
 
 	switch (stmt->type)
 	{
 		case STMT_EXPR:
 		{
-			result = compile_expr(stmt->as.expression.expr);
-			emit_byte(OP_POP);
+			result = compile_expr(compiler, stmt->as.expression.expr);
+			emit_byte(compiler, OP_POP);
 		}
 		break;
 
@@ -207,78 +304,162 @@ static CompileResult compile_stmt(Stmt *stmt)
 		{
 			String *name = stmt->as.var_decl.name;
 
-			declare_variable(name);
+			declare_variable(compiler, name);
 
 			u8 ident = 0;
-			if (compiler.scope_depth == 0)
+			if (compiler->scope_depth == 0)
 			{
-				ident = (u8)identifier_constant(name);
+				ident = (u8)identifier_constant(compiler, name);
 			}
 
 			if (stmt->as.var_decl.expr != NULL)
 			{
-				compile_expr(stmt->as.var_decl.expr);
+				compile_expr(compiler, stmt->as.var_decl.expr);
 			}
 			else
 			{
-				emit_byte(OP_NIL);
+				emit_byte(compiler, OP_NIL);
+			}
+
+			define_variable(compiler, ident);
+		}
+		break;
+
+		case STMT_FUNCTION_DECL:
+		{
+			String *name = stmt->as.function_decl.name;
+
+			declare_variable(compiler, name);
+
+			u8 ident = 0;
+			if (compiler->scope_depth == 0)
+			{
+				ident = (u8)identifier_constant(compiler, name);
 			}
 
-			define_variable(ident);
+			result = compile_function(compiler, &stmt->as.function_decl);
+
+			define_variable(compiler, ident);
+		}
+		break;
+
+		case STMT_RETURN:
+		{
+			Expr *expr = stmt->as.return_stmt.expr;
+
+			if (expr != NULL && expr->type == EXPR_CALL &&
+				compiler->in_function)
+			{
+				// Still followed by a return, for callees that are natives
+				compile_call(compiler, &expr->as.call, OP_TAIL_CALL);
+			}
+			else if (expr != NULL)
+			{
+				compile_expr(compiler, expr);
+			}
+			else
+			{
+				emit_byte(compiler, OP_NIL);
+			}
+
+			emit_byte(compiler, OP_RETURN);
 		}
 		break;
 
 		case STMT_BLOCK:
 		{
-			begin_scope();
+			begin_scope(compiler);
 
 			for (int i = 0; i < arrlen(stmt->as.block.statements); i++)
 			{
-				compile_stmt(stmt->as.block.statements[i]);
+				compile_stmt(compiler, stmt->as.block.statements[i]);
 			}
 
-			end_scope();
+			end_scope(compiler);
 		}
 		break;
 
 		case STMT_IF:
 		{
-			compile_expr(stmt->as.if_stmt.cond);
+			compile_expr(compiler, stmt->as.if_stmt.cond);
 
-			usize then_jump = emit_jump(OP_JUMP_IF_FALSE);
-			emit_byte(OP_POP);
+			usize then_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
+			emit_byte(compiler, OP_POP);
 
-			compile_stmt(stmt->as.if_stmt.then_branch);
+			compile_stmt(compiler, stmt->as.if_stmt.then_branch);
 
-			usize else_jump = emit_jump(OP_JUMP);
+			usize else_jump = emit_jump(compiler, OP_JUMP);
 
-			patch_jump(then_jump);
+			patch_jump(compiler, then_jump);
 
-			emit_byte(OP_POP);
+			emit_byte(compiler, OP_POP);
 
 			if (stmt->as.if_stmt.else_branch != NULL)
 			{
-				compile_stmt(stmt->as.if_stmt.else_branch);
+				compile_stmt(compiler, stmt->as.if_stmt.else_branch);
 			}
 
-			patch_jump(else_jump);
+			patch_jump(compiler, else_jump);
+		}
+		break;
+
+		case STMT_FOR_IN:
+		{
+			begin_scope(compiler);
+
+			// The map, the iteration cursor and the key are kept in locals,
+			// the first two being unnamed so they can't be resolved.
+			u8 map_slot = (u8)compiler->local_count;
+
+			compile_expr(compiler, stmt->as.for_in.iterable);
+			add_local(compiler, NULL);
+			mark_initialized(compiler);
+
+			emit_constant(compiler, value_number(0));
+			add_local(compiler, NULL);
+			mark_initialized(compiler);
+
+			emit_byte(compiler, OP_NIL);
+			add_local(compiler, stmt->as.for_in.name);
+			mark_initialized(compiler);
+
+			usize loop_start = arrlen(current_chunk(compiler)->code);
+
+			emit_bytes(compiler, 4, OP_MAP_NEXT, map_slot, 0xFF, 0xFF);
+			usize exit_jump = arrlen(current_chunk(compiler)->code) - 2;
+
+			compile_stmt(compiler, stmt->as.for_in.body);
+
+			emit_loop(compiler, loop_start);
+
+			patch_jump(compiler, exit_jump);
+
+			end_scope(compiler);
+		}
+		break;
+
+		case STMT_DELETE:
+		{
+			compile_expr(compiler, stmt->as.delete_stmt.target);
+			compile_expr(compiler, stmt->as.delete_stmt.index);
+			emit_byte(compiler, OP_DELETE_INDEX);
 		}
 		break;
 
 		case STMT_WHILE:
 		{
-			usize loop_start = arrlen(current_chunk()->code);
-			compile_expr(stmt->as.while_stmt.cond);
+			usize loop_start = arrlen(current_chunk(compiler)->code);
+			compile_expr(compiler, stmt->as.while_stmt.cond);
 
-			usize exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-			emit_byte(OP_POP);
+			usize exit_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
+			emit_byte(compiler, OP_POP);
 
-			compile_stmt(stmt->as.while_stmt.body);
+			compile_stmt(compiler, stmt->as.while_stmt.body);
 
-			emit_loop(loop_start);
+			emit_loop(compiler, loop_start);
 
-			patch_jump(exit_jump);
-			emit_byte(OP_POP);
+			patch_jump(compiler, exit_jump);
+			emit_byte(compiler, OP_POP);
 		}
 		break;
 
@@ -290,14 +471,16 @@ static CompileResult compile_stmt(Stmt *stmt)
 		}
 	}
 
+	compiler->line = line;
+
 	return result;
 }
 
-static u16 resolve_local(String *name)
+static u16 resolve_local(Compiler *compiler, String *name)
 {
-	for (int i = compiler.local_count - 1; i >= 0; i--)
+	for (int i = compiler->local_count - 1; i >= 0; i--)
 	{
-		Local *local = &compiler.locals[i];
+		Local *local = &compiler->locals[i];
 		if (name == local->name)
 		{
 			return (u16)i;
@@ -307,11 +490,11 @@ static u16 resolve_local(String *name)
 	return (u16)-1;
 }
 
-static void named_variable(String *name, bool assignment)
+static void named_variable(Compiler *compiler, String *name, bool assignment)
 {
 	u8 get_op, set_op;
 
-	u16 arg = resolve_local(name);
+	u16 arg = resolve_local(compiler, name);
 
 	if (arg != (u16)-1)
 	{
@@ -320,63 +503,174 @@ static void named_variable(String *name, bool assignment)
 	}
 	else
 	{
-		arg = identifier_constant(name);
+		arg = identifier_constant(compiler, name);
 		get_op = OP_GET_GLOBAL;
 		set_op = OP_SET_GLOBAL;
 	}
 
-	emit_bytes(2, assignment ? set_op : get_op, arg);
+	emit_bytes(compiler, 2, assignment ? set_op : get_op, arg);
+
+	if (get_op == OP_GET_GLOBAL)
+	{
+		Chunk *chunk = current_chunk(compiler);
+		u16 cache = 0;
+
+		// The operand is still emitted, so that the chunk can be disassembled
+		if (arrlen(chunk->caches) == CHUNK_MAX_CACHES)
+		{
+			printf("Too many accesses to globals in chunk\n");
+			compiler->had_error = true;
+		}
+		else
+		{
+			cache = chunk_add_cache(chunk);
+		}
+
+		emit_bytes(compiler, 2, (cache >> 8) & 0xFF, cache & 0xFF);
+	}
 }
 
-static CompileResult compile_binary_expr(BinaryExpr expr);
-static CompileResult compile_unary_expr(UnaryExpr expr);
+static CompileResult compile_binary_expr(Compiler *compiler, BinaryExpr expr);
+static CompileResult compile_unary_expr(Compiler *compiler, UnaryExpr expr);
 
-static CompileResult compile_expr(Expr *expr)
+static CompileResult compile_expr(Compiler *compiler, Expr *expr)
 {
+	i32 line = enter_location(compiler, expr->location);
+
 	switch (expr->type)
 	{
 		case EXPR_IDENTIFIER:
 		{
-			named_variable(expr->as.identifier, false);
+			named_variable(compiler, expr->as.identifier, false);
 		}
 		break;
 
 		case EXPR_BOOLEAN_LITERAL:
 		{
 			bool b = expr->as.boolean;
-			emit_byte(b ? OP_TRUE : OP_FALSE);
+			emit_byte(compiler, b ? OP_TRUE : OP_FALSE);
 		}
 		break;
 
 		case EXPR_NUMBER_LITERAL:
 		{
-			emit_constant(value_number(expr->as.number));
+			emit_constant(compiler, value_number(expr->as.number));
+		}
+		break;
+
+		case EXPR_STRING_LITERAL:
+		{
+			emit_constant(compiler, expr->as.string);
 		}
 		break;
 
-		case EXPR_CELL_LITERAL:
+		case EXPR_GROUPING:
 		{
-			emit_constant(value_cell(expr->as.cell));
+			compile_expr(compiler, expr->as.grouping.expr);
 		}
 		break;
 
 		case EXPR_BINARY:
 		{
-			compile_binary_expr(expr->as.binary);
+			compile_binary_expr(compiler, expr->as.binary);
 		}
 		break;
 
 		case EXPR_UNARY:
 		{
-			compile_expr(expr->as.unary.right);
-			compile_unary_expr(expr->as.unary);
+			compile_expr(compiler, expr->as.unary.right);
+			compile_unary_expr(compiler, expr->as.unary);
 		}
 		break;
 
 		case EXPR_ASSIGNMENT:
 		{
-			compile_expr(expr->as.assignment.value);
-			named_variable(expr->as.assignment.name, true);
+			compile_expr(compiler, expr->as.assignment.value);
+			named_variable(compiler, expr->as.assignment.name, true);
+		}
+		break;
+
+		case EXPR_CALL:
+		{
+			compile_call(compiler, &expr->as.call, OP_CALL);
+		}
+		break;
+
+		case EXPR_MAP_LITERAL:
+		{
+			i32 count = (i32)arrlen(expr->as.map.keys);
+			assert(count <= UINT8_MAX && "TODO: Handle bigger map literals");
+
+			for (i32 i = 0; i < count; i++)
+			{
+				compile_expr(compiler, expr->as.map.keys[i]);
+				compile_expr(compiler, expr->as.map.values[i]);
+			}
+
+			emit_bytes(compiler, 2, OP_MAP, count);
+		}
+		break;
+
+		case EXPR_ARRAY_LITERAL:
+		{
+			i32 count = (i32)arrlen(expr->as.array.items);
+			assert(count <= UINT8_MAX && "TODO: Handle bigger array literals");
+
+			for (i32 i = 0; i < count; i++)
+			{
+				compile_expr(compiler, expr->as.array.items[i]);
+			}
+
+			emit_bytes(compiler, 2, OP_ARRAY, count);
+		}
+		break;
+
+		case EXPR_INDEX:
+		{
+			compile_expr(compiler, expr->as.index.target);
+			compile_expr(compiler, expr->as.index.index);
+			emit_byte(compiler, OP_GET_INDEX);
+		}
+		break;
+
+		case EXPR_SET_INDEX:
+		{
+			compile_expr(compiler, expr->as.set_index.target);
+			compile_expr(compiler, expr->as.set_index.index);
+			compile_expr(compiler, expr->as.set_index.value);
+			emit_byte(compiler, OP_SET_INDEX);
+		}
+		break;
+
+		case EXPR_YIELD:
+		{
+			if (expr->as.yield.value != NULL)
+			{
+				compile_expr(compiler, expr->as.yield.value);
+			}
+			else
+			{
+				emit_byte(compiler, OP_NIL);
+			}
+
+			emit_byte(compiler, OP_YIELD);
+		}
+		break;
+
+		case EXPR_RESUME:
+		{
+			compile_expr(compiler, expr->as.resume.coroutine);
+
+			if (expr->as.resume.value != NULL)
+			{
+				compile_expr(compiler, expr->as.resume.value);
+			}
+			else
+			{
+				emit_byte(compiler, OP_NIL);
+			}
+
+			emit_byte(compiler, OP_RESUME);
 		}
 		break;
 
@@ -386,74 +680,91 @@ static CompileResult compile_expr(Expr *expr)
 			UNREACHABLE();
 	}
 
+	compiler->line = line;
+
 	// TODO: Error handling
 	return COMPILE_OK;
 }
 
-static CompileResult compile_binary_expr(BinaryExpr expr)
+static void compile_call(Compiler *compiler, CallExpr *call, OpCode op)
+{
+	i32 arg_count = (i32)arrlen(call->arguments);
+	assert(arg_count <= UINT8_MAX && "TODO: Handle more arguments");
+
+	compile_expr(compiler, call->callee);
+
+	for (i32 i = 0; i < arg_count; i++)
+	{
+		compile_expr(compiler, call->arguments[i]);
+	}
+
+	emit_bytes(compiler, 2, op, arg_count);
+}
+
+static CompileResult compile_binary_expr(Compiler *compiler, BinaryExpr expr)
 {
-	compile_expr(expr.left);
+	compile_expr(compiler, expr.left);
 
 	switch (expr.op)
 	{
 		case TOKEN_PLUS:
-			compile_expr(expr.right);
-			emit_byte(OP_ADD);
+			compile_expr(compiler, expr.right);
+			emit_byte(compiler, OP_ADD);
 			break;
 		case TOKEN_MINUS:
-			compile_expr(expr.right);
-			emit_byte(OP_SUBTRACT);
+			compile_expr(compiler, expr.right);
+			emit_byte(compiler, OP_SUBTRACT);
 			break;
 		case TOKEN_STAR:
-			compile_expr(expr.right);
-			emit_byte(OP_MULTIPLY);
+			compile_expr(compiler, expr.right);
+			emit_byte(compiler, OP_MULTIPLY);
 			break;
 		case TOKEN_SLASH:
-			compile_expr(expr.right);
-			emit_byte(OP_DIVIDE);
+			compile_expr(compiler, expr.right);
+			emit_byte(compiler, OP_DIVIDE);
 			break;
 		case TOKEN_EQUAL_EQUAL:
-			compile_expr(expr.right);
-			emit_byte(OP_EQUAL);
+			compile_expr(compiler, expr.right);
+			emit_byte(compiler, OP_EQUAL);
 			break;
 		case TOKEN_BANG_EQUAL:
-			compile_expr(expr.right);
-			emit_bytes(2, OP_EQUAL, OP_NOT);
+			compile_expr(compiler, expr.right);
+			emit_bytes(compiler, 2, OP_EQUAL, OP_NOT);
 			break;
 		case TOKEN_GREATER:
-			compile_expr(expr.right);
-			emit_byte(OP_GREATER);
+			compile_expr(compiler, expr.right);
+			emit_byte(compiler, OP_GREATER);
 			break;
 		case TOKEN_GREATER_EQUAL:
-			compile_expr(expr.right);
-			emit_bytes(2, OP_LESS, OP_NOT);
+			compile_expr(compiler, expr.right);
+			emit_byte(compiler, OP_GREATER_EQUAL);
 			break;
 		case TOKEN_LESS:
-			compile_expr(expr.right);
-			emit_byte(OP_LESS);
+			compile_expr(compiler, expr.right);
+			emit_byte(compiler, OP_LESS);
 			break;
 		case TOKEN_LESS_EQUAL:
-			compile_expr(expr.right);
-			emit_bytes(2, OP_GREATER, OP_NOT);
+			compile_expr(compiler, expr.right);
+			emit_byte(compiler, OP_LESS_EQUAL);
 			break;
 		case TOKEN_AND:
 		{
-			usize end_jump = emit_jump(OP_JUMP_IF_FALSE);
-			emit_byte(OP_POP);
-			compile_expr(expr.right);
-			patch_jump(end_jump);
+			usize end_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
+			emit_byte(compiler, OP_POP);
+			compile_expr(compiler, expr.right);
+			patch_jump(compiler, end_jump);
 		}
 		break;
 
 		case TOKEN_OR:
 		{
-			usize else_jump = emit_jump(OP_JUMP_IF_FALSE);
-			usize end_jump = emit_jump(OP_JUMP);
+			usize else_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
+			usize end_jump = emit_jump(compiler, OP_JUMP);
 
-			patch_jump(else_jump);
-			emit_byte(OP_POP);
-			compile_expr(expr.right);
-			patch_jump(end_jump);
+			patch_jump(compiler, else_jump);
+			emit_byte(compiler, OP_POP);
+			compile_expr(compiler, expr.right);
+			patch_jump(compiler, end_jump);
 		}
 		break;
 
@@ -464,16 +775,16 @@ static CompileResult compile_binary_expr(BinaryExpr expr)
 	return COMPILE_OK;
 }
 
-static CompileResult compile_unary_expr(UnaryExpr expr)
+static CompileResult compile_unary_expr(Compiler *compiler, UnaryExpr expr)
 {
 	switch (expr.op)
 	{
 		case TOKEN_MINUS:
-			emit_byte(OP_NEGATE);
+			emit_byte(compiler, OP_NEGATE);
 			break;
 
 		case TOKEN_NOT:
-			emit_byte(OP_NOT);
+			emit_byte(compiler, OP_NOT);
 			break;
 
 		default:
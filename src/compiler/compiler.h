@@ -6,7 +6,7 @@ struct Chunk;
 typedef enum CompileResult
 {
 	COMPILE_OK,
-	// TODO:
+	COMPILE_ERROR,
 } CompileResult;
 
 CompileResult compile_program(struct Chunk *chunk, struct Program program);
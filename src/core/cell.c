@@ -4,29 +4,134 @@
 #include "core/memory.h"
 #include "core/value.h"
 #include "core/hash_table.h"
+#include "core/dyn_array.h"
+#include "core/gc.h"
 
 bool cell_is_of_type(Value value, CellType type)
 {
 	return is_cell(value) && value.as.cell->type == type;
 }
 
+// Concatenations shorter than this are copied right away instead of going
+// through a rope
+#define ROPE_MIN_LEN 32
+
 #define ALLOC_CELL(type, cell_type, additional_size) \
 	(type *)allocate_cell(sizeof(type), cell_type, additional_size);
 
 static Cell *allocate_cell(usize size, CellType type, usize additional_size)
 {
-	Cell *cell = mem_malloc(size + additional_size);
+	MemCategory category = type == CELL_STRING ? MEM_STRINGS : MEM_CELLS;
+	Cell *cell = gc_allocate(size + additional_size, category);
 	cell->type = type;
 	return cell;
 }
 
-static String *allocate_string(const char *str, i32 len)
+usize cell_size(Cell *cell)
+{
+	switch (cell->type)
+	{
+		case CELL_STRING:
+			return sizeof(String) + ((String *)cell)->len + 1;
+		case CELL_ROPE:
+			return sizeof(Rope);
+		case CELL_MAP:
+			return sizeof(Map);
+		case CELL_ARRAY:
+			return sizeof(Array);
+		case CELL_FUNCTION:
+			return sizeof(CompiledFunction);
+		case CELL_COROUTINE:
+			return sizeof(Coroutine);
+		case CELL_ACTOR:
+			return sizeof(ActorRef);
+	}
+
+	UNREACHABLE();
+}
+
+void cell_free_buffers(Cell *cell)
+{
+	switch (cell->type)
+	{
+		case CELL_MAP:
+			hash_table_free(&((Map *)cell)->table);
+			break;
+
+		case CELL_ARRAY:
+			arrfree(((Array *)cell)->items);
+			break;
+
+		// Compiled functions are freed by the chunk they were declared in,
+		// and the fibers of coroutines by their heap
+		case CELL_STRING:
+		case CELL_COROUTINE:
+		case CELL_ROPE:
+		case CELL_FUNCTION:
+		case CELL_ACTOR:
+			break;
+	}
+}
+
+static String *allocate_string(i32 len)
 {
 	String *string = ALLOC_CELL(String, CELL_STRING, len + 1);
 	string->len = len;
+	string->table = NULL;
+	string->str[len] = '\0';
+
+	return string;
+}
+
+static String *copy_string(const char *str, i32 len)
+{
+	String *string = allocate_string(len);
+	string->hash = hash_string(str, len);
 
 	memcpy(string->str, str, len);
-	string->str[len] = '\0';
+
+	return string;
+}
+
+void string_table_init(StringTable *strings, StringTable *shared)
+{
+	hash_table_init_as(&strings->table, TABLE_STRINGS);
+	strings->shared = shared;
+}
+
+void string_table_free(StringTable *strings)
+{
+	hash_table_free(&strings->table);
+	strings->shared = NULL;
+}
+
+String *string_table_find(StringTable *strings, const char *str, i32 len)
+{
+	for (; strings != NULL; strings = strings->shared)
+	{
+		String *string = hash_table_find_key(&strings->table, str, len);
+
+		if (string != NULL)
+		{
+			gc_revive((Cell *)string);
+			return string;
+		}
+	}
+
+	return NULL;
+}
+
+static String *intern_string(StringTable *strings, const char *str, i32 len)
+{
+	String *string = string_table_find(strings, str, len);
+
+	if (string == NULL)
+	{
+		string = copy_string(str, len);
+		string->table = strings;
+		hash_table_set(&strings->table, value_cell((Cell *)string),
+					   value_nil());
+	}
 
 	return string;
 }
@@ -34,7 +139,7 @@ static String *allocate_string(const char *str, i32 len)
 static const char *string_sanitize(const char *str, i32 *str_len);
 static bool needs_sanitization(const char *str, i32 len);
 
-String *string_from_str(HashTable *strings, const char *str, i32 len)
+String *string_from_str(StringTable *strings, const char *str, i32 len)
 {
 	const char *str_cleaned = str;
 	i32 len_cleaned = len;
@@ -46,12 +151,43 @@ String *string_from_str(HashTable *strings, const char *str, i32 len)
 		sanitized = true;
 	}
 
-	String *string = hash_table_find_key(strings, str_cleaned, len_cleaned);
+	String *string = intern_string(strings, str_cleaned, len_cleaned);
 
-	if (string == NULL)
+	if (sanitized)
+	{
+		free((char *)str_cleaned);
+	}
+
+	return string;
+}
+
+String *string_from_cstr(StringTable *strings, const char *str)
+{
+	return string_from_str(strings, str, (i32)strlen(str));
+}
+
+Value string_literal(StringTable *strings, const char *str, i32 len)
+{
+	const char *str_cleaned = str;
+	i32 len_cleaned = len;
+	bool sanitized = false;
+
+	if (needs_sanitization(str, len))
+	{
+		str_cleaned = string_sanitize(str, &len_cleaned);
+		sanitized = true;
+	}
+
+	Value value;
+
+	if (len_cleaned <= SHORT_STRING_MAX)
 	{
-		string = allocate_string(str_cleaned, len_cleaned);
-		hash_table_set(strings, string, value_nil());
+		value = value_short_string(str_cleaned, len_cleaned);
+	}
+	else
+	{
+		String *string = intern_string(strings, str_cleaned, len_cleaned);
+		value = value_cell((Cell *)string);
 	}
 
 	if (sanitized)
@@ -59,12 +195,424 @@ String *string_from_str(HashTable *strings, const char *str, i32 len)
 		free((char *)str_cleaned);
 	}
 
-	return string;
+	return value;
 }
 
-String *string_from_cstr(HashTable *strings, const char *str)
+Value string_copy(const char *str, i32 len)
 {
-	return string_from_str(strings, str, (i32)strlen(str));
+	if (len <= SHORT_STRING_MAX)
+	{
+		return value_short_string(str, len);
+	}
+
+	return value_cell((Cell *)copy_string(str, len));
+}
+
+i32 string_length(Value value)
+{
+	if (is_short_string(value))
+	{
+		return as_short_string(value).len;
+	}
+
+	return is_string(value) ? as_string(value)->len : as_rope(value)->len;
+}
+
+const char *string_chars(const Value *value)
+{
+	if (is_short_string(*value))
+	{
+		return value->as.short_string.str;
+	}
+
+	return string_flatten(*value)->str;
+}
+
+bool string_concat(Value a, Value b, Value *result)
+{
+	i32 a_len = string_length(a);
+	i32 b_len = string_length(b);
+
+	// Ropes make doubling a string cheap, so the limit is reached quickly
+	if (a_len > STRING_MAX_LEN - b_len)
+	{
+		return false;
+	}
+
+	i32 len = a_len + b_len;
+
+	if (a_len == 0)
+	{
+		*result = b;
+		return true;
+	}
+
+	if (b_len == 0)
+	{
+		*result = a;
+		return true;
+	}
+
+	if (len <= SHORT_STRING_MAX)
+	{
+		char buffer[SHORT_STRING_MAX];
+		string_write(a, buffer);
+		string_write(b, buffer + a_len);
+
+		*result = value_short_string(buffer, len);
+		return true;
+	}
+
+	// Copying small strings is cheaper than allocating a node and flattening
+	// it later on
+	if (len <= ROPE_MIN_LEN)
+	{
+		String *string = allocate_string(len);
+		string_write(a, string->str);
+		string_write(b, string->str + a_len);
+		string->hash = hash_string(string->str, string->len);
+
+		*result = value_cell((Cell *)string);
+		return true;
+	}
+
+	gc_write_barrier(a);
+	gc_write_barrier(b);
+
+	Rope *rope = ALLOC_CELL(Rope, CELL_ROPE, 0);
+	rope->len = len;
+	rope->left = a;
+	rope->right = b;
+	rope->flat = NULL;
+
+	*result = value_cell((Cell *)rope);
+	return true;
+}
+
+void string_write(Value value, char *dest)
+{
+	// Ropes built in loops are very unbalanced, so walk them with an explicit
+	// stack instead of recursing
+	Value *stack = NULL;
+	arrpush(stack, value);
+
+	while (!arrempty(stack))
+	{
+		Value top = arrpop(stack);
+
+		if (is_rope(top) && as_rope(top)->flat == NULL)
+		{
+			arrpush(stack, as_rope(top)->right);
+			arrpush(stack, as_rope(top)->left);
+			continue;
+		}
+
+		i32 len = string_length(top);
+		memcpy(dest, string_chars(&top), len);
+		dest += len;
+	}
+
+	arrfree(stack);
+}
+
+String *string_flatten(Value value)
+{
+	if (is_string(value))
+	{
+		return as_string(value);
+	}
+
+	Rope *rope = as_rope(value);
+
+	if (rope->flat == NULL)
+	{
+		String *string = allocate_string(rope->len);
+		string_write(value, string->str);
+		string->hash = hash_string(string->str, string->len);
+
+		rope->flat = string;
+		rope->left = value_nil();
+		rope->right = value_nil();
+	}
+
+	return rope->flat;
+}
+
+Value string_intern(StringTable *strings, Value value)
+{
+	if (!is_any_string(value) || is_short_string(value))
+	{
+		return value;
+	}
+
+	String *string = string_flatten(value);
+
+	// Keep a single representation per content, so that keys hash the same
+	if (string->len <= SHORT_STRING_MAX)
+	{
+		return value_short_string(string->str, string->len);
+	}
+
+	if (string->table == NULL)
+	{
+		String *interned =
+			string_table_find(strings, string->str, string->len);
+
+		if (interned == NULL)
+		{
+			// Nobody else references this content yet, so the runtime string
+			// itself can become the canonical one
+			string->table = strings;
+			hash_table_set(&strings->table, value_cell((Cell *)string),
+						   value_nil());
+			interned = string;
+		}
+
+		if (is_rope(value))
+		{
+			gc_write_barrier(value_cell((Cell *)interned));
+			as_rope(value)->flat = interned;
+		}
+
+		string = interned;
+	}
+
+	return value_cell((Cell *)string);
+}
+
+bool string_equal(Value a, Value b)
+{
+	i32 len = string_length(a);
+
+	if (len != string_length(b))
+	{
+		return false;
+	}
+
+	if (!is_short_string(a) && !is_short_string(b))
+	{
+		String *a_str = string_flatten(a);
+		String *b_str = string_flatten(b);
+
+		if (a_str == b_str)
+		{
+			return true;
+		}
+
+		bool same_table = a_str->table != NULL && a_str->table == b_str->table;
+
+		if (same_table || a_str->hash != b_str->hash)
+		{
+			return false;
+		}
+	}
+
+	return memcmp(string_chars(&a), string_chars(&b), len) == 0;
+}
+
+Map *map_new()
+{
+	Map *map = ALLOC_CELL(Map, CELL_MAP, 0);
+	hash_table_init_as(&map->table, TABLE_MAPS);
+	return map;
+}
+
+Array *array_new(i32 count)
+{
+	Array *array = ALLOC_CELL(Array, CELL_ARRAY, 0);
+	array->items = NULL;
+	arrsetcap(array->items, count);
+	return array;
+}
+
+Value *array_at(Array *array, Value index)
+{
+	if (!is_number(index))
+	{
+		return NULL;
+	}
+
+	f64 position = as_number(index);
+
+	if (position < 0 || position >= arrlen(array->items) ||
+		position != (f64)(i64)position)
+	{
+		return NULL;
+	}
+
+	return &array->items[(i64)position];
+}
+
+CompiledFunction *compiled_function_new(String *name, i32 arity,
+										struct Chunk *chunk)
+{
+	CompiledFunction *function = ALLOC_CELL(CompiledFunction, CELL_FUNCTION, 0);
+	function->arity = arity;
+	function->name = name;
+	function->chunk = chunk;
+	return function;
+}
+
+Coroutine *coroutine_new(Value function)
+{
+	Coroutine *coroutine = ALLOC_CELL(Coroutine, CELL_COROUTINE, 0);
+	coroutine->state = COROUTINE_CREATED;
+	coroutine->function = function;
+	coroutine->fiber = NULL;
+	coroutine->caller = NULL;
+	return coroutine;
+}
+
+// Handles are shared by every instance, so no heap owns them
+ActorRef *actor_ref_new(struct Actor *actor)
+{
+	Heap *previous = gc_enter(NULL);
+
+	ActorRef *ref = ALLOC_CELL(ActorRef, CELL_ACTOR, 0);
+	ref->actor = actor;
+
+	gc_enter(previous);
+
+	return ref;
+}
+
+static bool copy_deep(Value value, Value *copy, HashTable *copies);
+
+static bool copy_map(Map *map, Value *copy, HashTable *copies)
+{
+	Map *result = map_new();
+	*copy = value_cell((Cell *)result);
+	hash_table_set(copies, value_cell((Cell *)map), *copy);
+
+	i32 cursor = 0;
+	Entry *entry;
+
+	while ((entry = hash_table_next(&map->table, &cursor)) != NULL)
+	{
+		Value key = value_nil();
+		Value value = value_nil();
+
+		bool copied = copy_deep(entry->key, &key, copies) &&
+					  copy_deep(entry->value, &value, copies);
+
+		// Partial copies are kept as well, see value_copy_deep
+		if (!is_nil(key))
+		{
+			hash_table_set(&result->table, key, value);
+		}
+
+		if (!copied)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool copy_array(Array *array, Value *copy, HashTable *copies)
+{
+	i32 count = (i32)arrlen(array->items);
+
+	Array *result = array_new(count);
+	*copy = value_cell((Cell *)result);
+	hash_table_set(copies, value_cell((Cell *)array), *copy);
+
+	for (i32 i = 0; i < count; i++)
+	{
+		Value item = value_nil();
+		bool copied = copy_deep(array->items[i], &item, copies);
+
+		// Partial copies are kept as well, see value_copy_deep
+		arrpush(result->items, item);
+
+		if (!copied)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool copy_deep(Value value, Value *copy, HashTable *copies)
+{
+	if (is_function(value))
+	{
+		printf("Only compiled functions can be copied to another instance\n");
+		return false;
+	}
+
+	if (!is_cell(value))
+	{
+		*copy = value;
+		return true;
+	}
+
+	// Keeps cycles and shared containers as they are
+	if (hash_table_get(copies, value, copy))
+	{
+		return true;
+	}
+
+	switch (as_cell(value)->type)
+	{
+		// Even interned strings are copied, as they may outlive their table
+		case CELL_STRING:
+			*copy = string_copy(as_string(value)->str, as_string(value)->len);
+			return true;
+
+		// Flattening would allocate on the heap of the sender
+		case CELL_ROPE:
+		{
+			String *string = allocate_string(as_rope(value)->len);
+			string_write(value, string->str);
+			string->hash = hash_string(string->str, string->len);
+			*copy = value_cell((Cell *)string);
+			return true;
+		}
+
+		case CELL_FUNCTION:
+		case CELL_ACTOR:
+			*copy = value;
+			return true;
+
+		case CELL_MAP:
+			return copy_map(as_map(value), copy, copies);
+
+		case CELL_ARRAY:
+			return copy_array(as_array(value), copy, copies);
+
+		case CELL_COROUTINE:
+			printf("Coroutines cannot be copied to another instance\n");
+			return false;
+	}
+
+	return false;
+}
+
+bool value_copy_deep(Value value, Value *copy)
+{
+	HashTable copies;
+	hash_table_init(&copies);
+
+	// Copies belong to no heap until adopted by their receiver
+	Heap *previous = gc_enter(NULL);
+	*copy = value_nil();
+	bool copied = copy_deep(value, copy, &copies);
+	gc_enter(previous);
+
+	// Whatever a failed copy allocated is still reachable from it, as
+	// containers keep their partial items
+	if (!copied)
+	{
+		gc_release(*copy);
+		*copy = value_nil();
+	}
+
+	hash_table_free(&copies);
+
+	return copied;
 }
 
 static bool needs_sanitization(const char *str, i32 len)
@@ -1,36 +1,188 @@
 #pragma once
 
 #include "common.h"
+#include "hash_table.h"
 
 struct Value;
-struct HashTable;
 
 typedef enum CellType
 {
 	CELL_STRING,
+	CELL_ROPE,
+	CELL_MAP,
+	CELL_ARRAY,
+	CELL_FUNCTION,
+	CELL_COROUTINE,
+	CELL_ACTOR,
 } CellType;
 
+// See core/gc.h
+typedef enum CellColor
+{
+	COLOR_UNTRACKED,
+	COLOR_WHITE,
+	COLOR_GRAY,
+	COLOR_BLACK,
+} CellColor;
+
 typedef struct Cell
 {
-	CellType type;
+	CellType type : 8;
+	CellColor color : 8;
+	bool in_slab; // Otherwise allocated with mem_malloc, see core/slab.h
+	struct Cell *next; // In the list of its heap
 } Cell;
 
 #ifdef _WIN32
 #pragma warning(disable : 4200)
 #endif
+// Identifiers and literals are interned while parsing, so that they can be
+// compared by address. Strings built at runtime are not: they are only interned
+// when used as map keys, and are otherwise compared by content.
+// Only strings interned in the same table can be told apart by address alone,
+// since several instances may share compiled code.
 typedef struct String
 {
 	Cell cell;
 	i32 len;
+	u32 hash;
+	struct StringTable *table; // Where the string is interned, if anywhere
 	char str[];
 } String;
 
+// Lengths are i32, and strings are allocated with their null terminator
+#define STRING_MAX_LEN (INT32_MAX - 1)
+
+// Result of a runtime concatenation. Ropes are only flattened once their
+// content is needed as a whole, so that building a string in a loop stays
+// linear in its final length.
+typedef struct Rope
+{
+	Cell cell;
+	i32 len;
+	struct Value left;
+	struct Value right;
+	String *flat;
+} Rope;
+
+typedef struct Map
+{
+	Cell cell;
+	HashTable table;
+} Map;
+
+typedef struct Array
+{
+	Cell cell;
+	struct Value *items; // Dynamic array
+} Array;
+
+// Function compiled for the bytecode vm. When called, slot 0 of its frame
+// holds the function itself, followed by the arguments.
+typedef struct CompiledFunction
+{
+	Cell cell;
+	i32 arity;
+	String *name;
+	struct Chunk *chunk;
+} CompiledFunction;
+
+typedef enum CoroutineState
+{
+	COROUTINE_CREATED,
+	COROUTINE_SUSPENDED,
+	COROUTINE_WAITING, // Suspended until an async request completes
+	COROUTINE_RUNNING,
+	COROUTINE_DONE,
+} CoroutineState;
+
+// A coroutine runs `function` on a fiber of its own, which is allocated when
+// it is first resumed and released once the function returns.
+typedef struct Coroutine
+{
+	Cell cell;
+	CoroutineState state;
+	struct Value function;
+	struct Fiber *fiber;
+	struct Coroutine *caller; // NULL when resumed from the main fiber
+} Coroutine;
+
+// Handle on an actor. Every handle on a given actor is the same cell, so that
+// handles compare by address.
+typedef struct ActorRef
+{
+	Cell cell;
+	struct Actor *actor;
+} ActorRef;
+
 #define is_string(value) cell_is_of_type((value), CELL_STRING)
+#define is_rope(value) cell_is_of_type((value), CELL_ROPE)
+#define is_map(value) cell_is_of_type((value), CELL_MAP)
+#define is_array(value) cell_is_of_type((value), CELL_ARRAY)
+#define is_compiled_function(value) cell_is_of_type((value), CELL_FUNCTION)
+#define is_coroutine(value) cell_is_of_type((value), CELL_COROUTINE)
+#define is_actor_ref(value) cell_is_of_type((value), CELL_ACTOR)
+
+#define is_any_string(value) \
+	(is_short_string(value) || is_string(value) || is_rope(value))
 
 #define as_string(value) ((String *)(value).as.cell)
 #define as_cstring(value) (as_string(value)->str)
+#define as_rope(value) ((Rope *)(value).as.cell)
+#define as_map(value) ((Map *)(value).as.cell)
+#define as_array(value) ((Array *)(value).as.cell)
+#define as_compiled_function(value) ((CompiledFunction *)(value).as.cell)
+#define as_coroutine(value) ((Coroutine *)(value).as.cell)
+#define as_actor_ref(value) ((ActorRef *)(value).as.cell)
+
+// Interned strings. `shared` is an optional table owned by another instance,
+// searched as well so that the strings it holds keep a single address across
+// instances. It is only ever read, and must not change while in use.
+typedef struct StringTable
+{
+	HashTable table;
+	struct StringTable *shared;
+} StringTable;
 
 bool cell_is_of_type(struct Value value, CellType type);
+// Size of the cell itself, without the buffers it owns
+usize cell_size(Cell *cell);
+// Releases the buffers owned by the cell, but not the cell itself
+void cell_free_buffers(Cell *cell);
+
+void string_table_init(StringTable *strings, StringTable *shared);
+void string_table_free(StringTable *strings);
+String *string_table_find(StringTable *strings, const char *str, i32 len);
+
+String *string_from_str(StringTable *strings, const char *str, i32 len);
+String *string_from_cstr(StringTable *strings, const char *str);
+struct Value string_literal(StringTable *strings, const char *str, i32 len);
+// Runtime string holding a copy of `str`, which is not interned
+struct Value string_copy(const char *str, i32 len);
+
+i32 string_length(struct Value value);
+const char *string_chars(const struct Value *value);
+// Returns false, leaving `result` untouched, if the string would be longer
+// than STRING_MAX_LEN
+bool string_concat(struct Value a, struct Value b, struct Value *result);
+String *string_flatten(struct Value value);
+struct Value string_intern(StringTable *strings, struct Value value);
+bool string_equal(struct Value a, struct Value b);
+void string_write(struct Value value, char *dest);
+
+Map *map_new();
+// `count` items are reserved, but the array starts empty
+Array *array_new(i32 count);
+// NULL unless `index` is an integer within the bounds of the array
+struct Value *array_at(Array *array, struct Value index);
+
+CompiledFunction *compiled_function_new(String *name, i32 arity,
+										struct Chunk *chunk);
+Coroutine *coroutine_new(struct Value function);
+ActorRef *actor_ref_new(struct Actor *actor);
 
-String *string_from_str(struct HashTable *strings, const char *str, i32 len);
-String *string_from_cstr(struct HashTable *strings, const char *str);
+// Copies `value` so that it can be handed over to another instance, cycles
+// included. Compiled functions and actor handles never change, and are shared
+// instead. Fails on values that are bound to their instance. Copies are not
+// tracked by any heap, see gc_adopt.
+bool value_copy_deep(struct Value value, struct Value *copy);
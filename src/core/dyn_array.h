@@ -2,8 +2,8 @@
 
 #include "memory.h"
 
-//#define STBDS_REALLOC mem_realloc
-//#define STBDS_FREE mem_free
+#define STBDS_REALLOC(context, ptr, size) mem_realloc(ptr, size)
+#define STBDS_FREE(context, ptr) mem_free(ptr)
 #include "core/stb_ds.h"
 
 #define arrempty(arr) (arrlen(arr) == 0)
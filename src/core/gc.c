@@ -0,0 +1,618 @@
+#include "gc.h"
+
+#include <stdlib.h>
+
+#include "dyn_array.h"
+#include "hash_table.h"
+#include "memory.h"
+#include "metrics.h"
+
+// Allocations between two steps
+#define GC_STEP_SIZE (64 * 1024)
+#define GC_MIN_THRESHOLD (1024 * 1024)
+#define GC_HEAP_GROWTH 2
+#define GC_PAUSE_BUDGET_NS 250000
+
+// Bytes of cells marked or swept for each byte allocated
+#define GC_WORK_RATIO 2
+
+// Cells processed between two looks at the clock
+#define GC_WORK_SLICE 16
+
+static _Thread_local Heap *current_heap = NULL;
+
+void gc_heap_init(Heap *heap, StringTable *strings, GcMarkRoots mark_roots,
+				  GcMarkFiber mark_fiber, GcFreeFiber free_fiber,
+				  void *owner)
+{
+	heap->cells = NULL;
+	heap->unswept = NULL;
+	heap->gray = NULL;
+	heap->shaded = 0;
+	heap->phase = GC_IDLE;
+
+	heap->allocated = 0;
+	heap->survived = 0;
+	heap->threshold = GC_MIN_THRESHOLD;
+	heap->debt = 0;
+	heap->step_pending = false;
+
+	slab_init(&heap->slab);
+
+	heap->pause_budget = GC_PAUSE_BUDGET_NS;
+	heap->pause_count = 0;
+	heap->pause_max = 0;
+
+	heap->strings = strings;
+	heap->mark_roots = mark_roots;
+	heap->mark_fiber = mark_fiber;
+	heap->free_fiber = free_fiber;
+	heap->owner = owner;
+}
+
+// Only the vm knows what fibers hold
+static void free_buffers(Heap *heap, Cell *cell)
+{
+	if (cell->type == CELL_COROUTINE && ((Coroutine *)cell)->fiber != NULL)
+	{
+		heap->free_fiber(((Coroutine *)cell)->fiber);
+		((Coroutine *)cell)->fiber = NULL;
+	}
+
+	cell_free_buffers(cell);
+}
+
+static void free_cell(Heap *heap, Cell *cell)
+{
+	free_buffers(heap, cell);
+
+	if (cell->in_slab)
+	{
+		slab_free(&heap->slab, cell);
+	}
+	else
+	{
+		mem_free(cell);
+	}
+}
+
+// Cells in slabs are left to slab_release
+static void free_cells(Heap *heap, Cell *cell)
+{
+	while (cell != NULL)
+	{
+		Cell *next = cell->next;
+		free_buffers(heap, cell);
+
+		if (!cell->in_slab)
+		{
+			mem_free(cell);
+		}
+
+		cell = next;
+	}
+}
+
+void gc_heap_free(Heap *heap)
+{
+	free_cells(heap, heap->cells);
+	free_cells(heap, heap->unswept);
+	heap->cells = NULL;
+	heap->unswept = NULL;
+	slab_release(&heap->slab);
+
+	arrfree(heap->gray);
+	heap->allocated = 0;
+	heap->phase = GC_IDLE;
+}
+
+Heap *gc_enter(Heap *heap)
+{
+	Heap *previous = current_heap;
+	current_heap = heap;
+	return previous;
+}
+
+Heap *gc_current_heap()
+{
+	return current_heap;
+}
+
+static void link_cell(Heap *heap, Cell *cell, usize size)
+{
+	// Sweeping only goes through the cells that were there when it started
+	cell->color = heap->phase == GC_MARK ? COLOR_BLACK : COLOR_WHITE;
+	cell->next = heap->cells;
+	heap->cells = cell;
+
+	heap->allocated += size;
+	heap->debt += size;
+
+	if (heap->debt >= GC_STEP_SIZE &&
+		(heap->phase != GC_IDLE || heap->allocated >= heap->threshold))
+	{
+		heap->step_pending = true;
+	}
+}
+
+Cell *gc_allocate(usize size, MemCategory category)
+{
+	Heap *heap = current_heap;
+
+	if (heap == NULL)
+	{
+		Cell *cell = mem_malloc_as(category, size);
+		cell->color = COLOR_UNTRACKED;
+		cell->in_slab = false;
+		cell->next = NULL;
+		return cell;
+	}
+
+	Cell *cell = slab_allocate(&heap->slab, size);
+	bool in_slab = cell != NULL;
+
+	if (!in_slab)
+	{
+		cell = mem_malloc_as(category, size);
+		heap->slab.stats.large += 1;
+	}
+
+	cell->in_slab = in_slab;
+	link_cell(heap, cell, size);
+
+	return cell;
+}
+
+static bool can_adopt(Cell *cell)
+{
+	if (cell->color != COLOR_UNTRACKED)
+	{
+		return false;
+	}
+
+	switch (cell->type)
+	{
+		case CELL_STRING:
+			return ((String *)cell)->table == NULL;
+
+		case CELL_FUNCTION:
+		case CELL_ACTOR:
+			return false;
+
+		case CELL_ROPE:
+		case CELL_MAP:
+		case CELL_ARRAY:
+		case CELL_COROUTINE:
+			return true;
+	}
+
+	return false;
+}
+
+// Pushes the values held by `cell`
+static void push_children(Value **stack, Cell *cell)
+{
+	switch (cell->type)
+	{
+		case CELL_ROPE:
+		{
+			Rope *rope = (Rope *)cell;
+			arrpush(*stack, rope->left);
+			arrpush(*stack, rope->right);
+			if (rope->flat != NULL)
+			{
+				arrpush(*stack, value_cell((Cell *)rope->flat));
+			}
+		}
+		break;
+
+		case CELL_MAP:
+		{
+			i32 cursor = 0;
+			Entry *entry;
+			while ((entry = hash_table_next(&((Map *)cell)->table, &cursor)) !=
+				   NULL)
+			{
+				arrpush(*stack, entry->key);
+				arrpush(*stack, entry->value);
+			}
+		}
+		break;
+
+		case CELL_ARRAY:
+		{
+			Array *array = (Array *)cell;
+			for (i32 i = 0; i < arrlen(array->items); i++)
+			{
+				arrpush(*stack, array->items[i]);
+			}
+		}
+		break;
+
+		// Copies never hold coroutines, which are never shared either
+		case CELL_COROUTINE:
+		case CELL_STRING:
+		case CELL_FUNCTION:
+		case CELL_ACTOR:
+			break;
+	}
+}
+
+void gc_adopt(Value value)
+{
+	Heap *heap = current_heap;
+
+	if (heap == NULL)
+	{
+		return;
+	}
+
+	Value *stack = NULL;
+	arrpush(stack, value);
+
+	while (!arrempty(stack))
+	{
+		Value top = arrpop(stack);
+
+		if (!is_cell(top) || !can_adopt(as_cell(top)))
+		{
+			continue;
+		}
+
+		Cell *cell = as_cell(top);
+		link_cell(heap, cell, cell_size(cell));
+		push_children(&stack, cell);
+	}
+
+	arrfree(stack);
+}
+
+void gc_release(Value value)
+{
+	Value *stack = NULL;
+	Cell **cells = NULL;
+	arrpush(stack, value);
+
+	while (!arrempty(stack))
+	{
+		Value top = arrpop(stack);
+
+		if (!is_cell(top) || !can_adopt(as_cell(top)))
+		{
+			continue;
+		}
+
+		// Cells reached twice are only freed once, as they are no longer
+		// untracked
+		Cell *cell = as_cell(top);
+		cell->color = COLOR_BLACK;
+		arrpush(cells, cell);
+		push_children(&stack, cell);
+	}
+
+	for (i32 i = 0; i < arrlen(cells); i++)
+	{
+		cell_free_buffers(cells[i]);
+		mem_free(cells[i]);
+	}
+
+	arrfree(cells);
+	arrfree(stack);
+}
+
+void gc_set_pause_budget(Heap *heap, u64 nanoseconds)
+{
+	heap->pause_budget = nanoseconds;
+}
+
+void gc_mark_cell(Heap *heap, Cell *cell)
+{
+	if (cell != NULL && cell->color == COLOR_WHITE)
+	{
+		cell->color = COLOR_GRAY;
+		heap->shaded += 1;
+		arrpush(heap->gray, cell);
+	}
+}
+
+void gc_mark_value(Heap *heap, Value value)
+{
+	if (is_cell(value))
+	{
+		gc_mark_cell(heap, as_cell(value));
+	}
+}
+
+void gc_retrace(Heap *heap, Cell *cell)
+{
+	if (heap->phase != GC_MARK)
+	{
+		return;
+	}
+
+	if (cell->color == COLOR_BLACK)
+	{
+		cell->color = COLOR_GRAY;
+		arrpush(heap->gray, cell);
+		return;
+	}
+
+	gc_mark_cell(heap, cell);
+}
+
+void gc_shade(Cell *cell)
+{
+	if (current_heap != NULL && current_heap->phase == GC_MARK)
+	{
+		gc_mark_cell(current_heap, cell);
+	}
+}
+
+void gc_revive(Cell *cell)
+{
+	// Cells allocated while sweeping are white too, and only survive one more
+	// cycle when revived
+	if (current_heap != NULL && current_heap->phase == GC_SWEEP &&
+		cell->color == COLOR_WHITE)
+	{
+		cell->color = COLOR_BLACK;
+	}
+}
+
+static void mark_table(Heap *heap, HashTable *table)
+{
+	i32 cursor = 0;
+	Entry *entry;
+
+	while ((entry = hash_table_next(table, &cursor)) != NULL)
+	{
+		gc_mark_value(heap, entry->key);
+		gc_mark_value(heap, entry->value);
+	}
+}
+
+// Returns the work done, counted in bytes like allocations
+static usize blacken(Heap *heap, Cell *cell)
+{
+	cell->color = COLOR_BLACK;
+	usize work = cell_size(cell);
+
+	switch (cell->type)
+	{
+		case CELL_ROPE:
+		{
+			Rope *rope = (Rope *)cell;
+			gc_mark_value(heap, rope->left);
+			gc_mark_value(heap, rope->right);
+			gc_mark_cell(heap, (Cell *)rope->flat);
+		}
+		break;
+
+		case CELL_MAP:
+		{
+			HashTable *table = &((Map *)cell)->table;
+			mark_table(heap, table);
+			work += table->capacity * sizeof(Entry);
+		}
+		break;
+
+		case CELL_ARRAY:
+		{
+			Array *array = (Array *)cell;
+			for (i32 i = 0; i < arrlen(array->items); i++)
+			{
+				gc_mark_value(heap, array->items[i]);
+			}
+			work += arrlen(array->items) * sizeof(Value);
+		}
+		break;
+
+		case CELL_COROUTINE:
+		{
+			Coroutine *coroutine = (Coroutine *)cell;
+			gc_mark_value(heap, coroutine->function);
+			gc_mark_cell(heap, (Cell *)coroutine->caller);
+			if (coroutine->fiber != NULL)
+			{
+				heap->mark_fiber(heap, coroutine->fiber);
+			}
+		}
+		break;
+
+		// Compiled functions only reference their constants, which are never
+		// tracked
+		case CELL_STRING:
+		case CELL_FUNCTION:
+		case CELL_ACTOR:
+			break;
+	}
+
+	return work;
+}
+
+// A step pays off the allocations made since the previous one, unless it runs
+// out of time first, in which case the next safe point runs another step
+typedef struct Slice
+{
+	usize work;
+	usize target;
+	u64 deadline;
+} Slice;
+
+static bool slice_over(Slice *slice)
+{
+	return slice->work >= slice->target || metrics_now() >= slice->deadline;
+}
+
+// Returns true once there is nothing gray left
+static bool propagate(Heap *heap, Slice *slice)
+{
+	while (!arrempty(heap->gray))
+	{
+		if (slice_over(slice))
+		{
+			return false;
+		}
+
+		for (i32 i = 0; i < GC_WORK_SLICE && !arrempty(heap->gray); i++)
+		{
+			slice->work += blacken(heap, arrpop(heap->gray));
+		}
+	}
+
+	return true;
+}
+
+// Scans the roots again, as stacks are changed without barriers. Returns true
+// when nothing white was left, in which case only running coroutines were
+// shaded again, and blackening them only goes through their stacks.
+static bool rescan_roots(Heap *heap, Slice *slice)
+{
+	u64 shaded = heap->shaded;
+	heap->mark_roots(heap, heap->owner);
+
+	while (!arrempty(heap->gray) && heap->shaded == shaded)
+	{
+		slice->work += blacken(heap, arrpop(heap->gray));
+	}
+
+	return heap->shaded == shaded;
+}
+
+static void start_sweep(Heap *heap)
+{
+	heap->unswept = heap->cells;
+	heap->cells = NULL;
+	heap->survived = 0;
+	heap->phase = GC_SWEEP;
+}
+
+static void free_dead_cell(Heap *heap, Cell *cell)
+{
+	if (cell->type == CELL_STRING && ((String *)cell)->table != NULL)
+	{
+		hash_table_delete(&((String *)cell)->table->table, value_cell(cell));
+	}
+
+	free_cell(heap, cell);
+}
+
+// Returns true once every cell has been swept
+static bool sweep(Heap *heap, Slice *slice)
+{
+	while (heap->unswept != NULL)
+	{
+		if (slice_over(slice))
+		{
+			return false;
+		}
+
+		for (i32 i = 0; i < GC_WORK_SLICE && heap->unswept != NULL; i++)
+		{
+			Cell *cell = heap->unswept;
+			heap->unswept = cell->next;
+
+			usize size = cell_size(cell);
+			slice->work += size;
+
+			if (cell->color == COLOR_WHITE)
+			{
+				heap->allocated -= size;
+				free_dead_cell(heap, cell);
+				continue;
+			}
+
+			heap->survived += size;
+			cell->color = COLOR_WHITE;
+			cell->next = heap->cells;
+			heap->cells = cell;
+		}
+	}
+
+	return true;
+}
+
+void gc_step(Heap *heap)
+{
+	u64 start = metrics_now();
+
+	Slice slice = {
+		.work = 0,
+		.target = heap->debt * GC_WORK_RATIO,
+		.deadline = start + heap->pause_budget,
+	};
+
+	switch (heap->phase)
+	{
+		case GC_IDLE:
+			heap->phase = GC_MARK;
+			heap->debt = 0;
+			heap->mark_roots(heap, heap->owner);
+			break;
+
+		case GC_MARK:
+			// Each scan that fails shades cells that were white, of which
+			// there are fewer and fewer, as new cells are black
+			while (propagate(heap, &slice))
+			{
+				if (rescan_roots(heap, &slice))
+				{
+					start_sweep(heap);
+					break;
+				}
+			}
+			break;
+
+		case GC_SWEEP:
+			if (sweep(heap, &slice))
+			{
+				// Cells allocated during the cycle are left for the next one
+				usize growth = heap->survived * (GC_HEAP_GROWTH - 1);
+				heap->phase = GC_IDLE;
+				heap->debt = 0;
+				metrics_add(METRIC_GC_CYCLES, 1);
+				heap->threshold =
+					heap->allocated + MAX(growth, GC_MIN_THRESHOLD);
+				slab_trim(&heap->slab);
+			}
+			break;
+	}
+
+	heap->debt -= MIN(heap->debt, slice.work / GC_WORK_RATIO);
+	heap->step_pending = heap->phase != GC_IDLE && heap->debt >= GC_STEP_SIZE;
+
+	u64 pause = metrics_now() - start;
+	heap->pauses[heap->pause_count % GC_PAUSE_WINDOW] = pause;
+	heap->pause_count += 1;
+	heap->pause_max = MAX(heap->pause_max, pause);
+
+	metrics_end(PHASE_GC, start);
+}
+
+static int compare_pauses(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+	return (x > y) - (x < y);
+}
+
+u64 gc_pause_percentile(Heap *heap, f64 percentile)
+{
+	i32 count = (i32)MIN(heap->pause_count, GC_PAUSE_WINDOW);
+
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	u64 *sorted = mem_allocate(u64, count);
+	mem_copy(sorted, heap->pauses, sizeof(u64) * count);
+	qsort(sorted, count, sizeof(u64), compare_pauses);
+
+	i32 rank = (i32)(percentile / 100 * count + 0.999999);
+	u64 pause = sorted[MIN(MAX(rank, 1), count) - 1];
+
+	mem_free(sorted);
+
+	return pause;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "common.h"
+#include "cell.h"
+#include "memory.h"
+#include "slab.h"
+#include "value.h"
+
+struct Fiber;
+struct Heap;
+
+typedef void (*GcMarkRoots)(struct Heap *heap, void *owner);
+typedef void (*GcMarkFiber)(struct Heap *heap, struct Fiber *fiber);
+typedef void (*GcFreeFiber)(struct Fiber *fiber);
+
+// Steps whose pause is kept for percentiles
+#define GC_PAUSE_WINDOW 1024
+
+typedef enum GcPhase
+{
+	GC_IDLE,
+	GC_MARK,
+	GC_SWEEP,
+} GcPhase;
+
+// Incremental tri-color collector for the cells allocated by a vm.
+//
+// Cells are only tracked when allocated while their heap is current, see
+// gc_enter. Others, like compiled code or values handed from an instance to
+// another, are never collected, and must be adopted before a vm can store
+// anything into them.
+//
+// Allocations only pay off their debt at the safe points of the vm, where
+// every live value is reachable from the roots. Each step does a slice of
+// marking or sweeping bounded by the pause budget. Cells allocated while
+// marking are black, and stores into cells shade the stored value, so that
+// only the stacks of the running fibers have to be scanned again before the
+// heap is swept. They are scanned whenever nothing is left gray, and marking
+// is over once a scan finds no white cell within the step that made it.
+//
+// Dead strings are removed from the string table as they are swept, and the
+// ones found by lookups in the meantime are kept alive.
+typedef struct Heap
+{
+	Cell *cells; // Newest first
+	Cell *unswept; // Cells left to sweep, detached from `cells`
+	Cell **gray;
+	u64 shaded; // Cells turned gray so far
+	GcPhase phase;
+
+	usize allocated; // Bytes held by tracked cells
+	usize survived; // Bytes left by the last sweep
+	usize threshold; // Starts a cycle once `allocated` goes past it
+	usize debt; // Allocated since the last step
+	bool step_pending;
+
+	SlabAllocator slab; // Cells small enough, others use mem_malloc
+
+	u64 pause_budget; // In nanoseconds
+	u64 pauses[GC_PAUSE_WINDOW]; // Ring of the last durations of steps
+	u64 pause_count; // Steps so far
+	u64 pause_max;
+
+	StringTable *strings; // Weak, dead strings are removed as they are swept
+	GcMarkRoots mark_roots;
+	GcMarkFiber mark_fiber;
+	GcFreeFiber free_fiber; // Of the coroutines that are collected
+	void *owner;
+} Heap;
+
+void gc_heap_init(Heap *heap, StringTable *strings, GcMarkRoots mark_roots,
+				  GcMarkFiber mark_fiber, GcFreeFiber free_fiber,
+				  void *owner);
+// Frees every cell of the heap, and gives its slabs back all at once
+void gc_heap_free(Heap *heap);
+
+// Makes `heap` current on the calling thread, which can be NULL so that no
+// cell gets tracked, and returns the previous one
+Heap *gc_enter(Heap *heap);
+Heap *gc_current_heap();
+
+// Called by allocate_cell. Cells are taken from the slabs of the current heap,
+// if any, and tracked by it. `category` is only used for cells that don't fit
+// in slabs, see core/memory.h.
+Cell *gc_allocate(usize size, MemCategory category);
+
+// Tracks the untracked cells reachable from `value` on the current heap.
+// Compiled functions, actor handles and interned strings stay untracked, as
+// instances share them.
+void gc_adopt(Value value);
+// Frees the untracked cells reachable from `value`, for copies that no heap
+// will ever adopt
+void gc_release(Value value);
+
+void gc_set_pause_budget(Heap *heap, u64 nanoseconds);
+
+// Runs a slice of the current cycle, only called at safe points
+void gc_step(Heap *heap);
+
+// For roots and fibers
+void gc_mark_value(Heap *heap, Value value);
+void gc_mark_cell(Heap *heap, Cell *cell);
+
+// Marks `cell` again, for cells that are changed without write barriers, like
+// the coroutines whose fiber is running
+void gc_retrace(Heap *heap, Cell *cell);
+
+void gc_shade(Cell *cell);
+
+// Keeps a string found in a string table from being swept, as dead strings
+// stay interned until they are
+void gc_revive(Cell *cell);
+
+// Write barrier, to be called on every value stored into a cell
+#define gc_write_barrier(value)                                     \
+	do                                                              \
+	{                                                               \
+		if (is_cell(value) && as_cell(value)->color == COLOR_WHITE) \
+		{                                                           \
+			gc_shade(as_cell(value));                               \
+		}                                                           \
+	} while (false)
+
+// Nearest rank percentile of the last GC_PAUSE_WINDOW pauses, in nanoseconds,
+// 0 without any pause
+u64 gc_pause_percentile(Heap *heap, f64 percentile);
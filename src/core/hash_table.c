@@ -1,12 +1,23 @@
 #include "hash_table.h"
 
+#include <math.h>
+#include <stdatomic.h>
 #include <string.h>
 
 #include "value.h"
+#include "cell.h"
+#include "gc.h"
 #include "memory.h"
+#include "metrics.h"
 
 #define TABLE_MAX_LOAD 0.75
-static u32 hash_string(const char *str, i32 len)
+// Bounds of hash_table_set_max_load, as full tables would never end probing
+#define TABLE_MIN_LOAD_LIMIT 0.1
+#define TABLE_MAX_LOAD_LIMIT 0.95
+// Share of the capacity, past which tables are rehashed in place
+#define TABLE_MAX_TOMBSTONES 0.25
+
+u32 hash_string(const char *str, i32 len)
 {
 	// 32-bits FNV-1a hash
 	// https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
@@ -21,39 +32,315 @@ static u32 hash_string(const char *str, i32 len)
 	return hash;
 }
 
+// Spreads every bit of `bits` over the result, as small integers only differ
+// in the high bits of their doubles, and pointers in the middle ones
+static u32 mix_bits(u64 bits)
+{
+	bits ^= bits >> 33;
+	bits *= 0xff51afd7ed558ccdull;
+	bits ^= bits >> 33;
+
+	return (u32)bits;
+}
+
+static u32 hash_number(f64 number)
+{
+	// Make sure 0 and -0 end up in the same bucket, as they compare equal
+	if (number == 0)
+	{
+		number = 0;
+	}
+
+	u64 bits;
+	memcpy(&bits, &number, sizeof(bits));
+
+	return mix_bits(bits);
+}
+
+static u32 hash_pointer(void *ptr)
+{
+	return mix_bits((u64)(usize)ptr);
+}
+
+static u32 hash_value(Value value)
+{
+	switch (value.type)
+	{
+		case VALUE_BOOL:
+			return as_bool(value) ? 1231 : 1237;
+
+		case VALUE_NUMBER:
+			return hash_number(as_number(value));
+
+		case VALUE_SHORT_STRING:
+			return hash_string(as_short_string(value).str,
+							   as_short_string(value).len);
+
+		case VALUE_CELL:
+			if (is_string(value))
+			{
+				return as_string(value)->hash;
+			}
+			return hash_pointer(as_cell(value));
+
+		default:
+			UNREACHABLE();
+	}
+}
+
+bool hash_table_is_valid_key(Key key)
+{
+	// NaN isn't equal to itself, so it could never be found again
+	return is_bool(key) || (is_number(key) && !isnan(as_number(key))) ||
+		   is_short_string(key) || is_cell(key);
+}
+
+
+static f64 max_load = TABLE_MAX_LOAD;
+
+void hash_table_set_max_load(f64 load)
+{
+	max_load = MIN(MAX(load, TABLE_MIN_LOAD_LIMIT), TABLE_MAX_LOAD_LIMIT);
+}
+
+#ifdef CHARM_TABLE_STATS
+
+typedef struct Counters
+{
+	atomic_uint_fast64_t lookups;
+	atomic_uint_fast64_t probes[TABLE_PROBE_BUCKETS];
+	atomic_uint_fast64_t resizes;
+	atomic_uint_fast64_t rehashes;
+	atomic_int_fast64_t capacity;
+	atomic_int_fast64_t tombstones;
+} Counters;
+
+static Counters counters[TABLE_KIND_COUNT];
+
+static i32 probe_bucket(u64 probes)
+{
+	if (probes <= 4)
+	{
+		return (i32)probes - 1;
+	}
+
+	i32 bucket = 4;
+
+	for (u64 limit = 8; probes > limit && bucket < TABLE_PROBE_BUCKETS - 1;
+		 limit *= 2)
+	{
+		bucket += 1;
+	}
+
+	return bucket;
+}
+
+static void count_probes(HashTable *table, u64 probes)
+{
+	Counters *counter = &counters[table->kind];
+	atomic_fetch_add_explicit(&counter->lookups, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&counter->probes[probe_bucket(probes)], 1,
+							  memory_order_relaxed);
+}
+
+static void count_resize(HashTable *table, int new_capacity)
+{
+	Counters *counter = &counters[table->kind];
+	bool rehash = new_capacity == table->capacity;
+
+	if (new_capacity != 0)
+	{
+		atomic_fetch_add_explicit(rehash ? &counter->rehashes
+										 : &counter->resizes,
+								  1, memory_order_relaxed);
+	}
+
+	atomic_fetch_add_explicit(&counter->capacity,
+							  new_capacity - table->capacity,
+							  memory_order_relaxed);
+	atomic_fetch_sub_explicit(&counter->tombstones, table->tombstones,
+							  memory_order_relaxed);
+}
+
+static void count_tombstones(HashTable *table, i64 change)
+{
+	atomic_fetch_add_explicit(&counters[table->kind].tombstones, change,
+							  memory_order_relaxed);
+}
+
+TableStats hash_table_stats(TableKind kind)
+{
+	Counters *counter = &counters[kind];
+	TableStats stats = {
+		.lookups = atomic_load(&counter->lookups),
+		.resizes = atomic_load(&counter->resizes),
+		.rehashes = atomic_load(&counter->rehashes),
+		.capacity = atomic_load(&counter->capacity),
+		.tombstones = atomic_load(&counter->tombstones),
+	};
+
+	for (i32 i = 0; i < TABLE_PROBE_BUCKETS; i++)
+	{
+		stats.probes[i] = atomic_load(&counter->probes[i]);
+	}
+
+	return stats;
+}
+
+static const char *kind_names[TABLE_KIND_COUNT] = {
+	[TABLE_OTHER] = "other",
+	[TABLE_GLOBALS] = "globals",
+	[TABLE_STRINGS] = "strings",
+	[TABLE_MAPS] = "maps",
+	[TABLE_FRAMES] = "frames",
+};
+
+static const char *bucket_names[TABLE_PROBE_BUCKETS] = {
+	"1", "2", "3", "4", "<=8", "<=16", "<=32", ">32",
+};
+
+bool hash_table_stats_dump(FILE *out)
+{
+	fprintf(out, "%-8s %12s %8s %8s %10s %10s\n", "table", "lookups",
+			"resizes", "rehashes", "capacity", "tombstones");
+
+	for (i32 kind = 0; kind < TABLE_KIND_COUNT; kind++)
+	{
+		TableStats stats = hash_table_stats(kind);
+		fprintf(out, "%-8s %12llu %8llu %8llu %10lld %9.1f%%\n",
+				kind_names[kind], (unsigned long long)stats.lookups,
+				(unsigned long long)stats.resizes,
+				(unsigned long long)stats.rehashes, (long long)stats.capacity,
+				100.0 * stats.tombstones / MAX(stats.capacity, 1));
+	}
+
+	fprintf(out, "\n%-8s", "probes");
+
+	for (i32 i = 0; i < TABLE_PROBE_BUCKETS; i++)
+	{
+		fprintf(out, " %7s", bucket_names[i]);
+	}
+
+	fprintf(out, "\n");
+
+	for (i32 kind = 0; kind < TABLE_KIND_COUNT; kind++)
+	{
+		TableStats stats = hash_table_stats(kind);
+		fprintf(out, "%-8s", kind_names[kind]);
+
+		for (i32 i = 0; i < TABLE_PROBE_BUCKETS; i++)
+		{
+			fprintf(out, " %6.2f%%",
+					100.0 * stats.probes[i] / MAX(stats.lookups, 1));
+		}
+
+		fprintf(out, "\n");
+	}
+
+	return true;
+}
+
+#else
+
+#define count_probes(table, probes)
+#define count_resize(table, new_capacity)
+#define count_tombstones(table, change)
+
+TableStats hash_table_stats(TableKind kind)
+{
+	UNUSED(kind);
+	return (TableStats){ 0 };
+}
+
+bool hash_table_stats_dump(FILE *out)
+{
+	UNUSED(out);
+	return false;
+}
+
+#endif
+
 void hash_table_init(HashTable *table)
+{
+	hash_table_init_as(table, TABLE_OTHER);
+}
+
+void hash_table_init_as(HashTable *table, TableKind kind)
 {
 	mem_zero(table, HashTable, 1);
+	table->kind = kind;
 }
 
 void hash_table_free(HashTable *table)
 {
+	count_resize(table, 0);
 	mem_free_array(Entry, table->entries);
-	hash_table_init(table);
+	hash_table_init_as(table, table->kind);
 }
 
 static void adjust_capacity(HashTable *table, int new_capacity);
-static Entry *find_entry(Entry *entries, int capacity, Key key);
+static Entry *find_entry(HashTable *table, Key key);
 
 static bool is_null_entry(Entry *entry);
 static bool keys_equal(Key a, Key b);
 
-bool hash_table_set(HashTable *table, Key key, Value value)
+static void count_lookup(HashTable *table, u64 probes)
 {
-	if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+	MetricsBlock *block = metrics_local();
+	metrics_bump(&block->counts[METRIC_HASH_LOOKUPS], 1);
+	metrics_bump(&block->counts[METRIC_HASH_PROBES], probes);
+	count_probes(table, probes);
+}
+
+// Returns true if the entries moved to make room for a new key
+static bool make_room(HashTable *table)
+{
+	if (table->count + 1 > table->capacity * max_load)
 	{
-		int capacity = mem_grow_capacity(table->capacity, 0);
+		// Tables mostly made of tombstones are cleared rather than grown
+		int live = table->count - table->tombstones;
+		int capacity = live + 1 > table->capacity * max_load / 2
+						   ? mem_grow_capacity(table->capacity, 0)
+						   : table->capacity;
 		adjust_capacity(table, capacity);
+		return true;
 	}
 
-	Entry *entry = find_entry(table->entries, table->capacity, key);
+	if (table->tombstones > table->capacity * TABLE_MAX_TOMBSTONES)
+	{
+		// Tombstones lengthen the probes of lookups that miss
+		adjust_capacity(table, table->capacity);
+		return true;
+	}
+
+	return false;
+}
+
+bool hash_table_set(HashTable *table, Key key, Value value)
+{
+	// Entries only move when adding keys, so that the values of a table can
+	// be replaced while iterating over it
+	Entry *entry = table->capacity > 0 ? find_entry(table, key) : NULL;
+
+	if ((entry == NULL || is_null_entry(entry)) && make_room(table))
+	{
+		entry = find_entry(table, key);
+	}
 
-	bool is_new_key = entry->key == NULL;
+	bool is_new_key = is_null_entry(entry);
 
 	if (is_new_key && is_nil(entry->value))
 	{
 		table->count += 1;
 	}
+	else if (is_new_key)
+	{
+		table->tombstones -= 1;
+		count_tombstones(table, -1);
+	}
+
+	gc_write_barrier(key);
+	gc_write_barrier(value);
 
 	entry->key = key;
 	entry->value = value;
@@ -68,7 +355,7 @@ bool hash_table_get(HashTable *table, Key key, Value *value)
 		return false;
 	}
 
-	Entry *entry = find_entry(table->entries, table->capacity, key);
+	Entry *entry = find_entry(table, key);
 	if (is_null_entry(entry))
 	{
 		return false;
@@ -79,6 +366,18 @@ bool hash_table_get(HashTable *table, Key key, Value *value)
 	return true;
 }
 
+Entry *hash_table_get_entry(HashTable *table, Key key)
+{
+	if (table->count == 0)
+	{
+		return NULL;
+	}
+
+	Entry *entry = find_entry(table, key);
+
+	return is_null_entry(entry) ? NULL : entry;
+}
+
 bool hash_table_delete(HashTable *table, Key key)
 {
 	if (table->count == 0)
@@ -86,19 +385,38 @@ bool hash_table_delete(HashTable *table, Key key)
 		return false;
 	}
 
-	Entry *entry = find_entry(table->entries, table->capacity, key);
+	Entry *entry = find_entry(table, key);
 	if (is_null_entry(entry))
 	{
 		return false;
 	}
 
 	// Tombstone
-	entry->key = (Key){ 0 };
+	entry->key = value_nil();
 	entry->value = value_bool(true);
 
+	table->tombstones += 1;
+	count_tombstones(table, 1);
+
 	return true;
 }
 
+Entry *hash_table_next(HashTable *table, i32 *cursor)
+{
+	for (; *cursor < table->capacity; *cursor += 1)
+	{
+		Entry *entry = &table->entries[*cursor];
+
+		if (!is_null_entry(entry))
+		{
+			*cursor += 1;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
 String *hash_table_find_key(HashTable *table, const char *str, i32 len)
 {
 	if (table->count == 0)
@@ -106,23 +424,31 @@ String *hash_table_find_key(HashTable *table, const char *str, i32 len)
 		return NULL;
 	}
 
-	u32 index = hash_string(str, len) % table->capacity;
+	u32 hash = hash_string(str, len);
+	u32 index = hash % table->capacity;
 
-	for (;;)
+	for (u64 probes = 1;; probes++)
 	{
 		Entry *entry = &table->entries[index];
 
-		if (entry->key == NULL)
+		if (is_null_entry(entry))
 		{
 			if (is_nil(entry->value))
 			{
+				count_lookup(table, probes);
 				return NULL;
 			}
 		}
-		else if (entry->key->len == len &&
-				 memcmp(entry->key->str, str, len) == 0)
+		else if (is_string(entry->key))
 		{
-			return entry->key;
+			String *key = as_string(entry->key);
+
+			if (key->hash == hash && key->len == len &&
+				memcmp(key->str, str, len) == 0)
+			{
+				count_lookup(table, probes);
+				return key;
+			}
 		}
 
 		index = (index + 1) % table->capacity;
@@ -131,23 +457,34 @@ String *hash_table_find_key(HashTable *table, const char *str, i32 len)
 
 static void adjust_capacity(HashTable *table, int new_capacity)
 {
-	Entry *entries = mem_allocate(Entry, new_capacity);
+	count_resize(table, new_capacity);
+
+	Entry *entries =
+		mem_malloc_as(MEM_HASH_TABLES, sizeof(Entry) * new_capacity);
 
 	mem_zero(entries, Entry, new_capacity);
 
 	table->count = 0;
+	table->tombstones = 0;
 
 	for (int i = 0; i < table->capacity; i++)
 	{
-		if (is_null_entry(table->entries + i))
+		Entry *entry = &table->entries[i];
+
+		if (is_null_entry(entry))
 		{
 			continue;
 		}
 
-		Entry *entry = find_entry(entries, new_capacity, table->entries[i].key);
-		entry->key = table->entries[i].key;
-		entry->value = table->entries[i].value;
+		// Keys are distinct, and the new entries have no tombstone yet
+		u32 index = hash_value(entry->key) % new_capacity;
+
+		while (!is_nil(entries[index].key))
+		{
+			index = (index + 1) % new_capacity;
+		}
 
+		entries[index] = *entry;
 		table->count += 1;
 	}
 
@@ -157,13 +494,15 @@ static void adjust_capacity(HashTable *table, int new_capacity)
 	table->capacity = new_capacity;
 }
 
-static Entry *find_entry(Entry *entries, int capacity, Key key)
+static Entry *find_entry(HashTable *table, Key key)
 {
-	u32 index = hash_string(key->str, key->len) % capacity;
+	Entry *entries = table->entries;
+	int capacity = table->capacity;
+	u32 index = hash_value(key) % capacity;
 
 	Entry *tombstone = NULL;
 
-	for (;;)
+	for (u64 probes = 1;; probes++)
 	{
 		Entry *entry = &entries[index];
 
@@ -174,6 +513,7 @@ static Entry *find_entry(Entry *entries, int capacity, Key key)
 			// have been encountered
 			if (is_nil(entry->value))
 			{
+				count_lookup(table, probes);
 				return tombstone != NULL ? tombstone : entry;
 			}
 			else
@@ -186,6 +526,7 @@ static Entry *find_entry(Entry *entries, int capacity, Key key)
 		}
 		else if (keys_equal(entry->key, key))
 		{
+			count_lookup(table, probes);
 			return entry;
 		}
 
@@ -195,10 +536,10 @@ static Entry *find_entry(Entry *entries, int capacity, Key key)
 
 static bool is_null_entry(Entry *entry)
 {
-	return entry->key == NULL;
+	return is_nil(entry->key);
 }
 
 static bool keys_equal(Key a, Key b)
 {
-	return a == b;
+	return values_equal(a, b);
 }
@@ -2,9 +2,12 @@
 
 #include "core/common.h"
 #include "core/value.h"
-#include "core/cell.h"
 
-typedef String *Key;
+struct String;
+
+// Keys are plain values, strings being compared with `string_equal`
+// Empty entries have a nil key, and tombstones a nil key with a `true` value.
+typedef Value Key;
 
 typedef struct Entry
 {
@@ -12,18 +15,71 @@ typedef struct Entry
 	Value value;
 } Entry;
 
+// What tables are for, only told apart by the statistics
+typedef enum TableKind
+{
+	TABLE_OTHER,
+	TABLE_GLOBALS,
+	TABLE_STRINGS, // Interned strings
+	TABLE_MAPS,
+	TABLE_FRAMES, // Variables of the tree walker
+	TABLE_KIND_COUNT,
+} TableKind;
+
 typedef struct HashTable
 {
-	int count;
+	int count; // Tombstones included
 	int capacity;
+	int tombstones;
+	TableKind kind;
 	struct Entry *entries;
 } HashTable;
 
 void hash_table_init(HashTable *table);
+void hash_table_init_as(HashTable *table, TableKind kind);
 void hash_table_free(HashTable *table);
 
 bool hash_table_set(HashTable *table, Key key, Value value);
 bool hash_table_get(HashTable *table, Key key, Value *value);
+// Returns NULL if the key is missing. Entries move when keys are added, not
+// when the value of a key is replaced.
+Entry *hash_table_get_entry(HashTable *table, Key key);
 bool hash_table_delete(HashTable *table, Key key);
 
-String *hash_table_find_key(HashTable *table, const char *str, i32 len);
+// Returns the next live entry starting at `*cursor`, or NULL once all entries
+// have been visited. The cursor is updated so that calls can be chained.
+Entry *hash_table_next(HashTable *table, i32 *cursor);
+
+struct String *hash_table_find_key(HashTable *table, const char *str,
+								   i32 len);
+
+bool hash_table_is_valid_key(Key key);
+
+// Tables grow once their entries, tombstones included, go over `load` times
+// their capacity, 0.75 by default and kept between 0.1 and 0.95. Meant to be
+// tuned before any table is used.
+void hash_table_set_max_load(f64 load);
+
+// Lookups are counted by the number of entries they looked at: 1, 2, 3, 4,
+// then up to 8, 16, 32 and more
+#define TABLE_PROBE_BUCKETS 8
+
+// Statistics of every table of a kind, all zeroes unless built with
+// CHARM_TABLE_STATS
+typedef struct TableStats
+{
+	u64 lookups;
+	u64 probes[TABLE_PROBE_BUCKETS];
+	u64 resizes;
+	u64 rehashes; // In place, to clear tombstones
+	i64 capacity; // Of the live tables
+	i64 tombstones;
+} TableStats;
+
+TableStats hash_table_stats(TableKind kind);
+
+// Prints the statistics of every kind of table. Returns false, printing
+// nothing, when not built with CHARM_TABLE_STATS.
+bool hash_table_stats_dump(FILE *out);
+
+u32 hash_string(const char *str, i32 len);
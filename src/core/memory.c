@@ -1,10 +1,145 @@
 #include "memory.h"
 
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+static _Thread_local MemCategory current_category = MEM_OTHER;
+
+MemCategory mem_enter(MemCategory category)
+{
+	MemCategory previous = current_category;
+	current_category = category;
+	return previous;
+}
 
 void *mem_reallocate(void *buffer, usize new_capacity)
 {
+	return mem_reallocate_as(current_category, buffer, new_capacity);
+}
+
+#ifdef CHARM_MEMORY_STATS
+
+// Prepended to every allocation, keeping the alignment of malloc
+typedef struct Header
+{
+	usize size;
+	usize category;
+} Header;
+
+typedef struct Counters
+{
+	atomic_size_t bytes;
+	atomic_size_t count;
+	atomic_size_t peak;
+	atomic_uint_fast64_t allocations;
+} Counters;
+
+// The last one counts every allocation
+static Counters counters[MEM_CATEGORY_COUNT + 1];
+
+static void raise_peak(Counters *counters, usize bytes)
+{
+	usize peak = atomic_load_explicit(&counters->peak, memory_order_relaxed);
+
+	while (peak < bytes &&
+		   !atomic_compare_exchange_weak_explicit(&counters->peak, &peak,
+												  bytes, memory_order_relaxed,
+												  memory_order_relaxed))
+	{
+	}
+}
+
+static void count(usize category, isize bytes, isize live)
+{
+	Counters *both[2] = { &counters[category], &counters[MEM_CATEGORY_COUNT] };
+
+	for (i32 i = 0; i < 2; i++)
+	{
+		usize total = atomic_fetch_add_explicit(&both[i]->bytes, (usize)bytes,
+												memory_order_relaxed) +
+					  (usize)bytes;
+		atomic_fetch_add_explicit(&both[i]->count, (usize)live,
+								  memory_order_relaxed);
+
+		if (live > 0)
+		{
+			atomic_fetch_add_explicit(&both[i]->allocations, 1,
+									  memory_order_relaxed);
+		}
+
+		if (bytes > 0)
+		{
+			raise_peak(both[i], total);
+		}
+	}
+}
+
+void *mem_reallocate_as(MemCategory category, void *buffer,
+						usize new_capacity)
+{
+	Header *header = buffer != NULL ? (Header *)buffer - 1 : NULL;
+
+	if (new_capacity == 0)
+	{
+		if (header != NULL)
+		{
+			count(header->category, -(isize)header->size, -1);
+		}
+
+		free(header);
+		return NULL;
+	}
+
+	usize old_size = 0;
+
+	if (header != NULL)
+	{
+		old_size = header->size;
+		category = (MemCategory)header->category;
+	}
+
+	Header *result = realloc(header, sizeof(Header) + new_capacity);
+
+	if (result == NULL)
+	{
+		exit(42);
+	}
+
+	result->size = new_capacity;
+	result->category = category;
+	count(category, (isize)new_capacity - (isize)old_size,
+		  header == NULL ? 1 : 0);
+
+	return result + 1;
+}
+
+void mem_account(MemCategory category, isize bytes)
+{
+	count(category, bytes, bytes > 0 ? 1 : -1);
+}
+
+MemStats mem_stats(MemCategory category)
+{
+	Counters *counter = &counters[category];
+
+	return (MemStats){
+		.bytes = atomic_load(&counter->bytes),
+		.count = atomic_load(&counter->count),
+		.peak = atomic_load(&counter->peak),
+		.allocations = atomic_load(&counter->allocations),
+	};
+}
+
+#else
+
+void *mem_reallocate_as(MemCategory category, void *buffer,
+						usize new_capacity)
+{
+	UNUSED(category);
+
 	if (new_capacity == 0)
 	{
 		free(buffer);
@@ -20,3 +155,138 @@ void *mem_reallocate(void *buffer, usize new_capacity)
 
 	return result;
 }
+
+void mem_account(MemCategory category, isize bytes)
+{
+	UNUSED(category);
+	UNUSED(bytes);
+}
+
+MemStats mem_stats(MemCategory category)
+{
+	UNUSED(category);
+	return (MemStats){ 0 };
+}
+
+#endif
+
+static const char *category_names[MEM_CATEGORY_COUNT + 1] = {
+	[MEM_OTHER] = "other",
+	[MEM_AST] = "ast",
+	[MEM_CHUNKS] = "chunks",
+	[MEM_CONSTANTS] = "constants",
+	[MEM_STRINGS] = "strings",
+	[MEM_CELLS] = "cells",
+	[MEM_HASH_TABLES] = "hash tables",
+	[MEM_FRAMES] = "frames",
+	[MEM_CATEGORY_COUNT] = "total",
+};
+
+#define NAME_WIDTH 12
+#define COLUMN_WIDTH 14
+
+// snprintf is not safe in signal handlers. Negative widths align to the left.
+static void append(char *line, i32 *len, const char *str, i32 width)
+{
+	i32 str_len = (i32)strlen(str);
+	i32 padding = MAX(abs(width) - str_len, 0);
+
+	if (width > 0)
+	{
+		memset(line + *len, ' ', padding);
+		*len += padding;
+	}
+
+	memcpy(line + *len, str, str_len);
+	*len += str_len;
+
+	if (width < 0)
+	{
+		memset(line + *len, ' ', padding);
+		*len += padding;
+	}
+}
+
+static void append_number(char *line, i32 *len, u64 number, i32 width)
+{
+	char digits[24];
+	i32 i = (i32)sizeof(digits) - 1;
+	digits[i] = '\0';
+
+	do
+	{
+		digits[--i] = (char)('0' + number % 10);
+		number /= 10;
+	} while (number != 0);
+
+	append(line, len, digits + i, width);
+}
+
+void mem_stats_dump(int fd)
+{
+	char line[128];
+	i32 len = 0;
+
+	append(line, &len, "category", -NAME_WIDTH);
+	append(line, &len, "live bytes", COLUMN_WIDTH);
+	append(line, &len, "live count", COLUMN_WIDTH);
+	append(line, &len, "peak bytes", COLUMN_WIDTH);
+	append(line, &len, "allocations", COLUMN_WIDTH);
+	line[len++] = '\n';
+
+	if (write(fd, line, len) < 0)
+	{
+		return;
+	}
+
+	for (i32 i = 0; i <= MEM_CATEGORY_COUNT; i++)
+	{
+		MemStats stats = mem_stats((MemCategory)i);
+		len = 0;
+
+		append(line, &len, category_names[i], -NAME_WIDTH);
+		append_number(line, &len, stats.bytes, COLUMN_WIDTH);
+		append_number(line, &len, stats.count, COLUMN_WIDTH);
+		append_number(line, &len, stats.peak, COLUMN_WIDTH);
+		append_number(line, &len, stats.allocations, COLUMN_WIDTH);
+		line[len++] = '\n';
+
+		if (write(fd, line, len) < 0)
+		{
+			return;
+		}
+	}
+}
+
+#ifdef CHARM_MEMORY_STATS
+
+static void dump_at_exit()
+{
+	mem_stats_dump(STDERR_FILENO);
+}
+
+static void dump_on_signal(int signal)
+{
+	UNUSED(signal);
+	mem_stats_dump(STDERR_FILENO);
+}
+
+void mem_stats_install()
+{
+	atexit(dump_at_exit);
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = dump_on_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGUSR1, &action, NULL);
+}
+
+#else
+
+void mem_stats_install()
+{
+}
+
+#endif
@@ -18,4 +18,53 @@
 #define mem_zero(array, T, count) memset(array, 0, sizeof(T) * (count))
 #define mem_copy(dest, orig, size) memcpy(dest, orig, size)
 
+// What allocations are for, only kept track of when built with
+// CHARM_MEMORY_STATS. A buffer keeps the category of its first allocation
+// when reallocated.
+typedef enum MemCategory
+{
+	MEM_OTHER,
+	MEM_AST,
+	MEM_CHUNKS,
+	MEM_CONSTANTS,
+	MEM_STRINGS,
+	MEM_CELLS, // Slab pages and large cells other than strings
+	MEM_HASH_TABLES,
+	MEM_FRAMES,
+	MEM_CATEGORY_COUNT,
+} MemCategory;
+
+// Allocations made by the calling thread without a category of their own,
+// like dynamic arrays, fall into `category` until the previous one, which is
+// returned, is entered again
+MemCategory mem_enter(MemCategory category);
+
 void *mem_reallocate(void *buffer, usize new_capacity);
+void *mem_reallocate_as(MemCategory category, void *buffer,
+						usize new_capacity);
+
+#define mem_malloc_as(category, size) mem_reallocate_as(category, NULL, size)
+
+// Counts a buffer allocated, or freed when `bytes` is negative, without going
+// through mem_reallocate
+void mem_account(MemCategory category, isize bytes);
+
+typedef struct MemStats
+{
+	usize bytes; // Live
+	usize count; // Live
+	usize peak; // Of `bytes`
+	u64 allocations; // Since the start
+} MemStats;
+
+// Snapshot of `category`, or of every allocation for MEM_CATEGORY_COUNT. All
+// zeroes unless built with CHARM_MEMORY_STATS.
+MemStats mem_stats(MemCategory category);
+
+// Writes a snapshot of every category to `fd`. Only calls functions that are
+// safe in signal handlers.
+void mem_stats_dump(int fd);
+
+// Dumps a snapshot to stderr at exit and on SIGUSR1, when built with
+// CHARM_MEMORY_STATS
+void mem_stats_install();
@@ -0,0 +1,162 @@
+#include "metrics.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include "memory.h"
+
+_Thread_local MetricsBlock *metrics_block = NULL;
+
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+static MetricsBlock *blocks = NULL;
+// Counts of the threads that exited
+static MetricsSnapshot retired;
+
+// Only used to retire the block of a thread when it exits
+static pthread_once_t block_once = PTHREAD_ONCE_INIT;
+static pthread_key_t block_key;
+
+static void add_block(MetricsSnapshot *snapshot, MetricsBlock *block)
+{
+	for (i32 i = 0; i < METRIC_COUNT; i++)
+	{
+		snapshot->counts[i] +=
+			atomic_load_explicit(&block->counts[i], memory_order_relaxed);
+	}
+
+	for (i32 i = 0; i < PHASE_COUNT; i++)
+	{
+		snapshot->phase_ns[i] +=
+			atomic_load_explicit(&block->phase_ns[i], memory_order_relaxed);
+		snapshot->phase_runs[i] +=
+			atomic_load_explicit(&block->phase_runs[i], memory_order_relaxed);
+	}
+}
+
+static void retire_block(void *arg)
+{
+	MetricsBlock *block = arg;
+
+	pthread_mutex_lock(&blocks_lock);
+
+	add_block(&retired, block);
+
+	MetricsBlock **link = &blocks;
+
+	while (*link != block)
+	{
+		link = &(*link)->next;
+	}
+
+	*link = block->next;
+
+	pthread_mutex_unlock(&blocks_lock);
+
+	metrics_block = NULL;
+	mem_free(block);
+}
+
+static void create_block_key()
+{
+	pthread_key_create(&block_key, retire_block);
+}
+
+MetricsBlock *metrics_register_thread()
+{
+	MetricsBlock *block = mem_malloc(sizeof(MetricsBlock));
+	memset(block, 0, sizeof(MetricsBlock));
+
+	pthread_mutex_lock(&blocks_lock);
+	block->next = blocks;
+	blocks = block;
+	pthread_mutex_unlock(&blocks_lock);
+
+	pthread_once(&block_once, create_block_key);
+	pthread_setspecific(block_key, block);
+
+	metrics_block = block;
+
+	return block;
+}
+
+u64 metrics_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000000000ull + (u64)now.tv_nsec;
+}
+
+void metrics_end(Phase phase, u64 start)
+{
+	MetricsBlock *block = metrics_local();
+	metrics_bump(&block->phase_ns[phase], metrics_now() - start);
+	metrics_bump(&block->phase_runs[phase], 1);
+}
+
+MetricsSnapshot metrics_snapshot()
+{
+	pthread_mutex_lock(&blocks_lock);
+
+	MetricsSnapshot snapshot = retired;
+
+	for (MetricsBlock *block = blocks; block != NULL; block = block->next)
+	{
+		add_block(&snapshot, block);
+	}
+
+	pthread_mutex_unlock(&blocks_lock);
+
+	return snapshot;
+}
+
+static const char *metric_names[METRIC_COUNT] = {
+	[METRIC_TOKENS] = "tokens",
+	[METRIC_AST_NODES] = "ast_nodes",
+	[METRIC_BYTECODE_BYTES] = "bytecode_bytes",
+	[METRIC_CONSTANTS] = "constants",
+	[METRIC_INSTRUCTIONS] = "instructions",
+	[METRIC_HASH_LOOKUPS] = "hash_lookups",
+	[METRIC_HASH_PROBES] = "hash_probes",
+	[METRIC_GC_CYCLES] = "gc_cycles",
+};
+
+static const char *phase_names[PHASE_COUNT] = {
+	[PHASE_PARSE] = "parse",
+	[PHASE_PRINT_AST] = "print_ast",
+	[PHASE_TREEWALK] = "treewalk",
+	[PHASE_COMPILE] = "compile",
+	[PHASE_RUN] = "run",
+	[PHASE_GC] = "gc",
+};
+
+const char *metrics_name(Metric metric)
+{
+	return metric_names[metric];
+}
+
+const char *metrics_phase_name(Phase phase)
+{
+	return phase_names[phase];
+}
+
+void metrics_dump(FILE *out)
+{
+	MetricsSnapshot snapshot = metrics_snapshot();
+
+	fprintf(out, "%-16s %14s %12s\n", "phase", "ms", "runs");
+
+	for (i32 i = 0; i < PHASE_COUNT; i++)
+	{
+		fprintf(out, "%-16s %14.3f %12llu\n", phase_names[i],
+				snapshot.phase_ns[i] / 1e6,
+				(unsigned long long)snapshot.phase_runs[i]);
+	}
+
+	fprintf(out, "\n%-16s %14s\n", "counter", "count");
+
+	for (i32 i = 0; i < METRIC_COUNT; i++)
+	{
+		fprintf(out, "%-16s %14llu\n", metric_names[i],
+				(unsigned long long)snapshot.counts[i]);
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "common.h"
+
+// Counters and phase timers of the whole process, kept at all times so that
+// scripts can be monitored in production.
+//
+// Each thread counts into a block of its own, with plain loads and stores, so
+// counting costs about as much as incrementing a global. Snapshots add up the
+// blocks of every thread, and those of threads that exited.
+
+typedef enum Metric
+{
+	METRIC_TOKENS,
+	METRIC_AST_NODES,
+	METRIC_BYTECODE_BYTES,
+	METRIC_CONSTANTS,
+	METRIC_INSTRUCTIONS, // Flushed when runs end, see vm_flush_metrics
+	METRIC_HASH_LOOKUPS,
+	METRIC_HASH_PROBES, // Entries looked at by the lookups
+	METRIC_GC_CYCLES,
+	METRIC_COUNT,
+} Metric;
+
+// Nested phases count towards both, and phases run by several threads at
+// once count their time on each
+typedef enum Phase
+{
+	PHASE_PARSE, // Lexing included
+	PHASE_PRINT_AST,
+	PHASE_TREEWALK,
+	PHASE_COMPILE,
+	PHASE_RUN,
+	PHASE_GC,
+	PHASE_COUNT,
+} Phase;
+
+typedef struct MetricsBlock
+{
+	atomic_uint_fast64_t counts[METRIC_COUNT];
+	atomic_uint_fast64_t phase_ns[PHASE_COUNT];
+	atomic_uint_fast64_t phase_runs[PHASE_COUNT];
+
+	struct MetricsBlock *next;
+} MetricsBlock;
+
+typedef struct MetricsSnapshot
+{
+	u64 counts[METRIC_COUNT];
+	u64 phase_ns[PHASE_COUNT];
+	u64 phase_runs[PHASE_COUNT];
+} MetricsSnapshot;
+
+extern _Thread_local MetricsBlock *metrics_block;
+
+// Registers the block of the calling thread
+MetricsBlock *metrics_register_thread();
+
+static inline void metrics_bump(atomic_uint_fast64_t *counter, u64 amount)
+{
+	// Only the owning thread writes, snapshots merely read
+	u64 count = atomic_load_explicit(counter, memory_order_relaxed);
+	atomic_store_explicit(counter, count + amount, memory_order_relaxed);
+}
+
+static inline MetricsBlock *metrics_local()
+{
+	return metrics_block != NULL ? metrics_block : metrics_register_thread();
+}
+
+static inline void metrics_add(Metric metric, u64 amount)
+{
+	metrics_bump(&metrics_local()->counts[metric], amount);
+}
+
+// Monotonic time in nanoseconds, to give to metrics_end
+u64 metrics_now();
+void metrics_end(Phase phase, u64 start);
+
+MetricsSnapshot metrics_snapshot();
+
+const char *metrics_name(Metric metric);
+const char *metrics_phase_name(Phase phase);
+
+void metrics_dump(FILE *out);
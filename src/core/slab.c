@@ -0,0 +1,258 @@
+#include "slab.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "memory.h"
+
+// Empty pages kept by each thread
+#define SLAB_CACHED_PAGES 16
+
+typedef struct SlabPage
+{
+	struct SlabPage *next;
+	u32 class;
+	u32 live; // Blocks in use
+} SlabPage;
+
+#define PAGE_HEADER_SIZE ((sizeof(SlabPage) + 15) & ~(usize)15)
+
+#define page_of(block) \
+	((SlabPage *)((usize)(block) & ~(usize)(SLAB_PAGE_SIZE - 1)))
+
+static const u32 class_sizes[SLAB_CLASS_COUNT] = {
+	16, 32, 48, 64, 80, 96, 112, 128, 192, 256,
+};
+
+typedef struct PageCache
+{
+	SlabPage *pages;
+	i32 count;
+} PageCache;
+
+static _Thread_local PageCache cache = { .pages = NULL, .count = 0 };
+
+// Only used to empty the cache of a thread when it exits
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+
+static void free_cache(void *arg)
+{
+	PageCache *cache = arg;
+
+	while (cache->pages != NULL)
+	{
+		SlabPage *page = cache->pages;
+		cache->pages = page->next;
+		free(page);
+		mem_account(MEM_CELLS, -SLAB_PAGE_SIZE);
+	}
+
+	cache->count = 0;
+}
+
+static void create_cache_key()
+{
+	pthread_key_create(&cache_key, free_cache);
+}
+
+static SlabPage *take_page()
+{
+	if (cache.pages != NULL)
+	{
+		SlabPage *page = cache.pages;
+		cache.pages = page->next;
+		cache.count -= 1;
+		return page;
+	}
+
+	SlabPage *page = aligned_alloc(SLAB_PAGE_SIZE, SLAB_PAGE_SIZE);
+
+	if (page == NULL)
+	{
+		exit(42);
+	}
+
+	mem_account(MEM_CELLS, SLAB_PAGE_SIZE);
+
+	return page;
+}
+
+static void give_page(SlabPage *page)
+{
+	if (cache.count == SLAB_CACHED_PAGES)
+	{
+		free(page);
+		mem_account(MEM_CELLS, -SLAB_PAGE_SIZE);
+		return;
+	}
+
+	if (cache.count == 0)
+	{
+		pthread_once(&cache_once, create_cache_key);
+		pthread_setspecific(cache_key, &cache);
+	}
+
+	page->next = cache.pages;
+	cache.pages = page;
+	cache.count += 1;
+}
+
+static i32 class_of(usize size)
+{
+	if (size <= 128)
+	{
+		return (i32)(MAX(size, 1) + 15) / 16 - 1;
+	}
+
+	return size <= 192 ? 8 : 9;
+}
+
+void slab_init(SlabAllocator *slab)
+{
+	for (i32 i = 0; i < SLAB_CLASS_COUNT; i++)
+	{
+		slab->free[i] = NULL;
+		slab->pages[i] = NULL;
+		slab->bump[i] = NULL;
+		slab->end[i] = NULL;
+	}
+
+	slab->stats = (SlabStats){ 0 };
+}
+
+void slab_release(SlabAllocator *slab)
+{
+	for (i32 i = 0; i < SLAB_CLASS_COUNT; i++)
+	{
+		while (slab->pages[i] != NULL)
+		{
+			SlabPage *page = slab->pages[i];
+			slab->pages[i] = page->next;
+			give_page(page);
+		}
+	}
+
+	SlabStats stats = slab->stats;
+	slab_init(slab);
+
+	slab->stats.allocations = stats.allocations;
+	slab->stats.frees = stats.frees;
+	slab->stats.large = stats.large;
+}
+
+static void add_page(SlabAllocator *slab, i32 class)
+{
+	SlabPage *page = take_page();
+	page->class = (u32)class;
+	page->live = 0;
+	page->next = slab->pages[class];
+	slab->pages[class] = page;
+
+	u32 size = class_sizes[class];
+	usize count = (SLAB_PAGE_SIZE - PAGE_HEADER_SIZE) / size;
+
+	slab->bump[class] = (byte *)page + PAGE_HEADER_SIZE;
+	slab->end[class] = slab->bump[class] + count * size;
+	slab->stats.pages += 1;
+}
+
+void *slab_allocate(SlabAllocator *slab, usize size)
+{
+	if (size > SLAB_MAX_BLOCK)
+	{
+		return NULL;
+	}
+
+	i32 class = class_of(size);
+	void *block = slab->free[class];
+
+	if (block != NULL)
+	{
+		slab->free[class] = *(void **)block;
+	}
+	else
+	{
+		if (slab->bump[class] == slab->end[class])
+		{
+			add_page(slab, class);
+		}
+
+		block = slab->bump[class];
+		slab->bump[class] += class_sizes[class];
+	}
+
+	page_of(block)->live += 1;
+
+	slab->stats.allocations += 1;
+	slab->stats.in_use += class_sizes[class];
+
+	return block;
+}
+
+void slab_free(SlabAllocator *slab, void *block)
+{
+	SlabPage *page = page_of(block);
+	page->live -= 1;
+
+	*(void **)block = slab->free[page->class];
+	slab->free[page->class] = block;
+
+	slab->stats.frees += 1;
+	slab->stats.in_use -= class_sizes[page->class];
+}
+
+// The newest page of each class is kept, as blocks are still carved from it
+static bool can_trim(SlabAllocator *slab, SlabPage *page, i32 class)
+{
+	return page->live == 0 && page != slab->pages[class];
+}
+
+void slab_trim(SlabAllocator *slab)
+{
+	for (i32 class = 0; class < SLAB_CLASS_COUNT; class++)
+	{
+		bool any = false;
+
+		for (SlabPage *page = slab->pages[class]; page != NULL && !any;
+			 page = page->next)
+		{
+			any = can_trim(slab, page, class);
+		}
+
+		if (!any)
+		{
+			continue;
+		}
+
+		void **link = &slab->free[class];
+
+		while (*link != NULL)
+		{
+			if (can_trim(slab, page_of(*link), class))
+			{
+				*link = *(void **)*link;
+				continue;
+			}
+
+			link = (void **)*link;
+		}
+
+		SlabPage **page = &slab->pages[class];
+
+		while (*page != NULL)
+		{
+			SlabPage *current = *page;
+
+			if (can_trim(slab, current, class))
+			{
+				*page = current->next;
+				give_page(current);
+				slab->stats.pages -= 1;
+				continue;
+			}
+
+			page = &current->next;
+		}
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common.h"
+
+#define SLAB_PAGE_SIZE (64 * 1024)
+#define SLAB_CLASS_COUNT 10
+// Larger blocks are left to mem_malloc
+#define SLAB_MAX_BLOCK 256
+
+typedef struct SlabStats
+{
+	u64 allocations;
+	u64 frees;
+	u64 large; // Left to mem_malloc, counted by the caller
+	usize pages;
+	usize in_use; // Bytes held by live blocks, rounded up to their class
+} SlabStats;
+
+// Segregated free lists of small blocks, carved from pages of a single size
+// class. An allocator is not synchronized, and belongs to the heap of an
+// instance, which only runs on one thread at a time.
+//
+// Pages are taken from and given back to a cache owned by the calling thread,
+// which only falls back to the system allocator once empty or full.
+typedef struct SlabAllocator
+{
+	void *free[SLAB_CLASS_COUNT];
+	struct SlabPage *pages[SLAB_CLASS_COUNT];
+
+	// Blocks of the newest page not handed out yet
+	byte *bump[SLAB_CLASS_COUNT];
+	byte *end[SLAB_CLASS_COUNT];
+
+	SlabStats stats;
+} SlabAllocator;
+
+void slab_init(SlabAllocator *slab);
+// Gives back every page at once, whatever the blocks still in use
+void slab_release(SlabAllocator *slab);
+
+// Returns NULL when `size` is above SLAB_MAX_BLOCK
+void *slab_allocate(SlabAllocator *slab, usize size);
+// `block` must come from `slab`
+void slab_free(SlabAllocator *slab, void *block);
+
+// Gives back the pages without any block in use, to be called once in a while
+// as it goes through every free block
+void slab_trim(SlabAllocator *slab);
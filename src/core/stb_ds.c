@@ -0,0 +1,4 @@
+// The implementation lives in the library so that hosts linking against it
+// don't have to provide it
+#define STB_DS_IMPLEMENTATION
+#include "core/dyn_array.h"
@@ -1,5 +1,7 @@
 #include "value.h"
 
+#include <string.h>
+
 #include "core/common.h"
 #include "core/cell.h"
 
@@ -18,6 +20,18 @@ Value value_bool(bool b)
 	return (Value){ .type = VALUE_BOOL, { .boolean = b } };
 }
 
+Value value_short_string(const char *str, i32 len)
+{
+	assert(len <= SHORT_STRING_MAX);
+
+	Value value = { .type = VALUE_SHORT_STRING };
+	memcpy(value.as.short_string.str, str, len);
+	value.as.short_string.str[len] = '\0';
+	value.as.short_string.len = (u8)len;
+
+	return value;
+}
+
 Value value_cell(Cell *cell)
 {
 	return (Value){ .type = VALUE_CELL, { .cell = cell } };
@@ -29,17 +43,31 @@ Value value_function(struct String **args, struct Stmt *body)
 	return (Value){ .type = VALUE_FUNCTION, { .function = function } };
 }
 
-Value value_native_function(NativeFunction function)
+Value value_native_function(NativeFunction function, i32 arity)
 {
-	return (Value){
-		.type = VALUE_NATIVE_FUNCTION,
-		{ .native_function = function },
-	};
+	Native native = { .function = function, .arity = arity };
+	return (Value){ .type = VALUE_NATIVE_FUNCTION, { .native = native } };
+}
+
+bool values_share_type(Value a, Value b)
+{
+	if (a.type == b.type)
+	{
+		return true;
+	}
+
+	// Whether a string is stored inline or not is an implementation detail
+	return is_any_string(a) && is_any_string(b);
 }
 
 bool values_equal(Value a, Value b)
 {
-	if (!values_share_type(a, b))
+	if (is_any_string(a) && is_any_string(b))
+	{
+		return string_equal(a, b);
+	}
+
+	if (a.type != b.type)
 	{
 		return false;
 	}
@@ -74,3 +102,10 @@ Result result_return(Value value)
 	result.as.return_result = value;
 	return result;
 }
+
+Result result_async(struct AsyncRequest *request)
+{
+	Result result = { .type = RESULT_ASYNC };
+	result.as.async_request = request;
+	return result;
+}
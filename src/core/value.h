@@ -7,6 +7,7 @@ typedef enum ValueType
 	VALUE_NIL = 0,
 	VALUE_NUMBER,
 	VALUE_BOOL,
+	VALUE_SHORT_STRING,
 	VALUE_CELL,
 	VALUE_USER_TYPE,
 	VALUE_FUNCTION,
@@ -14,7 +15,19 @@ typedef enum ValueType
 } ValueType;
 
 struct Value;
-typedef struct Result (*NativeFunction)(struct Value *);
+
+// Natives receive a view on their arguments, which lives on the caller's stack
+// and is only valid for the duration of the call
+typedef struct Result (*NativeFunction)(struct Value *args, i32 arg_count);
+
+// Arity of natives accepting any number of arguments
+#define NATIVE_VARIADIC -1
+
+typedef struct Native
+{
+	NativeFunction function;
+	i32 arity;
+} Native;
 
 // GC-ed objects
 struct Cell;
@@ -25,6 +38,16 @@ typedef struct Function
 	struct Stmt *body;
 } Function;
 
+// Strings up to this length are stored in the value itself instead of being
+// allocated as a cell
+#define SHORT_STRING_MAX 14
+
+typedef struct ShortString
+{
+	char str[SHORT_STRING_MAX + 1];
+	u8 len;
+} ShortString;
+
 typedef struct Value
 {
 	ValueType type;
@@ -33,8 +56,9 @@ typedef struct Value
 	{
 		f64 number;
 		bool boolean;
+		ShortString short_string;
 		struct Cell *cell;
-		NativeFunction native_function;
+		Native native;
 		Function function;
 		// TODO: others
 	} as;
@@ -43,31 +67,37 @@ typedef struct Value
 Value value_nil();
 Value value_number(f64 number);
 Value value_bool(bool boolean);
+Value value_short_string(const char *str, i32 len);
 Value value_cell(struct Cell *cell);
 Value value_function(struct String **args, struct Stmt *body);
-Value value_native_function(NativeFunction function);
+Value value_native_function(NativeFunction function, i32 arity);
 
 #define is_nil(v) ((v).type == VALUE_NIL)
 #define is_bool(v) ((v).type == VALUE_BOOL)
 #define is_number(v) ((v).type == VALUE_NUMBER)
+#define is_short_string(v) ((v).type == VALUE_SHORT_STRING)
 #define is_cell(v) ((v).type == VALUE_CELL)
 #define is_function(v) ((v).type == VALUE_FUNCTION)
 #define is_native_function(v) ((v).type == VALUE_NATIVE_FUNCTION)
 
 #define as_bool(v) ((v).as.boolean)
 #define as_number(v) ((v).as.number)
+#define as_short_string(v) ((v).as.short_string)
 #define as_cell(v) ((v).as.cell)
 #define as_function(v) ((v).as.function)
-#define as_native_function(v) ((v).as.native_function)
+#define as_native_function(v) ((v).as.native)
 
-#define values_share_type(a, b) ((a).type == (b).type)
+bool values_share_type(Value a, Value b);
 bool values_equal(Value a, Value b);
 
+struct AsyncRequest;
+
 // TODO: Statement result
 typedef enum ResultType
 {
 	RESULT_NONE,
 	RESULT_RETURN,
+	RESULT_ASYNC, // See interpreter/event_loop.h
 	// TODO: Continue,
 	// TODO: Break,
 	// TODO: Error ?
@@ -78,6 +108,7 @@ typedef struct Result
 	union
 	{
 		Value return_result;
+		struct AsyncRequest *async_request;
 	} as;
 
 	ResultType type;
@@ -85,3 +116,4 @@ typedef struct Result
 
 Result result_none();
 Result result_return(Value value);
+Result result_async(struct AsyncRequest *request);
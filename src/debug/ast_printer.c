@@ -128,10 +128,11 @@ static void print_expr(Expr *expr, i32 level)
 		}
 		break;
 
-		case EXPR_CELL_LITERAL:
+		case EXPR_STRING_LITERAL:
 		{
-			PRINT_EXPR_LITERAL(Cell, "%p", expr->as.cell);
-			// TODO: Print more info about the cell at some point
+			printf(RED "String" RESET " <" CYN);
+			print_value(&expr->as.string);
+			printf(RESET ">");
 		}
 		break;
 
@@ -140,6 +141,90 @@ static void print_expr(Expr *expr, i32 level)
 			PRINT_EXPR_LITERAL(Identifier, "%s", expr->as.identifier->str);
 		}
 		break;
+
+		case EXPR_MAP_LITERAL:
+		{
+			PRINT_EXPR_TYPE(Map);
+			PRINT_HEADER(Entries);
+			printf("%d", (i32)arrlen(expr->as.map.keys));
+			level += 1;
+			for (i32 i = 0; i < arrlen(expr->as.map.keys); i++)
+			{
+				printf("\n");
+				PRINT_EXPR_CHILD(Key, expr->as.map.keys[i]);
+				printf("\n");
+				PRINT_EXPR_CHILD(Value, expr->as.map.values[i]);
+			}
+			level -= 1;
+		}
+		break;
+
+		case EXPR_ARRAY_LITERAL:
+		{
+			PRINT_EXPR_TYPE(Array);
+			PRINT_HEADER(Items);
+			printf("%d", (i32)arrlen(expr->as.array.items));
+			level += 1;
+			for (i32 i = 0; i < arrlen(expr->as.array.items); i++)
+			{
+				printf("\n");
+				PRINT_EXPR_CHILD(Item, expr->as.array.items[i]);
+			}
+			level -= 1;
+		}
+		break;
+
+		case EXPR_INDEX:
+		{
+			PRINT_EXPR_TYPE(Index);
+			PRINT_EXPR_CHILD(Target, expr->as.index.target);
+			printf("\n");
+			PRINT_EXPR_CHILD(Index, expr->as.index.index);
+		}
+		break;
+
+		case EXPR_SET_INDEX:
+		{
+			PRINT_EXPR_TYPE(Set Index);
+			PRINT_EXPR_CHILD(Target, expr->as.set_index.target);
+			printf("\n");
+			PRINT_EXPR_CHILD(Index, expr->as.set_index.index);
+			printf("\n");
+			PRINT_EXPR_CHILD(Value, expr->as.set_index.value);
+		}
+		break;
+
+		case EXPR_YIELD:
+		{
+			PRINT_EXPR_TYPE(Yield);
+			PRINT_HEADER(Value);
+			if (expr->as.yield.value == NULL)
+			{
+				printf("<NONE>");
+			}
+			else
+			{
+				print_expr(expr->as.yield.value, level + 1);
+			}
+		}
+		break;
+
+		case EXPR_RESUME:
+		{
+			PRINT_EXPR_TYPE(Resume);
+			PRINT_EXPR_CHILD(Coroutine, expr->as.resume.coroutine);
+			printf("\n");
+			PRINT_HEADER(Value);
+			if (expr->as.resume.value == NULL)
+			{
+				printf("<NONE>");
+			}
+			else
+			{
+				print_expr(expr->as.resume.value, level + 1);
+			}
+		}
+		break;
 	}
 }
 
@@ -260,6 +345,33 @@ static void print_stmt(Stmt *stmt, i32 level)
 
 			printf("\n");
 		}
+		break;
+
+		case STMT_FOR_IN:
+		{
+			PRINT_STMT_TYPE(For In);
+			PRINT_HEADER(Name);
+			PRINT_IDENTIFIER(BLU, stmt->as.for_in.name);
+			printf("\n");
+			PRINT_STMT_CHILD(Iterable);
+			print_expr(stmt->as.for_in.iterable, level + 1);
+			printf("\n");
+			PRINT_STMT_CHILD(Body);
+			print_stmt(stmt->as.for_in.body, level + 1);
+		}
+		break;
+
+		case STMT_DELETE:
+		{
+			PRINT_STMT_TYPE(Delete);
+			PRINT_STMT_CHILD(Target);
+			print_expr(stmt->as.delete_stmt.target, level + 1);
+			printf("\n");
+			PRINT_STMT_CHILD(Index);
+			print_expr(stmt->as.delete_stmt.index, level + 1);
+			printf("\n");
+		}
+		break;
 	}
 }
 
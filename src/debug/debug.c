@@ -1,11 +1,16 @@
 #include "debug.h"
 
+#include <math.h>
+
 #include "core/common.h"
 #include "core/value.h"
 #include "core/cell.h"
+#include "core/dyn_array.h"
 
 #include "ast/ast.h"
 
+#include "compiler/chunk.h"
+
 const char *debug_get_token_type_str(TokenType type)
 {
 	switch (type)
@@ -34,6 +39,8 @@ const char *debug_get_token_type_str(TokenType type)
 			return "Dot";
 		case TOKEN_SEMICOLON:
 			return "Semicolon";
+		case TOKEN_COLON:
+			return "Colon";
 		case TOKEN_MINUS:
 			return "Minus";
 		case TOKEN_PLUS:
@@ -64,6 +71,8 @@ const char *debug_get_token_type_str(TokenType type)
 			return "Number";
 		case TOKEN_AND:
 			return "And";
+		case TOKEN_DELETE:
+			return "Delete";
 		case TOKEN_ELSE:
 			return "Else";
 		case TOKEN_FALSE:
@@ -74,12 +83,16 @@ const char *debug_get_token_type_str(TokenType type)
 			return "Function";
 		case TOKEN_IF:
 			return "If";
+		case TOKEN_IN:
+			return "In";
 		case TOKEN_NIL:
 			return "Nil";
 		case TOKEN_NOT:
 			return "Not";
 		case TOKEN_OR:
 			return "Or";
+		case TOKEN_RESUME:
+			return "Resume";
 		case TOKEN_RETURN:
 			return "Return";
 		case TOKEN_STRUCT:
@@ -92,6 +105,8 @@ const char *debug_get_token_type_str(TokenType type)
 			return "Var";
 		case TOKEN_WHILE:
 			return "While";
+		case TOKEN_YIELD:
+			return "Yield";
 		case TOKEN_SUPER:
 			return "Super";
 	}
@@ -119,18 +134,67 @@ void print_value(Value *value)
 			break;
 
 		case VALUE_NUMBER:
-			printf("%f", value->as.number);
+			// The sign of NaN depends on how it was computed, which engines
+			// are free to do differently
+			if (isnan(value->as.number))
+			{
+				printf("nan");
+			}
+			else
+			{
+				printf("%f", value->as.number);
+			}
+			break;
+
+		case VALUE_SHORT_STRING:
+			printf("%s", value->as.short_string.str);
 			break;
 
 		case VALUE_CELL:
 			print_cell(value->as.cell);
 			break;
 
+		case VALUE_FUNCTION:
+			printf("<function>");
+			break;
+
+		case VALUE_NATIVE_FUNCTION:
+			printf("<native function>");
+			break;
+
 		default:
 			UNREACHABLE();
 	}
 }
 
+// Containers being printed, outermost first, to print cycles only once
+static _Thread_local Cell **printing = NULL;
+
+static bool enter_container(Cell *cell)
+{
+	for (i32 i = 0; i < arrlen(printing); i++)
+	{
+		if (printing[i] == cell)
+		{
+			return false;
+		}
+	}
+
+	arrpush(printing, cell);
+
+	return true;
+}
+
+static void leave_container()
+{
+	arrsetlen(printing, arrlen(printing) - 1);
+
+	if (arrlen(printing) == 0)
+	{
+		arrfree(printing);
+	}
+}
+
 void print_cell(Cell *cell)
 {
 	switch (cell->type)
@@ -138,6 +202,85 @@ void print_cell(Cell *cell)
 		case CELL_STRING:
 			printf("%s", ((String *)cell)->str);
 			break;
+
+		case CELL_ROPE:
+			print_cell((Cell *)string_flatten(value_cell(cell)));
+			break;
+
+		case CELL_FUNCTION:
+			printf("<function %s>", ((CompiledFunction *)cell)->name->str);
+			break;
+
+		case CELL_COROUTINE:
+			printf("<coroutine>");
+			break;
+
+		case CELL_ACTOR:
+			printf("<actor>");
+			break;
+
+		case CELL_MAP:
+		{
+			HashTable *table = &((Map *)cell)->table;
+
+			if (!enter_container(cell))
+			{
+				printf("{...}");
+				break;
+			}
+
+			printf("{");
+
+			i32 cursor = 0;
+			Entry *entry = hash_table_next(table, &cursor);
+
+			while (entry != NULL)
+			{
+				print_value(&entry->key);
+				printf(": ");
+				print_value(&entry->value);
+
+				entry = hash_table_next(table, &cursor);
+
+				if (entry != NULL)
+				{
+					printf(", ");
+				}
+			}
+
+			printf("}");
+
+			leave_container();
+		}
+		break;
+
+		case CELL_ARRAY:
+		{
+			Value *items = ((Array *)cell)->items;
+
+			if (!enter_container(cell))
+			{
+				printf("[...]");
+				break;
+			}
+
+			printf("[");
+
+			for (i32 i = 0; i < arrlen(items); i++)
+			{
+				if (i != 0)
+				{
+					printf(", ");
+				}
+
+				print_value(&items[i]);
+			}
+
+			printf("]");
+
+			leave_container();
+		}
+		break;
 	}
 }
 
@@ -155,14 +298,111 @@ const char *debug_expr_type_str(ExprType type)
 			return "EXPR_BOOLEAN_LITERAL";
 		case EXPR_NUMBER_LITERAL:
 			return "EXPR_NUMBER_LITERAL";
-		case EXPR_CELL_LITERAL:
-			return "EXPR_CELL_LITERAL";
+		case EXPR_STRING_LITERAL:
+			return "EXPR_STRING_LITERAL";
 		case EXPR_IDENTIFIER:
 			return "EXPR_IDENTIFIER";
 		case EXPR_ASSIGNMENT:
 			return "EXPR_ASSIGNMENT";
 		case EXPR_CALL:
 			return "EXPR_CALL";
+		case EXPR_MAP_LITERAL:
+			return "EXPR_MAP_LITERAL";
+		case EXPR_ARRAY_LITERAL:
+			return "EXPR_ARRAY_LITERAL";
+		case EXPR_INDEX:
+			return "EXPR_INDEX";
+		case EXPR_SET_INDEX:
+			return "EXPR_SET_INDEX";
+		case EXPR_YIELD:
+			return "EXPR_YIELD";
+		case EXPR_RESUME:
+			return "EXPR_RESUME";
+	}
+
+	UNREACHABLE();
+}
+
+const char *debug_opcode_str(OpCode opcode)
+{
+	switch (opcode)
+	{
+		case OP_CONSTANT:
+			return "OP_CONSTANT";
+		case OP_NIL:
+			return "OP_NIL";
+		case OP_TRUE:
+			return "OP_TRUE";
+		case OP_FALSE:
+			return "OP_FALSE";
+		case OP_NEGATE:
+			return "OP_NEGATE";
+		case OP_ADD:
+			return "OP_ADD";
+		case OP_SUBTRACT:
+			return "OP_SUBTRACT";
+		case OP_MULTIPLY:
+			return "OP_MULTIPLY";
+		case OP_DIVIDE:
+			return "OP_DIVIDE";
+		case OP_NOT:
+			return "OP_NOT";
+		case OP_AND:
+			return "OP_AND";
+		case OP_OR:
+			return "OP_OR";
+		case OP_EQUAL:
+			return "OP_EQUAL";
+		case OP_GREATER:
+			return "OP_GREATER";
+		case OP_GREATER_EQUAL:
+			return "OP_GREATER_EQUAL";
+		case OP_LESS:
+			return "OP_LESS";
+		case OP_LESS_EQUAL:
+			return "OP_LESS_EQUAL";
+		case OP_POP:
+			return "OP_POP";
+		case OP_DEFINE_GLOBAL:
+			return "OP_DEFINE_GLOBAL";
+		case OP_GET_GLOBAL:
+			return "OP_GET_GLOBAL";
+		case OP_SET_GLOBAL:
+			return "OP_SET_GLOBAL";
+		case OP_SET_LOCAL:
+			return "OP_SET_LOCAL";
+		case OP_GET_LOCAL:
+			return "OP_GET_LOCAL";
+		case OP_JUMP:
+			return "OP_JUMP";
+		case OP_JUMP_IF_FALSE:
+			return "OP_JUMP_IF_FALSE";
+		case OP_LOOP:
+			return "OP_LOOP";
+		case OP_CALL:
+			return "OP_CALL";
+		case OP_TAIL_CALL:
+			return "OP_TAIL_CALL";
+		case OP_MAP:
+			return "OP_MAP";
+		case OP_ARRAY:
+			return "OP_ARRAY";
+		case OP_GET_INDEX:
+			return "OP_GET_INDEX";
+		case OP_SET_INDEX:
+			return "OP_SET_INDEX";
+		case OP_DELETE_INDEX:
+			return "OP_DELETE_INDEX";
+		case OP_MAP_NEXT:
+			return "OP_MAP_NEXT";
+		case OP_YIELD:
+			return "OP_YIELD";
+		case OP_RESUME:
+			return "OP_RESUME";
+		case OP_RETURN:
+			return "OP_RETURN";
+		case OP_COUNT:
+			break;
 	}
 
 	UNREACHABLE();
@@ -186,6 +426,10 @@ const char *debug_stmt_type_str(StmtType type)
 			return "STMT_WHILE";
 		case STMT_RETURN:
 			return "STMT_RETURN";
+		case STMT_FOR_IN:
+			return "STMT_FOR_IN";
+		case STMT_DELETE:
+			return "STMT_DELETE";
 	}
 
 	UNREACHABLE();
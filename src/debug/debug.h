@@ -11,6 +11,7 @@ struct Chunk;
 enum TokenType;
 enum ExprType;
 enum StmtType;
+enum OpCode;
 
 void print_value(struct Value *value);
 void print_cell(struct Cell *cell);
@@ -20,8 +21,9 @@ int debug_token_to_string(char *buffer, int capacity, struct Token token);
 
 const char *debug_expr_type_str(enum ExprType type);
 const char *debug_stmt_type_str(enum StmtType type);
+const char *debug_opcode_str(enum OpCode opcode);
 
 void debug_print_program(struct Program program);
 
-void debug_disassemble_chunk(struct Chunk *chunk, const char *name);
-i32 debug_disassemble_instruction(struct Chunk *chunk, i32 offset);
+void debug_disassemble_chunk(const struct Chunk *chunk, const char *name);
+i32 debug_disassemble_instruction(const struct Chunk *chunk, i32 offset);
@@ -9,12 +9,17 @@
 #include "compiler/chunk.h"
 
 static i32 simple_instruction(const char *name, i32 offset);
-static i32 constant_instruction(const char *name, Chunk *chunk, i32 offset);
-static i32 byte_instruction(const char *name, Chunk *chunk, i32 offset);
-static i32 jump_instruction(const char *name, i32 sign, Chunk *chunk,
+static i32 constant_instruction(const char *name, const Chunk *chunk,
+								i32 offset);
+static i32 global_instruction(const char *name, const Chunk *chunk,
+							  i32 offset);
+static i32 byte_instruction(const char *name, const Chunk *chunk, i32 offset);
+static i32 jump_instruction(const char *name, i32 sign, const Chunk *chunk,
 							i32 offset);
+static i32 map_next_instruction(const char *name, const Chunk *chunk,
+								i32 offset);
 
-void debug_disassemble_chunk(Chunk *chunk, const char *name)
+void debug_disassemble_chunk(const Chunk *chunk, const char *name)
 {
 	printf("== %s ==\n", name);
 
@@ -24,16 +29,30 @@ void debug_disassemble_chunk(Chunk *chunk, const char *name)
 	}
 }
 
-i32 debug_disassemble_instruction(Chunk *chunk, i32 offset)
+i32 debug_disassemble_instruction(const Chunk *chunk, i32 offset)
 {
 	printf("%04d ", offset);
 
+	i32 line = chunk_get_line(chunk, offset);
+
+	if (offset > 0 && line == chunk_get_line(chunk, offset - 1))
+	{
+		printf("   | ");
+	}
+	else
+	{
+		printf("%4d ", line);
+	}
+
 	u8 instruction = chunk->code[offset];
 	switch (instruction)
 	{
 		case OP_CONSTANT:
 			return constant_instruction("OP_CONSTANT", chunk, offset);
 
+		case OP_NIL:
+			return simple_instruction("OP_NIL", offset);
+
 		case OP_TRUE:
 			return simple_instruction("OP_TRUE", offset);
 
@@ -70,9 +89,15 @@ i32 debug_disassemble_instruction(Chunk *chunk, i32 offset)
 		case OP_GREATER:
 			return simple_instruction("OP_GREATER", offset);
 
+		case OP_GREATER_EQUAL:
+			return simple_instruction("OP_GREATER_EQUAL", offset);
+
 		case OP_LESS:
 			return simple_instruction("OP_LESS", offset);
 
+		case OP_LESS_EQUAL:
+			return simple_instruction("OP_LESS_EQUAL", offset);
+
 		case OP_RETURN:
 			return simple_instruction("OP_RETURN", offset);
 
@@ -83,10 +108,10 @@ i32 debug_disassemble_instruction(Chunk *chunk, i32 offset)
 			return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
 
 		case OP_GET_GLOBAL:
-			return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+			return global_instruction("OP_GET_GLOBAL", chunk, offset);
 
 		case OP_SET_GLOBAL:
-			return constant_instruction("OP_SET_GLOBAL", chunk, offset);
+			return global_instruction("OP_SET_GLOBAL", chunk, offset);
 
 		case OP_GET_LOCAL:
 			return byte_instruction("OP_GET_LOCAL", chunk, offset);
@@ -103,6 +128,35 @@ i32 debug_disassemble_instruction(Chunk *chunk, i32 offset)
 		case OP_LOOP:
 			return jump_instruction("OP_LOOP", -1, chunk, offset);
 
+		case OP_CALL:
+			return byte_instruction("OP_CALL", chunk, offset);
+		case OP_TAIL_CALL:
+			return byte_instruction("OP_TAIL_CALL", chunk, offset);
+
+		case OP_MAP:
+			return byte_instruction("OP_MAP", chunk, offset);
+
+		case OP_ARRAY:
+			return byte_instruction("OP_ARRAY", chunk, offset);
+
+		case OP_GET_INDEX:
+			return simple_instruction("OP_GET_INDEX", offset);
+
+		case OP_SET_INDEX:
+			return simple_instruction("OP_SET_INDEX", offset);
+
+		case OP_DELETE_INDEX:
+			return simple_instruction("OP_DELETE_INDEX", offset);
+
+		case OP_MAP_NEXT:
+			return map_next_instruction("OP_MAP_NEXT", chunk, offset);
+
+		case OP_YIELD:
+			return simple_instruction("OP_YIELD", offset);
+
+		case OP_RESUME:
+			return simple_instruction("OP_RESUME", offset);
+
 		default:
 			printf("Unknown opcode %d\n", instruction);
 			return offset + 1;
@@ -115,7 +169,8 @@ static i32 simple_instruction(const char *name, i32 offset)
 	return offset + 1;
 }
 
-static i32 constant_instruction(const char *name, Chunk *chunk, i32 offset)
+static i32 constant_instruction(const char *name, const Chunk *chunk,
+								i32 offset)
 {
 	u8 constant = chunk->code[offset + 1];
 	printf("%-16s %4d '", name, constant);
@@ -124,14 +179,26 @@ static i32 constant_instruction(const char *name, Chunk *chunk, i32 offset)
 	return offset + 2;
 }
 
-static i32 byte_instruction(const char *name, Chunk *chunk, i32 offset)
+static i32 global_instruction(const char *name, const Chunk *chunk,
+							  i32 offset)
+{
+	u8 constant = chunk->code[offset + 1];
+	u16 cache = (u16)(chunk->code[offset + 2] << 8);
+	cache |= chunk->code[offset + 3];
+	printf("%-16s %4d '", name, constant);
+	print_value(&chunk->constants[constant]);
+	printf("' cache %d\n", cache);
+	return offset + 4;
+}
+
+static i32 byte_instruction(const char *name, const Chunk *chunk, i32 offset)
 {
 	u8 slot = chunk->code[offset + 1];
 	printf("%-16s %4d\n", name, slot);
 	return offset + 2;
 }
 
-static i32 jump_instruction(const char *name, i32 sign, Chunk *chunk,
+static i32 jump_instruction(const char *name, i32 sign, const Chunk *chunk,
 							i32 offset)
 {
 	u16 jump = (u16)(chunk->code[offset + 1] << 8);
@@ -139,3 +206,13 @@ static i32 jump_instruction(const char *name, i32 sign, Chunk *chunk,
 	printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
 	return offset + 3;
 }
+
+static i32 map_next_instruction(const char *name, const Chunk *chunk,
+								i32 offset)
+{
+	u8 slot = chunk->code[offset + 1];
+	u16 jump = (u16)(chunk->code[offset + 2] << 8);
+	jump |= chunk->code[offset + 3];
+	printf("%-16s %4d -> %d\n", name, slot, offset + 4 + jump);
+	return offset + 4;
+}
@@ -0,0 +1,506 @@
+#include "event_loop.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core/cell.h"
+#include "core/dyn_array.h"
+#include "core/memory.h"
+
+#define NS_PER_SECOND 1000000000ull
+
+static u64 monotonic_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * NS_PER_SECOND + (u64)now.tv_nsec;
+}
+
+static struct timespec to_timespec(u64 ns)
+{
+	return (struct timespec){ .tv_sec = (time_t)(ns / NS_PER_SECOND),
+							  .tv_nsec = (long)(ns % NS_PER_SECOND) };
+}
+
+static char *copy_bytes(const char *bytes, i32 len)
+{
+	char *copy = mem_malloc(len + 1);
+	memcpy(copy, bytes, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+static AsyncRequest *request_new(AsyncOp op)
+{
+	AsyncRequest *request = mem_malloc(sizeof(AsyncRequest));
+	request->op = op;
+	request->task = NULL;
+	request->deadline = 0;
+	request->sequence = 0;
+	request->path = NULL;
+	request->data = NULL;
+	request->len = 0;
+	request->ok = false;
+	return request;
+}
+
+AsyncRequest *async_request_sleep(f64 seconds)
+{
+	AsyncRequest *request = request_new(ASYNC_SLEEP);
+	request->deadline = monotonic_now() + (u64)(MAX(seconds, 0) * 1e9);
+	return request;
+}
+
+AsyncRequest *async_request_read_file(const char *path, i32 path_len)
+{
+	AsyncRequest *request = request_new(ASYNC_READ_FILE);
+	request->path = copy_bytes(path, path_len);
+	return request;
+}
+
+AsyncRequest *async_request_write_file(const char *path, i32 path_len,
+									   const char *data, i32 len)
+{
+	AsyncRequest *request = request_new(ASYNC_WRITE_FILE);
+	request->path = copy_bytes(path, path_len);
+	request->data = copy_bytes(data, len);
+	request->len = len;
+	return request;
+}
+
+void async_request_free(AsyncRequest *request)
+{
+	mem_free(request->path);
+	mem_free(request->data);
+	mem_free(request);
+}
+
+static void read_file(AsyncRequest *request)
+{
+	FILE *file = fopen(request->path, "rb");
+
+	if (file == NULL)
+	{
+		return;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+
+	if (size >= 0 && size < INT32_MAX)
+	{
+		request->data = mem_malloc(size + 1);
+		request->len = (i32)size;
+		request->data[size] = '\0';
+		request->ok = fread(request->data, 1, size, file) == (usize)size;
+	}
+
+	fclose(file);
+}
+
+static void write_file(AsyncRequest *request)
+{
+	FILE *file = fopen(request->path, "wb");
+
+	if (file == NULL)
+	{
+		return;
+	}
+
+	usize written = fwrite(request->data, 1, request->len, file);
+	request->ok = fclose(file) == 0 && written == (usize)request->len;
+}
+
+static void run_file_request(AsyncRequest *request)
+{
+	if (request->op == ASYNC_READ_FILE)
+	{
+		read_file(request);
+	}
+	else
+	{
+		write_file(request);
+	}
+}
+
+Value async_request_run(AsyncRequest *request)
+{
+	switch (request->op)
+	{
+		case ASYNC_SLEEP:
+		{
+			struct timespec deadline = to_timespec(request->deadline);
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+								   NULL) == EINTR)
+			{
+			}
+		}
+		break;
+
+		case ASYNC_READ_FILE:
+		case ASYNC_WRITE_FILE:
+			run_file_request(request);
+			break;
+	}
+
+	return async_request_finish(request);
+}
+
+Value async_request_finish(AsyncRequest *request)
+{
+	Value result = value_nil();
+
+	switch (request->op)
+	{
+		case ASYNC_SLEEP:
+			break;
+
+		case ASYNC_READ_FILE:
+			if (request->ok)
+			{
+				result = string_copy(request->data, request->len);
+			}
+			break;
+
+		case ASYNC_WRITE_FILE:
+			result = value_bool(request->ok);
+			break;
+	}
+
+	async_request_free(request);
+	return result;
+}
+
+static bool timer_before(AsyncRequest *a, AsyncRequest *b)
+{
+	return a->deadline < b->deadline ||
+		   (a->deadline == b->deadline && a->sequence < b->sequence);
+}
+
+static void timer_push(EventLoop *loop, AsyncRequest *request)
+{
+	arrpush(loop->timers, request);
+
+	AsyncRequest **heap = loop->timers;
+	i32 i = (i32)arrlen(heap) - 1;
+
+	while (i > 0 && timer_before(heap[i], heap[(i - 1) / 2]))
+	{
+		AsyncRequest *parent = heap[(i - 1) / 2];
+		heap[(i - 1) / 2] = heap[i];
+		heap[i] = parent;
+		i = (i - 1) / 2;
+	}
+}
+
+static AsyncRequest *timer_pop(EventLoop *loop)
+{
+	AsyncRequest **heap = loop->timers;
+	AsyncRequest *top = heap[0];
+	heap[0] = arrpop(loop->timers);
+
+	i32 count = (i32)arrlen(heap);
+	i32 i = 0;
+
+	for (;;)
+	{
+		i32 smallest = i;
+		i32 left = i * 2 + 1;
+		i32 right = left + 1;
+
+		if (left < count && timer_before(heap[left], heap[smallest]))
+		{
+			smallest = left;
+		}
+
+		if (right < count && timer_before(heap[right], heap[smallest]))
+		{
+			smallest = right;
+		}
+
+		if (smallest == i)
+		{
+			break;
+		}
+
+		AsyncRequest *swap = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = swap;
+		i = smallest;
+	}
+
+	return top;
+}
+
+void event_loop_init(EventLoop *loop)
+{
+	loop->epoll_fd = -1;
+	loop->timer_fd = -1;
+	loop->wake_fd = -1;
+
+	loop->timers = NULL;
+	loop->next_sequence = 0;
+
+	loop->ready = NULL;
+	loop->ready_head = 0;
+
+	loop->pending = 0;
+
+	loop->file_thread_started = false;
+	loop->stopping = false;
+	pthread_mutex_init(&loop->lock, NULL);
+	pthread_cond_init(&loop->file_work, NULL);
+	loop->file_jobs = NULL;
+	loop->file_running = NULL;
+	loop->file_done = NULL;
+}
+
+static void free_requests(AsyncRequest **requests, i32 from)
+{
+	for (i32 i = from; i < arrlen(requests); i++)
+	{
+		async_request_free(requests[i]);
+	}
+
+	arrfree(requests);
+}
+
+void event_loop_free(EventLoop *loop)
+{
+	if (loop->file_thread_started)
+	{
+		pthread_mutex_lock(&loop->lock);
+		loop->stopping = true;
+		pthread_cond_signal(&loop->file_work);
+		pthread_mutex_unlock(&loop->lock);
+
+		pthread_join(loop->file_thread, NULL);
+		loop->file_thread_started = false;
+	}
+
+	// Requests abandoned by a failed run
+	free_requests(loop->timers, 0);
+	free_requests(loop->ready, loop->ready_head);
+	free_requests(loop->file_jobs, 0);
+	free_requests(loop->file_done, 0);
+	loop->timers = NULL;
+	loop->ready = NULL;
+	loop->file_jobs = NULL;
+	loop->file_done = NULL;
+	loop->ready_head = 0;
+	loop->pending = 0;
+
+	if (loop->epoll_fd >= 0)
+	{
+		close(loop->epoll_fd);
+		close(loop->timer_fd);
+		close(loop->wake_fd);
+		loop->epoll_fd = -1;
+	}
+
+	pthread_mutex_destroy(&loop->lock);
+	pthread_cond_destroy(&loop->file_work);
+}
+
+static void watch(EventLoop *loop, int fd)
+{
+	struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		printf("Could not watch event loop fd: %s\n", strerror(errno));
+		UNREACHABLE();
+	}
+}
+
+static void start_loop(EventLoop *loop)
+{
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	loop->timer_fd =
+		timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (loop->epoll_fd < 0 || loop->timer_fd < 0 || loop->wake_fd < 0)
+	{
+		printf("Could not start the event loop: %s\n", strerror(errno));
+		UNREACHABLE();
+	}
+
+	watch(loop, loop->timer_fd);
+	watch(loop, loop->wake_fd);
+}
+
+static void *file_thread_main(void *arg)
+{
+	EventLoop *loop = arg;
+
+	pthread_mutex_lock(&loop->lock);
+
+	while (!loop->stopping)
+	{
+		if (arrempty(loop->file_jobs))
+		{
+			pthread_cond_wait(&loop->file_work, &loop->lock);
+			continue;
+		}
+
+		AsyncRequest *request = loop->file_jobs[0];
+		arrdel(loop->file_jobs, 0);
+		loop->file_running = request;
+
+		pthread_mutex_unlock(&loop->lock);
+		run_file_request(request);
+		pthread_mutex_lock(&loop->lock);
+
+		loop->file_running = NULL;
+		arrpush(loop->file_done, request);
+		eventfd_write(loop->wake_fd, 1);
+	}
+
+	pthread_mutex_unlock(&loop->lock);
+
+	return NULL;
+}
+
+void event_loop_submit(EventLoop *loop, AsyncRequest *request)
+{
+	if (loop->epoll_fd < 0)
+	{
+		start_loop(loop);
+	}
+
+	loop->pending += 1;
+
+	switch (request->op)
+	{
+		case ASYNC_SLEEP:
+		{
+			request->sequence = loop->next_sequence++;
+			timer_push(loop, request);
+		}
+		break;
+
+		case ASYNC_READ_FILE:
+		case ASYNC_WRITE_FILE:
+		{
+			if (!loop->file_thread_started)
+			{
+				pthread_create(&loop->file_thread, NULL, file_thread_main,
+							   loop);
+				loop->file_thread_started = true;
+			}
+
+			pthread_mutex_lock(&loop->lock);
+			arrpush(loop->file_jobs, request);
+			pthread_cond_signal(&loop->file_work);
+			pthread_mutex_unlock(&loop->lock);
+		}
+		break;
+	}
+}
+
+static void mark_requests(Heap *heap, AsyncRequest **requests, i32 from)
+{
+	for (i32 i = from; i < arrlen(requests); i++)
+	{
+		gc_mark_cell(heap, (Cell *)requests[i]->task);
+	}
+}
+
+void event_loop_mark_tasks(EventLoop *loop, Heap *heap)
+{
+	mark_requests(heap, loop->timers, 0);
+	mark_requests(heap, loop->ready, loop->ready_head);
+
+	pthread_mutex_lock(&loop->lock);
+	mark_requests(heap, loop->file_jobs, 0);
+	mark_requests(heap, loop->file_done, 0);
+	if (loop->file_running != NULL)
+	{
+		gc_mark_cell(heap, (Cell *)loop->file_running->task);
+	}
+	pthread_mutex_unlock(&loop->lock);
+}
+
+static void collect_timers(EventLoop *loop)
+{
+	u64 now = monotonic_now();
+
+	while (!arrempty(loop->timers) && loop->timers[0]->deadline <= now)
+	{
+		arrpush(loop->ready, timer_pop(loop));
+	}
+}
+
+static void collect_files(EventLoop *loop)
+{
+	eventfd_t count;
+	eventfd_read(loop->wake_fd, &count);
+
+	pthread_mutex_lock(&loop->lock);
+
+	for (i32 i = 0; i < arrlen(loop->file_done); i++)
+	{
+		arrpush(loop->ready, loop->file_done[i]);
+	}
+
+	arrsetlen(loop->file_done, 0);
+	pthread_mutex_unlock(&loop->lock);
+}
+
+static void wait_for_events(EventLoop *loop)
+{
+	collect_timers(loop);
+
+	if (!arrempty(loop->ready))
+	{
+		return;
+	}
+
+	// Only the earliest timer needs to wake the loop up
+	struct itimerspec timer = { 0 };
+	if (!arrempty(loop->timers))
+	{
+		timer.it_value = to_timespec(loop->timers[0]->deadline);
+	}
+
+	timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+
+	struct epoll_event events[2];
+	i32 count = epoll_wait(loop->epoll_fd, events, 2, -1);
+
+	for (i32 i = 0; i < count; i++)
+	{
+		if (events[i].data.fd == loop->wake_fd)
+		{
+			collect_files(loop);
+		}
+	}
+
+	collect_timers(loop);
+}
+
+AsyncRequest *event_loop_next(EventLoop *loop)
+{
+	if (loop->pending == 0)
+	{
+		return NULL;
+	}
+
+	while (loop->ready_head == arrlen(loop->ready))
+	{
+		arrsetlen(loop->ready, 0);
+		loop->ready_head = 0;
+		wait_for_events(loop);
+	}
+
+	loop->pending -= 1;
+	return loop->ready[loop->ready_head++];
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "core/common.h"
+#include "core/gc.h"
+#include "core/value.h"
+
+struct Coroutine;
+
+typedef enum AsyncOp
+{
+	ASYNC_SLEEP,
+	ASYNC_READ_FILE,
+	ASYNC_WRITE_FILE,
+} AsyncOp;
+
+// Operation requested by an async native. The vm either hands it to its event
+// loop and suspends the calling task until it completes, or runs it right away
+// when it is not called from a task.
+typedef struct AsyncRequest
+{
+	AsyncOp op;
+
+	// When set by the native, the task is started once the request completes
+	// and the caller gets the task back without waiting
+	struct Coroutine *task;
+
+	u64 deadline; // ASYNC_SLEEP, in nanoseconds of the monotonic clock
+	u64 sequence; // Orders requests sharing a deadline
+
+	char *path;
+	char *data; // Content to write, or content read once completed
+	i32 len;
+	bool ok;
+} AsyncRequest;
+
+AsyncRequest *async_request_sleep(f64 seconds);
+AsyncRequest *async_request_read_file(const char *path, i32 path_len);
+AsyncRequest *async_request_write_file(const char *path, i32 path_len,
+									   const char *data, i32 len);
+void async_request_free(AsyncRequest *request);
+
+// Runs the request on the calling thread, then frees it
+Value async_request_run(AsyncRequest *request);
+
+// Result of a completed request, which is freed
+Value async_request_finish(AsyncRequest *request);
+
+// Timers are kept in a heap behind a single timerfd, and file operations run
+// on a helper thread that signals completions through an eventfd, so that the
+// loop only ever waits on one epoll instance.
+// Nothing is allocated until the first request is submitted.
+typedef struct EventLoop
+{
+	int epoll_fd;
+	int timer_fd;
+	int wake_fd;
+
+	AsyncRequest **timers; // Min-heap on (deadline, sequence)
+	u64 next_sequence;
+
+	AsyncRequest **ready;
+	i32 ready_head;
+
+	i32 pending; // Submitted and not returned by event_loop_next yet
+
+	pthread_t file_thread;
+	bool file_thread_started;
+	bool stopping;
+	pthread_mutex_t lock; // Guards the two lists below and `stopping`
+	pthread_cond_t file_work;
+	AsyncRequest **file_jobs;
+	AsyncRequest *file_running;
+	AsyncRequest **file_done;
+} EventLoop;
+
+void event_loop_init(EventLoop *loop);
+void event_loop_free(EventLoop *loop);
+
+void event_loop_submit(EventLoop *loop, AsyncRequest *request);
+
+// Marks the tasks of the pending requests, which only the loop references
+void event_loop_mark_tasks(EventLoop *loop, Heap *heap);
+
+// Blocks until a request completes and returns it, or returns NULL right away
+// once nothing is pending
+AsyncRequest *event_loop_next(EventLoop *loop);
@@ -22,9 +22,11 @@ void frame_stack_free(FrameStack *stack)
 void frame_stack_push_frame(FrameStack *stack)
 {
 	Frame frame;
-	hash_table_init(&frame.variables);
+	hash_table_init_as(&frame.variables, TABLE_FRAMES);
 
+	MemCategory previous = mem_enter(MEM_FRAMES);
 	arrpush(stack->frames, frame);
+	mem_enter(previous);
 }
 
 void frame_stack_pop_frame(FrameStack *stack)
@@ -38,6 +40,22 @@ void frame_stack_pop_frame(FrameStack *stack)
 	hash_table_free(&top.variables);
 }
 
+void frame_stack_merge_frame(FrameStack *stack)
+{
+	Frame top = arrpop(stack->frames);
+	HashTable *below = &arrlast(stack->frames).variables;
+
+	i32 cursor = 0;
+	Entry *entry;
+
+	while ((entry = hash_table_next(&top.variables, &cursor)) != NULL)
+	{
+		hash_table_set(below, entry->key, entry->value);
+	}
+
+	hash_table_free(&top.variables);
+}
+
 bool frame_stack_get_value(FrameStack *stack, String *identifier, Value *value)
 {
 	i32 stack_len = (i32)arrlen(stack->frames);
@@ -47,7 +65,8 @@ bool frame_stack_get_value(FrameStack *stack, String *identifier, Value *value)
 	for (i32 i = stack_len - 1; i >= 0; i--)
 	{
 		Frame *frame = &stack->frames[i];
-		if (hash_table_get(&frame->variables, identifier, value))
+		if (hash_table_get(&frame->variables, value_cell((Cell *)identifier),
+						   value))
 		{
 			return true;
 		}
@@ -60,7 +79,7 @@ void frame_stack_declare_variable(FrameStack *stack, String *identifier,
 								  Value value)
 {
 	Frame *frame = &arrlast(stack->frames);
-	hash_table_set(&frame->variables, identifier, value);
+	hash_table_set(&frame->variables, value_cell((Cell *)identifier), value);
 }
 
 bool frame_stack_set_variable(FrameStack *stack, String *identifier,
@@ -73,11 +92,13 @@ bool frame_stack_set_variable(FrameStack *stack, String *identifier,
 		Value old_value = value_nil();
 		Frame *frame = &stack->frames[i];
 
-		if (hash_table_get(&frame->variables, identifier, &old_value))
+		if (hash_table_get(&frame->variables, value_cell((Cell *)identifier),
+						   &old_value))
 		{
-			if (old_value.type == VALUE_NIL || old_value.type == value.type)
+			if (is_nil(old_value) || values_share_type(old_value, value))
 			{
-				hash_table_set(&frame->variables, identifier, value);
+				hash_table_set(&frame->variables,
+							   value_cell((Cell *)identifier), value);
 				return true;
 			}
 			else
@@ -13,6 +13,9 @@ void frame_stack_free(FrameStack *stack);
 
 void frame_stack_push_frame(FrameStack *stack);
 void frame_stack_pop_frame(FrameStack *stack);
+// Pops the top frame, whose variables move to the frame below, where they
+// shadow those of the same name
+void frame_stack_merge_frame(FrameStack *stack);
 
 bool frame_stack_get_value(FrameStack *stack, String *identifier, Value *value);
 
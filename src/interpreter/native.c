@@ -0,0 +1,384 @@
+#include "native.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "core/cell.h"
+#include "core/dyn_array.h"
+#include "core/gc.h"
+#include "core/memory.h"
+#include "core/metrics.h"
+
+#include "interpreter/event_loop.h"
+#include "interpreter/vm.h"
+
+#include "debug/debug.h"
+
+void native_registry_init(NativeRegistry *registry)
+{
+	registry->decls = NULL;
+}
+
+void native_registry_free(NativeRegistry *registry)
+{
+	for (i32 i = 0; i < arrlen(registry->decls); i++)
+	{
+		mem_free((char *)registry->decls[i].name);
+	}
+
+	arrfree(registry->decls);
+}
+
+void native_register(NativeRegistry *registry, const char *name,
+					 NativeFunction function, i32 arity)
+{
+	Native native = { .function = function, .arity = arity };
+
+	for (i32 i = 0; i < arrlen(registry->decls); i++)
+	{
+		if (strcmp(registry->decls[i].name, name) == 0)
+		{
+			registry->decls[i].native = native;
+			return;
+		}
+	}
+
+	// Hosts may register names from buffers that don't outlive the call
+	usize len = strlen(name);
+	char *copy = mem_malloc(len + 1);
+	mem_copy(copy, name, len + 1);
+
+	NativeDecl decl = { .name = copy, .native = native };
+	arrpush(registry->decls, decl);
+}
+
+const char *native_name(const NativeRegistry *registry,
+						NativeFunction function)
+{
+	for (i32 i = 0; i < arrlen(registry->decls); i++)
+	{
+		if (registry->decls[i].native.function == function)
+		{
+			return registry->decls[i].name;
+		}
+	}
+
+	return NULL;
+}
+
+bool native_check_arity(const NativeRegistry *registry, Native native,
+						i32 arg_count)
+{
+	if (native.arity == NATIVE_VARIADIC || native.arity == arg_count)
+	{
+		return true;
+	}
+
+	const char *name = native_name(registry, native.function);
+
+	printf("Native function %s expects %d arguments, got %d\n",
+		   name != NULL ? name : "<unknown>", native.arity, arg_count);
+	return false;
+}
+
+static Result native_time(Value *args, i32 arg_count)
+{
+	UNUSED(args);
+	UNUSED(arg_count);
+
+#ifdef _WIN32
+	// TODO
+	return result_return(value_number(0));
+#else
+	struct timespec clock;
+	clock_gettime(CLOCK_REALTIME, &clock);
+
+	f64 t = (f64)clock.tv_nsec * 1e-9 + clock.tv_sec;
+
+	return result_return(value_number(t));
+#endif
+}
+
+static Result native_print(Value *args, i32 arg_count)
+{
+	for (i32 i = 0; i < arg_count; i++)
+	{
+		if (i != 0)
+		{
+			printf(" ");
+		}
+
+		print_value(&args[i]);
+	}
+
+	printf("\n");
+
+	return result_none();
+}
+
+static Result native_coroutine(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	if (!is_compiled_function(args[0]) && !is_function(args[0]))
+	{
+		printf("Coroutines can only be created from functions\n");
+		return result_none();
+	}
+
+	Coroutine *coroutine = coroutine_new(args[0]);
+	return result_return(value_cell((Cell *)coroutine));
+}
+
+static Result native_coroutine_done(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	if (!is_coroutine(args[0]))
+	{
+		printf("Expected a coroutine\n");
+		return result_none();
+	}
+
+	bool done = as_coroutine(args[0])->state == COROUTINE_DONE;
+	return result_return(value_bool(done));
+}
+
+static Result native_len(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	if (is_array(args[0]))
+	{
+		return result_return(value_number(arrlen(as_array(args[0])->items)));
+	}
+
+	if (is_any_string(args[0]))
+	{
+		return result_return(value_number(string_length(args[0])));
+	}
+
+	printf("Only arrays and strings have a length\n");
+	return result_none();
+}
+
+static Result native_push(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	if (!is_array(args[0]))
+	{
+		printf("Expected an array\n");
+		return result_none();
+	}
+
+	gc_write_barrier(args[1]);
+	arrpush(as_array(args[0])->items, args[1]);
+	return result_none();
+}
+
+static Result native_gc_pause_budget(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	Heap *heap = gc_current_heap();
+
+	if (!is_number(args[0]) || as_number(args[0]) < 0)
+	{
+		printf("Expected a number of microseconds\n");
+		return result_none();
+	}
+
+	if (heap != NULL)
+	{
+		gc_set_pause_budget(heap, (u64)(as_number(args[0]) * 1000));
+	}
+
+	return result_none();
+}
+
+static void set_field(Map *map, const char *name, f64 number)
+{
+	hash_table_set(&map->table, value_short_string(name, (i32)strlen(name)),
+				   value_number(number));
+}
+
+// Pauses of the collector in microseconds, percentiles being of the last
+// GC_PAUSE_WINDOW ones
+static Result native_gc_pauses(Value *args, i32 arg_count)
+{
+	UNUSED(args);
+	UNUSED(arg_count);
+
+	Heap *heap = gc_current_heap();
+
+	if (heap == NULL)
+	{
+		printf("Only the bytecode vm collects garbage\n");
+		return result_none();
+	}
+
+	Map *pauses = map_new();
+	set_field(pauses, "count", (f64)heap->pause_count);
+	set_field(pauses, "p50", gc_pause_percentile(heap, 50) / 1e3);
+	set_field(pauses, "p99", gc_pause_percentile(heap, 99) / 1e3);
+	set_field(pauses, "max", heap->pause_max / 1e3);
+
+	return result_return(value_cell((Cell *)pauses));
+}
+
+// Counters of the allocator of the current heap, sizes in bytes
+static Result native_alloc_stats(Value *args, i32 arg_count)
+{
+	UNUSED(args);
+	UNUSED(arg_count);
+
+	Heap *heap = gc_current_heap();
+
+	if (heap == NULL)
+	{
+		printf("Only the bytecode vm collects garbage\n");
+		return result_none();
+	}
+
+	SlabStats stats = heap->slab.stats;
+
+	Map *map = map_new();
+	set_field(map, "allocations", (f64)stats.allocations);
+	set_field(map, "frees", (f64)stats.frees);
+	set_field(map, "large", (f64)stats.large);
+	set_field(map, "pages", (f64)stats.pages);
+	set_field(map, "in_use", (f64)stats.in_use);
+	set_field(map, "heap", (f64)heap->allocated);
+
+	return result_return(value_cell((Cell *)map));
+}
+
+// Counters of the process, see metrics.h, and the time spent in each phase
+// in milliseconds, which only counts the runs that are over
+static Result native_stats(Value *args, i32 arg_count)
+{
+	UNUSED(args);
+	UNUSED(arg_count);
+
+	Heap *heap = gc_current_heap();
+
+	if (heap != NULL)
+	{
+		vm_flush_metrics(heap->owner);
+	}
+
+	MetricsSnapshot snapshot = metrics_snapshot();
+	Map *map = map_new();
+
+	for (i32 i = 0; i < METRIC_COUNT; i++)
+	{
+		set_field(map, metrics_name(i), (f64)snapshot.counts[i]);
+	}
+
+	for (i32 i = 0; i < PHASE_COUNT; i++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%s_ms", metrics_phase_name(i));
+		set_field(map, name, snapshot.phase_ns[i] / 1e6);
+	}
+
+	return result_return(value_cell((Cell *)map));
+}
+
+// Async natives return a request, see event_loop.h
+
+static Result native_sleep(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	if (!is_number(args[0]))
+	{
+		printf("Expected a number of seconds\n");
+		return result_none();
+	}
+
+	return result_async(async_request_sleep(as_number(args[0])));
+}
+
+static Result native_read_file(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	if (!is_any_string(args[0]))
+	{
+		printf("Expected a path\n");
+		return result_none();
+	}
+
+	AsyncRequest *request = async_request_read_file(
+		string_chars(&args[0]), string_length(args[0]));
+	return result_async(request);
+}
+
+static Result native_write_file(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	if (!is_any_string(args[0]) || !is_any_string(args[1]))
+	{
+		printf("Expected a path and a string\n");
+		return result_none();
+	}
+
+	AsyncRequest *request = async_request_write_file(
+		string_chars(&args[0]), string_length(args[0]),
+		string_chars(&args[1]), string_length(args[1]));
+	return result_async(request);
+}
+
+static Result start_task(Value function, f64 seconds)
+{
+	if (!is_compiled_function(function) && !is_function(function))
+	{
+		printf("Tasks can only be started from functions\n");
+		return result_none();
+	}
+
+	AsyncRequest *request = async_request_sleep(seconds);
+	request->task = coroutine_new(function);
+	return result_async(request);
+}
+
+static Result native_spawn(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+	return start_task(args[0], 0);
+}
+
+static Result native_timer(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	if (!is_number(args[0]))
+	{
+		printf("Expected a number of seconds\n");
+		return result_none();
+	}
+
+	return start_task(args[1], as_number(args[0]));
+}
+
+void native_register_builtins(NativeRegistry *registry)
+{
+	native_register(registry, "time", native_time, 0);
+	native_register(registry, "print", native_print, NATIVE_VARIADIC);
+	native_register(registry, "coroutine", native_coroutine, 1);
+	native_register(registry, "coroutine_done", native_coroutine_done, 1);
+	native_register(registry, "len", native_len, 1);
+	native_register(registry, "push", native_push, 2);
+	native_register(registry, "gc_pause_budget", native_gc_pause_budget, 1);
+	native_register(registry, "gc_pauses", native_gc_pauses, 0);
+	native_register(registry, "alloc_stats", native_alloc_stats, 0);
+	native_register(registry, "stats", native_stats, 0);
+	native_register(registry, "sleep", native_sleep, 1);
+	native_register(registry, "read_file", native_read_file, 1);
+	native_register(registry, "write_file", native_write_file, 2);
+	native_register(registry, "spawn", native_spawn, 1);
+	native_register(registry, "timer", native_timer, 2);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "core/common.h"
+#include "core/value.h"
+
+// Natives are registered by the host on a registry, and declared as globals by
+// each engine when it starts running a program.
+typedef struct NativeDecl
+{
+	const char *name; // Owned by the registry
+	Native native;
+} NativeDecl;
+
+typedef struct NativeRegistry
+{
+	NativeDecl *decls;
+} NativeRegistry;
+
+void native_registry_init(NativeRegistry *registry);
+void native_registry_free(NativeRegistry *registry);
+
+// Registering a name twice replaces the previous function. `name` is copied.
+// `arity` is either a number of arguments or NATIVE_VARIADIC.
+void native_register(NativeRegistry *registry, const char *name,
+					 NativeFunction function, i32 arity);
+void native_register_builtins(NativeRegistry *registry);
+
+// Name under which `function` is registered, NULL if it isn't
+const char *native_name(const NativeRegistry *registry,
+						NativeFunction function);
+
+// Prints an error naming the native, found in `registry`, when it doesn't
+// accept `arg_count` arguments
+bool native_check_arity(const NativeRegistry *registry, Native native,
+						i32 arg_count);
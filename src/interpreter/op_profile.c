@@ -0,0 +1,158 @@
+#include "op_profile.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "core/memory.h"
+
+#include "debug/debug.h"
+
+// Pairs printed by op_profile_dump
+#define PAIRS_SHOWN 25
+
+static bool enabled = false;
+
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+static OpProfile totals;
+
+#if !defined(__x86_64__) && !defined(__i386__)
+// Nanoseconds stand in for cycles
+u64 op_profile_tick()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000000000ull + (u64)now.tv_nsec;
+}
+#endif
+
+bool op_profile_enable()
+{
+#ifdef CHARM_PROFILE_OPS
+	enabled = true;
+#endif
+
+	return enabled;
+}
+
+bool op_profile_enabled()
+{
+	return enabled;
+}
+
+OpProfile *op_profile_new()
+{
+	OpProfile *profile = mem_malloc(sizeof(OpProfile));
+	memset(profile, 0, sizeof(OpProfile));
+	op_profile_start(profile);
+
+	return profile;
+}
+
+void op_profile_merge(OpProfile *profile)
+{
+	pthread_mutex_lock(&totals_lock);
+
+	for (i32 i = 0; i < OP_COUNT; i++)
+	{
+		totals.counts[i] += profile->counts[i];
+		totals.cycles[i] += profile->cycles[i];
+
+		for (i32 j = 0; j < OP_COUNT; j++)
+		{
+			totals.pairs[i][j] += profile->pairs[i][j];
+		}
+	}
+
+	pthread_mutex_unlock(&totals_lock);
+
+	mem_free(profile);
+}
+
+typedef struct Row
+{
+	u8 first;
+	u8 second;
+	u64 key;
+} Row;
+
+static int compare_rows(const void *a, const void *b)
+{
+	u64 x = ((const Row *)a)->key;
+	u64 y = ((const Row *)b)->key;
+	return (x < y) - (x > y);
+}
+
+void op_profile_dump(FILE *out)
+{
+	pthread_mutex_lock(&totals_lock);
+
+	Row ops[OP_COUNT];
+	u64 total_count = 0;
+	u64 total_cycles = 0;
+
+	for (i32 i = 0; i < OP_COUNT; i++)
+	{
+		ops[i] = (Row){ .first = (u8)i, .key = totals.cycles[i] };
+		total_count += totals.counts[i];
+		total_cycles += totals.cycles[i];
+	}
+
+	qsort(ops, OP_COUNT, sizeof(Row), compare_rows);
+
+	fprintf(out, "%-18s %14s %16s %10s %7s\n", "opcode", "executions",
+			"cycles", "cycles/op", "time");
+
+	for (i32 i = 0; i < OP_COUNT; i++)
+	{
+		u64 count = totals.counts[ops[i].first];
+
+		if (count == 0)
+		{
+			continue;
+		}
+
+		fprintf(out, "%-18s %14llu %16llu %10.1f %6.2f%%\n",
+				debug_opcode_str(ops[i].first), (unsigned long long)count,
+				(unsigned long long)ops[i].key, (f64)ops[i].key / count,
+				100.0 * ops[i].key / MAX(total_cycles, 1));
+	}
+
+	fprintf(out, "%-18s %14llu %16llu\n\n", "total",
+			(unsigned long long)total_count, (unsigned long long)total_cycles);
+
+	Row *pairs = mem_allocate(Row, OP_COUNT * OP_COUNT);
+	i32 pair_count = 0;
+
+	for (i32 i = 0; i < OP_COUNT; i++)
+	{
+		for (i32 j = 0; j < OP_COUNT; j++)
+		{
+			if (totals.pairs[i][j] != 0)
+			{
+				pairs[pair_count++] = (Row){
+					.first = (u8)i,
+					.second = (u8)j,
+					.key = totals.pairs[i][j],
+				};
+			}
+		}
+	}
+
+	qsort(pairs, pair_count, sizeof(Row), compare_rows);
+
+	fprintf(out, "%-37s %14s %7s\n", "pair", "executions", "share");
+
+	for (i32 i = 0; i < MIN(pair_count, PAIRS_SHOWN); i++)
+	{
+		fprintf(out, "%-18s %-18s %14llu %6.2f%%\n",
+				debug_opcode_str(pairs[i].first),
+				debug_opcode_str(pairs[i].second),
+				(unsigned long long)pairs[i].key,
+				100.0 * pairs[i].key / MAX(total_count, 1));
+	}
+
+	mem_free(pairs);
+
+	pthread_mutex_unlock(&totals_lock);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "core/common.h"
+
+#include "compiler/chunk.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define op_profile_tick() __rdtsc()
+#else
+u64 op_profile_tick();
+#endif
+
+// Executions and cycles spent per opcode, and executions per pair of
+// consecutive opcodes, counted by the vm when built with CHARM_PROFILE_OPS.
+//
+// Cycles are counted from the dispatch of an instruction to the dispatch of
+// the next one, so that calls to natives count towards OP_CALL. Each vm counts
+// on its own, and adds its counts to the totals of the process when freed.
+typedef struct OpProfile
+{
+	u64 counts[OP_COUNT];
+	u64 cycles[OP_COUNT];
+	u64 pairs[OP_COUNT][OP_COUNT];
+
+	u8 previous; // OP_COUNT before the first instruction of a run
+	u64 last_tick;
+} OpProfile;
+
+// Vms created afterwards count their instructions. Returns false when not
+// built with CHARM_PROFILE_OPS.
+bool op_profile_enable();
+bool op_profile_enabled();
+
+OpProfile *op_profile_new();
+// Adds the counts of `profile` to the totals, then frees it
+void op_profile_merge(OpProfile *profile);
+
+// Prints the opcodes sorted by cycles, then the most frequent pairs
+void op_profile_dump(FILE *out);
+
+static inline void op_profile_start(OpProfile *profile)
+{
+	profile->previous = OP_COUNT;
+	profile->last_tick = op_profile_tick();
+}
+
+static inline void op_profile_count(OpProfile *profile, u8 instruction)
+{
+	u64 tick = op_profile_tick();
+
+	if (profile->previous != OP_COUNT)
+	{
+		profile->cycles[profile->previous] += tick - profile->last_tick;
+		profile->pairs[profile->previous][instruction] += 1;
+	}
+
+	profile->counts[instruction] += 1;
+	profile->previous = instruction;
+	profile->last_tick = tick;
+}
@@ -0,0 +1,276 @@
+#include "sampler.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "core/cell.h"
+#include "core/gc.h"
+#include "core/memory.h"
+
+#include "compiler/chunk.h"
+
+#include "interpreter/vm.h"
+
+#define SAMPLER_MAX_DEPTH 64
+// Distinct stacks kept, a power of two
+#define SAMPLER_STACKS 2048
+
+typedef struct SampleFrame
+{
+	const String *function; // NULL for the program itself
+	i32 line;
+} SampleFrame;
+
+typedef struct Sample
+{
+	u64 hash;
+	u64 count; // 0 for free slots of the table
+	i32 depth;
+	bool truncated; // Outer frames didn't fit
+	SampleFrame frames[SAMPLER_MAX_DEPTH]; // Innermost first
+} Sample;
+
+static Sample *samples = NULL;
+
+// Taken by the handler, which drops the sample instead of waiting
+static atomic_flag busy = ATOMIC_FLAG_INIT;
+static atomic_uint_fast64_t dropped = 0;
+
+// Innermost first, returns false once the sample is full
+static bool add_frames(Sample *sample, const Fiber *fiber)
+{
+	for (i32 i = fiber->frame_count - 1; i >= 0; i--)
+	{
+		if (sample->depth == SAMPLER_MAX_DEPTH)
+		{
+			sample->truncated = true;
+			return false;
+		}
+
+		const CallFrame *frame = &fiber->frames[i];
+		const Chunk *chunk = frame->chunk;
+		const String *function = NULL;
+
+		// Slot 0 holds the function being called, but not for the program
+		Value callee = frame->slots[0];
+		if (is_compiled_function(callee) &&
+			as_compiled_function(callee)->chunk == chunk)
+		{
+			function = as_compiled_function(callee)->name;
+		}
+
+		sample->frames[sample->depth++] = (SampleFrame){
+			.function = function,
+			.line = chunk_get_line(chunk, (i32)(frame->ip - chunk->code) - 1),
+		};
+	}
+
+	return true;
+}
+
+// Heaps are only current while their vm runs on the thread
+static void capture(Sample *sample)
+{
+	sample->depth = 0;
+	sample->truncated = false;
+
+	Heap *heap = gc_current_heap();
+
+	if (heap == NULL)
+	{
+		return;
+	}
+
+	Vm *vm = heap->owner;
+
+	// From the running coroutine out to the main fiber, so that deep stacks
+	// keep the frames that are actually running
+	for (Coroutine *coroutine = vm->coroutine; coroutine != NULL;
+		 coroutine = coroutine->caller)
+	{
+		if (coroutine->fiber != NULL && !add_frames(sample, coroutine->fiber))
+		{
+			return;
+		}
+	}
+
+	add_frames(sample, &vm->main_fiber);
+}
+
+static u64 hash_sample(const Sample *sample)
+{
+	u64 hash = 14695981039346656037ull;
+
+	for (i32 i = 0; i < sample->depth; i++)
+	{
+		hash ^= (u64)(usize)sample->frames[i].function;
+		hash *= 1099511628211ull;
+		hash ^= (u64)sample->frames[i].line;
+		hash *= 1099511628211ull;
+	}
+
+	return hash ^ (u64)sample->truncated;
+}
+
+static bool same_stack(const Sample *a, const Sample *b)
+{
+	return a->hash == b->hash && a->depth == b->depth &&
+		   a->truncated == b->truncated &&
+		   memcmp(a->frames, b->frames, sizeof(SampleFrame) * a->depth) == 0;
+}
+
+static void record(const Sample *sample)
+{
+	usize mask = SAMPLER_STACKS - 1;
+
+	for (usize i = 0; i < SAMPLER_STACKS; i++)
+	{
+		Sample *slot = &samples[(sample->hash + i) & mask];
+
+		if (slot->count == 0)
+		{
+			mem_copy(slot, sample, sizeof(Sample));
+			slot->count = 1;
+			return;
+		}
+
+		if (same_stack(slot, sample))
+		{
+			slot->count += 1;
+			return;
+		}
+	}
+
+	atomic_fetch_add(&dropped, 1);
+}
+
+static void on_sample(int signal)
+{
+	UNUSED(signal);
+
+	int saved_errno = errno;
+
+	if (atomic_flag_test_and_set_explicit(&busy, memory_order_acquire))
+	{
+		atomic_fetch_add(&dropped, 1);
+		errno = saved_errno;
+		return;
+	}
+
+	Sample sample;
+	capture(&sample);
+	sample.hash = hash_sample(&sample);
+	record(&sample);
+
+	atomic_flag_clear_explicit(&busy, memory_order_release);
+	errno = saved_errno;
+}
+
+static bool set_timer(i32 rate)
+{
+	struct itimerval timer = { 0 };
+
+	if (rate > 0)
+	{
+		timer.it_interval.tv_sec = 0;
+		timer.it_interval.tv_usec = MAX(1000000 / rate, 1);
+		timer.it_value = timer.it_interval;
+	}
+
+	return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+bool sampler_start(i32 rate)
+{
+	if (rate <= 0)
+	{
+		return false;
+	}
+
+	if (samples == NULL)
+	{
+		samples = mem_allocate(Sample, SAMPLER_STACKS);
+		mem_zero(samples, Sample, SAMPLER_STACKS);
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = on_sample;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+
+	return sigaction(SIGPROF, &action, NULL) == 0 && set_timer(rate);
+}
+
+void sampler_stop()
+{
+	set_timer(0);
+}
+
+static void write_frame(FILE *out, const SampleFrame *frame)
+{
+	if (frame->function == NULL)
+	{
+		fprintf(out, "<script>:%d", frame->line);
+		return;
+	}
+
+	fprintf(out, "%.*s:%d", frame->function->len, frame->function->str,
+			frame->line);
+}
+
+void sampler_write_collapsed(FILE *out)
+{
+	if (samples == NULL)
+	{
+		return;
+	}
+
+	// Signals may still be on their way to other threads
+	while (atomic_flag_test_and_set_explicit(&busy, memory_order_acquire))
+	{
+	}
+
+	for (i32 i = 0; i < SAMPLER_STACKS; i++)
+	{
+		const Sample *sample = &samples[i];
+
+		if (sample->count == 0)
+		{
+			continue;
+		}
+
+		if (sample->depth == 0)
+		{
+			fprintf(out, "<native>");
+		}
+
+		if (sample->truncated)
+		{
+			fprintf(out, "<truncated>;");
+		}
+
+		// Outermost first
+		for (i32 j = sample->depth - 1; j >= 0; j--)
+		{
+			write_frame(out, &sample->frames[j]);
+
+			if (j > 0)
+			{
+				fputc(';', out);
+			}
+		}
+
+		fprintf(out, " %llu\n", (unsigned long long)sample->count);
+	}
+
+	atomic_flag_clear_explicit(&busy, memory_order_release);
+}
+
+u64 sampler_dropped()
+{
+	return atomic_load(&dropped);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "core/common.h"
+
+// Sampling profiler. A SIGPROF timer interrupts the process every so often
+// of CPU time, and the thread it lands on records the call stack of the vm it
+// runs, if any: the stacks of its fibers, from the main one to the running
+// coroutine. Identical stacks are counted together in a table allocated up
+// front, so that the signal handler neither allocates nor takes locks, and
+// samples that don't fit are only counted as dropped.
+//
+// Frames are written as `function:line`, the source line of the instruction
+// being run, and the program itself as `<script>`. Samples taken outside of
+// any vm are written as `<native>`. Stacks deeper than the samples keep their
+// innermost frames, under a `<truncated>` root frame.
+
+#define SAMPLER_DEFAULT_RATE 99
+
+// Samples `rate` times per second of CPU time, until sampler_stop. Returns
+// false if the timer could not be started.
+bool sampler_start(i32 rate);
+void sampler_stop();
+
+// Writes the samples in the collapsed stack format of flamegraph.pl, one
+// stack per line followed by its count
+void sampler_write_collapsed(FILE *out);
+
+u64 sampler_dropped();
@@ -1,100 +1,115 @@
 #include "treewalk.h"
 
-#include <time.h>
+#include <setjmp.h>
 
 #include "core/cell.h"
 #include "core/hash_table.h"
 #include "core/common.h"
 #include "core/value.h"
 #include "core/dyn_array.h"
+#include "core/metrics.h"
 
 #include "ast/ast.h"
 #include "ast/token.h"
 
 #include "debug/debug.h"
 
+#include "event_loop.h"
 #include "frame.h"
+#include "native.h"
 
-static Value interpret_expr(Expr *expr);
+// Everything the interpreter needs while running a program, so that several
+// programs can be interpreted at the same time
+typedef struct Interpreter
+{
+	FrameStack frame_stack;
+
+	// Call arguments are evaluated on this stack, which is reused from one
+	// call to the other so that calls don't need to allocate
+	Value *arg_stack;
 
-static NODISCARD Result interpret_stmt(Stmt *stmt);
+	// Set by a `return` of a call to a script function, which the function
+	// returning then runs in its own frame, instead of recursing
+	bool tail_call;
+	Value tail_callee;
+	Value *tail_args;
+	i32 call_depth; // Of script functions, tail calls are only made in one
 
-static FrameStack frame_stack;
-static String *native_call_args_name;
+	StringTable *strings;
+	NativeRegistry *natives;
 
-static Result native_print(Value *args);
-static Result native_time(Value *args);
+	// Where runtime errors that end the program jump back to, as expressions
+	// have no way to report them
+	jmp_buf error;
+} Interpreter;
 
-HashTable *strings = NULL;
+static Value interpret_expr(Interpreter *interp, Expr *expr);
 
-static void register_native_functions()
+static NODISCARD Result interpret_stmt(Interpreter *interp, Stmt *stmt);
+
+static void declare_native_functions(Interpreter *interp,
+									 NativeRegistry *natives)
 {
-#define STR(name) string_from_cstr(strings, name)
-	native_call_args_name = STR("native_call_args");
-	frame_stack_declare_variable(&frame_stack, STR("time"),
-								 value_native_function(native_time));
+	for (i32 i = 0; i < arrlen(natives->decls); i++)
+	{
+		NativeDecl decl = natives->decls[i];
+		String *name = string_from_cstr(interp->strings, decl.name);
+		Value value =
+			value_native_function(decl.native.function, decl.native.arity);
 
-	frame_stack_declare_variable(&frame_stack, STR("print"),
-								 value_native_function(native_print));
+		frame_stack_declare_variable(&interp->frame_stack, name, value);
+	}
 }
 
-static Result native_time(Value *args)
+static _Noreturn void runtime_error(Interpreter *interp)
 {
-#ifdef _WIN32
-	// TODO
-	UNUSED(args);
-	return result_return(value_number(0));
-#else
-	struct timespec clock;
-	clock_gettime(CLOCK_REALTIME, &clock);
-
-	f64 t = (f64)clock.tv_nsec * 1e-9 + clock.tv_sec;
-
-	return result_return(value_number(t));
-#endif
+	longjmp(interp->error, 1);
 }
 
-static Result native_print(Value *args)
+static void run_statements(Interpreter *interp, Program program)
 {
-	for (i32 i = 0; i < arrlen(args); i++)
+	i32 count = (i32)arrlen(program.statements);
+	for (i32 i = 0; i < count; i++)
 	{
-		Value value = args[i];
-
-		if (i != 0)
-		{
-			printf(" ");
-		}
-
-		print_value(&value);
+		Result result = interpret_stmt(interp, program.statements[i]);
+		// TODO: Handle errors here ?
+		UNUSED(result);
 	}
-
-	printf("\n");
-
-	return result_none();
 }
 
-void treewalk_interpreter_run(struct Program program)
+bool treewalk_interpreter_run(struct Program program, NativeRegistry *natives)
 {
-	frame_stack_init(&frame_stack);
-	frame_stack_push_frame(&frame_stack);
+	Interpreter interp_state = { .strings = program.strings,
+								 .natives = natives };
+	Interpreter *interp = &interp_state;
+	u64 start = metrics_now();
 
-	strings = &program.strings;
+	frame_stack_init(&interp->frame_stack);
+	frame_stack_push_frame(&interp->frame_stack);
 
-	register_native_functions();
+	declare_native_functions(interp, natives);
 
-	i32 count = (i32)arrlen(program.statements);
-	for (i32 i = 0; i < count; i++)
+	bool ok = false;
+
+	if (setjmp(interp->error) == 0)
 	{
-		Result result = interpret_stmt(program.statements[i]);
-		// TODO: Handle errors here ?
-		UNUSED(result);
+		run_statements(interp, program);
+		ok = true;
 	}
+
+	arrfree(interp->arg_stack);
+	arrfree(interp->tail_args);
+	frame_stack_free(&interp->frame_stack);
+
+	metrics_end(PHASE_TREEWALK, start);
+
+	return ok;
 }
 
-static Value mult(Expr *lhs, Expr *rhs)
+static Value mult(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
-	Value l = interpret_expr(lhs);
-	Value r = interpret_expr(rhs);
+	Value l = interpret_expr(interp, lhs);
+	Value r = interpret_expr(interp, rhs);
 
 	if (is_number(l) && is_number(r))
 	{
@@ -104,10 +119,10 @@ static Value mult(Expr *lhs, Expr *rhs)
 	UNREACHABLE();
 }
 
-static Value divide(Expr *lhs, Expr *rhs)
+static Value divide(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
-	Value l = interpret_expr(lhs);
-	Value r = interpret_expr(rhs);
+	Value l = interpret_expr(interp, lhs);
+	Value r = interpret_expr(interp, rhs);
 
 	if (is_number(l) && is_number(r))
 	{
@@ -117,24 +132,37 @@ static Value divide(Expr *lhs, Expr *rhs)
 	UNREACHABLE();
 }
 
-static Value add(Expr *lhs, Expr *rhs)
+static Value add(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
-	Value l = interpret_expr(lhs);
-	Value r = interpret_expr(rhs);
+	Value l = interpret_expr(interp, lhs);
+	Value r = interpret_expr(interp, rhs);
 
 	if (is_number(l) && is_number(r))
 	{
 		return value_number(l.as.number + r.as.number);
 	}
 
+	if (is_any_string(l) && is_any_string(r))
+	{
+		Value result;
+
+		if (!string_concat(l, r, &result))
+		{
+			printf("Strings can't be longer than %d bytes\n", STRING_MAX_LEN);
+			runtime_error(interp);
+		}
+
+		return result;
+	}
+
 	printf("%u %u\n", l.type, r.type);
 	UNREACHABLE();
 }
 
-static Value subtract(Expr *lhs, Expr *rhs)
+static Value subtract(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
-	Value l = interpret_expr(lhs);
-	Value r = interpret_expr(rhs);
+	Value l = interpret_expr(interp, lhs);
+	Value r = interpret_expr(interp, rhs);
 
 	if (is_number(l) && is_number(r))
 	{
@@ -147,8 +175,8 @@ static Value subtract(Expr *lhs, Expr *rhs)
 #define BIN_COMP(op)                                                 \
 	do                                                               \
 	{                                                                \
-		Value l = interpret_expr(lhs);                               \
-		Value r = interpret_expr(rhs);                               \
+		Value l = interpret_expr(interp, lhs);                       \
+		Value r = interpret_expr(interp, rhs);                       \
                                                                      \
 		if (values_share_type(l, r))                                 \
 		{                                                            \
@@ -166,39 +194,42 @@ static Value subtract(Expr *lhs, Expr *rhs)
 		UNREACHABLE();                                               \
 	} while (false)
 
-static Value eq(Expr *lhs, Expr *rhs)
+static Value eq(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
-	BIN_COMP(==);
+	Value l = interpret_expr(interp, lhs);
+	Value r = interpret_expr(interp, rhs);
+
+	return value_bool(values_equal(l, r));
 }
 
-static Value neq(Expr *lhs, Expr *rhs)
+static Value neq(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
-	BIN_COMP(!=);
+	return value_bool(!as_bool(eq(interp, lhs, rhs)));
 }
 
-static Value lt(Expr *lhs, Expr *rhs)
+static Value lt(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
 	BIN_COMP(<);
 }
 
-static Value gt(Expr *lhs, Expr *rhs)
+static Value gt(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
 	BIN_COMP(>);
 }
 
-static Value leq(Expr *lhs, Expr *rhs)
+static Value leq(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
 	BIN_COMP(<=);
 }
 
-static Value geq(Expr *lhs, Expr *rhs)
+static Value geq(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
 	BIN_COMP(>=);
 }
 
-static Value logic_and(Expr *lhs, Expr *rhs)
+static Value logic_and(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
-	Value left = interpret_expr(lhs);
+	Value left = interpret_expr(interp, lhs);
 	if (left.type != VALUE_BOOL)
 	{
 		printf("Operands to `and` must be of type boolean\n");
@@ -211,7 +242,7 @@ static Value logic_and(Expr *lhs, Expr *rhs)
 		return left;
 	}
 
-	Value right = interpret_expr(rhs);
+	Value right = interpret_expr(interp, rhs);
 	if (right.type != VALUE_BOOL)
 	{
 		printf("Operands to `and` must be of type boolean\n");
@@ -221,9 +252,9 @@ static Value logic_and(Expr *lhs, Expr *rhs)
 	return right;
 }
 
-static Value logic_or(Expr *lhs, Expr *rhs)
+static Value logic_or(Interpreter *interp, Expr *lhs, Expr *rhs)
 {
-	Value left = interpret_expr(lhs);
+	Value left = interpret_expr(interp, lhs);
 	if (left.type != VALUE_BOOL)
 	{
 		printf("Operands to `or` must be of type boolean\n");
@@ -236,7 +267,7 @@ static Value logic_or(Expr *lhs, Expr *rhs)
 		return left;
 	}
 
-	Value right = interpret_expr(rhs);
+	Value right = interpret_expr(interp, rhs);
 	if (right.type != VALUE_BOOL)
 	{
 		printf("Operands to `or` must be of type boolean\n");
@@ -246,13 +277,23 @@ static Value logic_or(Expr *lhs, Expr *rhs)
 	return right;
 }
 
-static Result call_function(FrameStack *stack, Value callee, Value *args);
-static Result call_native_function(FrameStack *stack, Value callee,
-								   Value *args);
-
-static Value interpret_binary_expr(BinaryExpr *expr);
-
-static Value interpret_expr(Expr *expr)
+static Result call_function(Interpreter *interp, Value callee, Value *args,
+							i32 arg_count);
+static Result call_native_function(Interpreter *interp, Value callee,
+								   Value *args, i32 arg_count);
+
+static Value interpret_call_expr(Interpreter *interp, CallExpr *expr,
+								 bool tail);
+static Value interpret_binary_expr(Interpreter *interp, BinaryExpr *expr);
+static Value interpret_map_literal_expr(Interpreter *interp,
+										MapLiteralExpr *expr);
+static Value interpret_array_literal_expr(Interpreter *interp,
+										  ArrayLiteralExpr *expr);
+static Value interpret_index_expr(Interpreter *interp, IndexExpr *expr);
+static Value interpret_set_index_expr(Interpreter *interp,
+									  SetIndexExpr *expr);
+
+static Value interpret_expr(Interpreter *interp, Expr *expr)
 {
 	switch (expr->type)
 	{
@@ -262,14 +303,14 @@ static Value interpret_expr(Expr *expr)
 		case EXPR_NUMBER_LITERAL:
 			return value_number(expr->as.number);
 
-		case EXPR_CELL_LITERAL:
-			return value_cell(expr->as.cell);
+		case EXPR_STRING_LITERAL:
+			return expr->as.string;
 
 		case EXPR_GROUPING:
-			return interpret_expr(expr->as.grouping.expr);
+			return interpret_expr(interp, expr->as.grouping.expr);
 
 		case EXPR_BINARY:
-			return interpret_binary_expr(&expr->as.binary);
+			return interpret_binary_expr(interp, &expr->as.binary);
 
 		case EXPR_UNARY:
 		{
@@ -277,7 +318,7 @@ static Value interpret_expr(Expr *expr)
 			{
 				case TOKEN_MINUS:
 				{
-					Value v = interpret_expr(expr->as.unary.right);
+					Value v = interpret_expr(interp, expr->as.unary.right);
 					if (is_number(v))
 					{
 						return value_number(-v.as.number);
@@ -289,7 +330,7 @@ static Value interpret_expr(Expr *expr)
 
 				case TOKEN_NOT:
 				{
-					Value v = interpret_expr(expr->as.unary.right);
+					Value v = interpret_expr(interp, expr->as.unary.right);
 					if (is_bool(v))
 					{
 						return value_bool(!v.as.boolean);
@@ -307,8 +348,8 @@ static Value interpret_expr(Expr *expr)
 
 		case EXPR_ASSIGNMENT:
 		{
-			Value value = interpret_expr(expr->as.assignment.value);
-			if (!frame_stack_set_variable(&frame_stack,
+			Value value = interpret_expr(interp, expr->as.assignment.value);
+			if (!frame_stack_set_variable(&interp->frame_stack,
 										  expr->as.assignment.name, value))
 			{
 				// TODO: Error
@@ -323,8 +364,8 @@ static Value interpret_expr(Expr *expr)
 		case EXPR_IDENTIFIER:
 		{
 			Value value = value_nil();
-			if (!frame_stack_get_value(&frame_stack, expr->as.identifier,
-									   &value))
+			if (!frame_stack_get_value(&interp->frame_stack,
+									   expr->as.identifier, &value))
 			{
 				// TODO: Error
 				printf("Variable '%.*s' does not exist\n",
@@ -336,121 +377,344 @@ static Value interpret_expr(Expr *expr)
 		break;
 
 		case EXPR_CALL:
-		{
-			Value callee = interpret_expr(expr->as.call.callee);
+			return interpret_call_expr(interp, &expr->as.call, false);
 
-			Value *args = NULL;
+		case EXPR_MAP_LITERAL:
+			return interpret_map_literal_expr(interp, &expr->as.map);
 
-			for (i32 i = 0; i < arrlen(expr->as.call.arguments); i++)
-			{
-				arrpush(args, interpret_expr(expr->as.call.arguments[i]));
-			}
+		case EXPR_ARRAY_LITERAL:
+			return interpret_array_literal_expr(interp, &expr->as.array);
 
-			frame_stack_push_frame(&frame_stack);
+		case EXPR_INDEX:
+			return interpret_index_expr(interp, &expr->as.index);
 
-			Result result = result_none();
+		case EXPR_SET_INDEX:
+			return interpret_set_index_expr(interp, &expr->as.set_index);
 
-			switch (callee.type)
-			{
-				case VALUE_FUNCTION:
-				{
-					result = call_function(&frame_stack, callee, args);
-				}
-				break;
+		case EXPR_YIELD:
+		case EXPR_RESUME:
+			// Suspending would require unwinding the C stack
+			printf("Coroutines are only supported by the bytecode vm\n");
+			return value_nil();
+	}
 
-				case VALUE_NATIVE_FUNCTION:
-				{
-					result = call_native_function(&frame_stack, callee, args);
-				}
-				break;
+	UNREACHABLE();
+}
 
-				default:
-					UNREACHABLE();
-			}
+// Tail calls to script functions are left to the function returning, see
+// call_function
+static Value interpret_call_expr(Interpreter *interp, CallExpr *expr,
+								 bool tail)
+{
+	Value callee = interpret_expr(interp, expr->callee);
 
-			frame_stack_pop_frame(&frame_stack);
+	i32 arg_count = (i32)arrlen(expr->arguments);
+	i32 base = (i32)arrlen(interp->arg_stack);
 
-			arrfree(args);
+	for (i32 i = 0; i < arg_count; i++)
+	{
+		Value arg = interpret_expr(interp, expr->arguments[i]);
+		arrpush(interp->arg_stack, arg);
+	}
+
+	// Arguments evaluation may have grown the stack, so the view can only be
+	// taken now
+	Value *args = interp->arg_stack + base;
+
+	Result result = result_none();
 
-			switch (result.type)
+	switch (callee.type)
+	{
+		case VALUE_FUNCTION:
+		{
+			if (tail)
 			{
-				case RESULT_NONE:
-					return value_nil();
+				arrsetlen(interp->tail_args, 0);
 
-				case RESULT_RETURN:
-					return result.as.return_result;
+				if (arg_count > 0)
+				{
+					memcpy(arraddnptr(interp->tail_args, arg_count), args,
+						   sizeof(Value) * arg_count);
+				}
+
+				interp->tail_call = true;
+				interp->tail_callee = callee;
+				break;
 			}
+
+			result = call_function(interp, callee, args, arg_count);
 		}
 		break;
+
+		case VALUE_NATIVE_FUNCTION:
+		{
+			result = call_native_function(interp, callee, args, arg_count);
+		}
+		break;
+
+		default:
+			UNREACHABLE();
+	}
+
+	arrsetlen(interp->arg_stack, base);
+
+	switch (result.type)
+	{
+		case RESULT_NONE:
+			return value_nil();
+
+		case RESULT_RETURN:
+			return result.as.return_result;
+
+		case RESULT_ASYNC:
+			UNREACHABLE();
 	}
 
 	UNREACHABLE();
 }
 
-static Value interpret_binary_expr(BinaryExpr *binary)
+static bool check_map_access(Interpreter *interp, Value target, Value *key)
+{
+	if (!is_map(target))
+	{
+		printf("Only maps can be indexed\n");
+		return false;
+	}
+
+	*key = string_intern(interp->strings, *key);
+
+	if (!hash_table_is_valid_key(*key))
+	{
+		printf("Map keys must be booleans, strings or numbers but NaN\n");
+		return false;
+	}
+
+	return true;
+}
+
+static Value interpret_map_literal_expr(Interpreter *interp,
+										MapLiteralExpr *expr)
+{
+	Map *map = map_new();
+
+	for (i32 i = 0; i < arrlen(expr->keys); i++)
+	{
+		Value key = interpret_expr(interp, expr->keys[i]);
+		key = string_intern(interp->strings, key);
+		Value value = interpret_expr(interp, expr->values[i]);
+
+		if (!hash_table_is_valid_key(key))
+		{
+			printf("Map keys must be booleans, strings or numbers but NaN\n");
+			continue;
+		}
+
+		hash_table_set(&map->table, key, value);
+	}
+
+	return value_cell((Cell *)map);
+}
+
+static Value interpret_array_literal_expr(Interpreter *interp,
+										  ArrayLiteralExpr *expr)
+{
+	Array *array = array_new((i32)arrlen(expr->items));
+
+	for (i32 i = 0; i < arrlen(expr->items); i++)
+	{
+		arrpush(array->items, interpret_expr(interp, expr->items[i]));
+	}
+
+	return value_cell((Cell *)array);
+}
+
+static Value *check_array_access(Value target, Value index)
+{
+	Value *item = array_at(as_array(target), index);
+
+	if (item == NULL)
+	{
+		printf("Array indices must be integers within bounds\n");
+	}
+
+	return item;
+}
+
+static Value interpret_index_expr(Interpreter *interp, IndexExpr *expr)
+{
+	Value target = interpret_expr(interp, expr->target);
+	Value key = interpret_expr(interp, expr->index);
+
+	Value value = value_nil();
+
+	if (is_array(target))
+	{
+		Value *item = check_array_access(target, key);
+		return item != NULL ? *item : value;
+	}
+
+	if (check_map_access(interp, target, &key))
+	{
+		hash_table_get(&as_map(target)->table, key, &value);
+	}
+
+	return value;
+}
+
+static Value interpret_set_index_expr(Interpreter *interp,
+									  SetIndexExpr *expr)
+{
+	Value target = interpret_expr(interp, expr->target);
+	Value key = interpret_expr(interp, expr->index);
+	Value value = interpret_expr(interp, expr->value);
+
+	if (is_array(target))
+	{
+		Value *item = check_array_access(target, key);
+		if (item != NULL)
+		{
+			*item = value;
+		}
+
+		return value;
+	}
+
+	if (check_map_access(interp, target, &key))
+	{
+		hash_table_set(&as_map(target)->table, key, value);
+	}
+
+	return value;
+}
+
+static Value interpret_binary_expr(Interpreter *interp, BinaryExpr *binary)
 {
 	switch (binary->op)
 	{
 		case TOKEN_MINUS:
-			return subtract(binary->left, binary->right);
+			return subtract(interp, binary->left, binary->right);
 		case TOKEN_PLUS:
-			return add(binary->left, binary->right);
+			return add(interp, binary->left, binary->right);
 		case TOKEN_SLASH:
-			return divide(binary->left, binary->right);
+			return divide(interp, binary->left, binary->right);
 		case TOKEN_STAR:
-			return mult(binary->left, binary->right);
+			return mult(interp, binary->left, binary->right);
 		case TOKEN_BANG_EQUAL:
-			return neq(binary->left, binary->right);
+			return neq(interp, binary->left, binary->right);
 		case TOKEN_EQUAL_EQUAL:
-			return eq(binary->left, binary->right);
+			return eq(interp, binary->left, binary->right);
 		case TOKEN_GREATER:
-			return gt(binary->left, binary->right);
+			return gt(interp, binary->left, binary->right);
 		case TOKEN_GREATER_EQUAL:
-			return geq(binary->left, binary->right);
+			return geq(interp, binary->left, binary->right);
 		case TOKEN_LESS:
-			return lt(binary->left, binary->right);
+			return lt(interp, binary->left, binary->right);
 		case TOKEN_LESS_EQUAL:
-			return leq(binary->left, binary->right);
+			return leq(interp, binary->left, binary->right);
 		case TOKEN_AND:
-			return logic_and(binary->left, binary->right);
+			return logic_and(interp, binary->left, binary->right);
 		case TOKEN_OR:
-			return logic_or(binary->left, binary->right);
+			return logic_or(interp, binary->left, binary->right);
 
 		default:
 			UNREACHABLE();
 	}
 }
 
-static Result call_function(FrameStack *stack, Value callee, Value *args)
+// Names resolve through the frames of every caller, so a body unwinding for a
+// tail call keeps the variables of its blocks for the callee to see
+static void leave_frame(Interpreter *interp)
+{
+	if (interp->tail_call)
+	{
+		frame_stack_merge_frame(&interp->frame_stack);
+	}
+	else
+	{
+		frame_stack_pop_frame(&interp->frame_stack);
+	}
+}
+
+static Result call_function(Interpreter *interp, Value callee, Value *args,
+							i32 arg_count)
 {
-	i32 arity = (i32)arrlen(args);
+	FrameStack *stack = &interp->frame_stack;
+
+	frame_stack_push_frame(stack);
+	interp->call_depth += 1;
 
-	assert(arity == arrlen(callee.as.function.args));
+	Result result;
 
-	for (i32 i = 0; i < arity; i++)
+	for (;;)
 	{
-		String *arg_name = callee.as.function.args[i];
-		Value arg_value = args[i];
+		assert(arg_count == arrlen(callee.as.function.args));
+
+		for (i32 i = 0; i < arg_count; i++)
+		{
+			String *arg_name = callee.as.function.args[i];
+			Value arg_value = args[i];
+
+			frame_stack_declare_variable(stack, arg_name, arg_value);
+		}
+
+		result = interpret_stmt(interp, callee.as.function.body);
+
+		if (!interp->tail_call)
+		{
+			break;
+		}
 
-		frame_stack_declare_variable(stack, arg_name, arg_value);
+		// The callee declares over the variables of the body, which stay
+		// visible to it, see leave_frame
+		interp->tail_call = false;
+		callee = interp->tail_callee;
+		args = interp->tail_args;
+		arg_count = (i32)arrlen(interp->tail_args);
 	}
 
-	return interpret_stmt(callee.as.function.body);
+	interp->call_depth -= 1;
+	frame_stack_pop_frame(stack);
+
+	return result;
 }
 
-static Result call_native_function(FrameStack *stack, Value callee, Value *args)
+static Result call_native_function(Interpreter *interp, Value callee,
+								   Value *args, i32 arg_count)
 {
-	UNUSED(stack);
-	return callee.as.native_function(args);
+	Native native = as_native_function(callee);
+
+	if (!native_check_arity(interp->natives, native, arg_count))
+	{
+		return result_none();
+	}
+
+	Result result = native.function(args, arg_count);
+
+	if (result.type != RESULT_ASYNC)
+	{
+		return result;
+	}
+
+	// There is no event loop here, so requests complete before returning
+	AsyncRequest *request = result.as.async_request;
+
+	if (request->task != NULL)
+	{
+		printf("Tasks are only supported by the bytecode vm\n");
+		async_request_free(request);
+		return result_none();
+	}
+
+	return result_return(async_request_run(request));
 }
 
-static NODISCARD Result interpret_stmt(Stmt *stmt)
+static NODISCARD Result interpret_stmt(Interpreter *interp, Stmt *stmt)
 {
 	switch (stmt->type)
 	{
 		case STMT_EXPR:
 		{
-			Value value = interpret_expr(stmt->as.expression.expr);
+			Value value = interpret_expr(interp, stmt->as.expression.expr);
 			UNUSED(value);
 			return result_none();
 		}
@@ -461,11 +725,11 @@ static NODISCARD Result interpret_stmt(Stmt *stmt)
 			Value value = value_nil();
 			if (stmt->as.var_decl.expr != NULL)
 			{
-				value = interpret_expr(stmt->as.var_decl.expr);
+				value = interpret_expr(interp, stmt->as.var_decl.expr);
 			}
 
-			frame_stack_declare_variable(&frame_stack, stmt->as.var_decl.name,
-										 value);
+			frame_stack_declare_variable(&interp->frame_stack,
+										 stmt->as.var_decl.name, value);
 
 			return result_none();
 		}
@@ -476,7 +740,7 @@ static NODISCARD Result interpret_stmt(Stmt *stmt)
 			Value value = value_function(stmt->as.function_decl.args,
 										 stmt->as.function_decl.body);
 
-			frame_stack_declare_variable(&frame_stack,
+			frame_stack_declare_variable(&interp->frame_stack,
 										 stmt->as.function_decl.name, value);
 
 			return result_none();
@@ -485,14 +749,15 @@ static NODISCARD Result interpret_stmt(Stmt *stmt)
 
 		case STMT_BLOCK:
 		{
-			frame_stack_push_frame(&frame_stack);
+			frame_stack_push_frame(&interp->frame_stack);
 
 			Result block_result = result_none();
 
 			i32 count = (i32)arrlen(stmt->as.block.statements);
 			for (i32 i = 0; i < count; i++)
 			{
-				Result result = interpret_stmt(stmt->as.block.statements[i]);
+				Result result =
+					interpret_stmt(interp, stmt->as.block.statements[i]);
 				if (result.type == RESULT_RETURN)
 				{
 					block_result = result;
@@ -500,7 +765,7 @@ static NODISCARD Result interpret_stmt(Stmt *stmt)
 				}
 			}
 
-			frame_stack_pop_frame(&frame_stack);
+			leave_frame(interp);
 
 			return block_result;
 		}
@@ -508,7 +773,7 @@ static NODISCARD Result interpret_stmt(Stmt *stmt)
 
 		case STMT_IF:
 		{
-			Value value = interpret_expr(stmt->as.if_stmt.cond);
+			Value value = interpret_expr(interp, stmt->as.if_stmt.cond);
 			if (value.type != VALUE_BOOL)
 			{
 				printf("Error: if condition is not a boolean expression\n");
@@ -518,13 +783,13 @@ static NODISCARD Result interpret_stmt(Stmt *stmt)
 
 			if (value.as.boolean)
 			{
-				return interpret_stmt(stmt->as.if_stmt.then_branch);
+				return interpret_stmt(interp, stmt->as.if_stmt.then_branch);
 			}
 			else
 			{
 				if (stmt->as.if_stmt.else_branch != NULL)
 				{
-					return interpret_stmt(stmt->as.if_stmt.else_branch);
+					return interpret_stmt(interp, stmt->as.if_stmt.else_branch);
 				}
 
 				return result_none();
@@ -538,7 +803,7 @@ static NODISCARD Result interpret_stmt(Stmt *stmt)
 
 			while (true)
 			{
-				Value value = interpret_expr(stmt->as.while_stmt.cond);
+				Value value = interpret_expr(interp, stmt->as.while_stmt.cond);
 
 				if (value.type != VALUE_BOOL)
 				{
@@ -552,7 +817,8 @@ static NODISCARD Result interpret_stmt(Stmt *stmt)
 					break;
 				}
 
-				Result result = interpret_stmt(stmt->as.while_stmt.body);
+				Result result =
+					interpret_stmt(interp, stmt->as.while_stmt.body);
 				if (result.type == RESULT_RETURN)
 				{
 					block_result = result;
@@ -566,15 +832,71 @@ static NODISCARD Result interpret_stmt(Stmt *stmt)
 
 		case STMT_RETURN:
 		{
+			Expr *expr = stmt->as.return_stmt.expr;
 			Value result = value_nil();
-			if (stmt->as.return_stmt.expr != NULL)
+
+			if (expr != NULL && expr->type == EXPR_CALL &&
+				interp->call_depth > 0)
 			{
-				result = interpret_expr(stmt->as.return_stmt.expr);
+				result = interpret_call_expr(interp, &expr->as.call, true);
+			}
+			else if (expr != NULL)
+			{
+				result = interpret_expr(interp, expr);
 			}
 
 			return result_return(result);
 		}
 		break;
+
+		case STMT_FOR_IN:
+		{
+			Value iterable = interpret_expr(interp, stmt->as.for_in.iterable);
+			if (!is_map(iterable))
+			{
+				printf("Error: for in loops can only iterate over maps\n");
+				return result_none();
+			}
+
+			HashTable *table = &as_map(iterable)->table;
+			Result block_result = result_none();
+
+			i32 cursor = 0;
+			for (Entry *entry = hash_table_next(table, &cursor); entry != NULL;
+				 entry = hash_table_next(table, &cursor))
+			{
+				frame_stack_push_frame(&interp->frame_stack);
+				frame_stack_declare_variable(&interp->frame_stack,
+											 stmt->as.for_in.name, entry->key);
+
+				Result result = interpret_stmt(interp, stmt->as.for_in.body);
+
+				leave_frame(interp);
+
+				if (result.type == RESULT_RETURN)
+				{
+					block_result = result;
+					break;
+				}
+			}
+
+			return block_result;
+		}
+		break;
+
+		case STMT_DELETE:
+		{
+			Value target = interpret_expr(interp, stmt->as.delete_stmt.target);
+			Value key = interpret_expr(interp, stmt->as.delete_stmt.index);
+
+			if (check_map_access(interp, target, &key))
+			{
+				hash_table_delete(&as_map(target)->table, key);
+			}
+
+			return result_none();
+		}
+		break;
 	}
 
 	UNREACHABLE();
@@ -1,5 +1,10 @@
 #pragma once
 
 struct Program;
+struct NativeRegistry;
 
-void treewalk_interpreter_run(struct Program program);
+#include "core/common.h"
+
+// Returns false when the program ended on a runtime error
+bool treewalk_interpreter_run(struct Program program,
+							  struct NativeRegistry *natives);
@@ -1,72 +1,290 @@
 #include "vm.h"
 
+#include <stdatomic.h>
+
+#include "core/cell.h"
 #include "core/common.h"
 #include "core/dyn_array.h"
 #include "core/hash_table.h"
+#include "core/memory.h"
+#include "core/metrics.h"
 #include "core/value.h"
 
 #include "compiler/chunk.h"
 
+#include "interpreter/native.h"
+#include "interpreter/op_profile.h"
+
 #include "debug/debug.h"
 
-#define DEBUG_TRACE_EXECUTION
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_STACK_SLOTS 16
+// Longer strings are only traced by length, instead of flattening them
+#define TRACE_STRING_LEN 64
+#endif
 
-static Vm vm;
+static InterpretResult run(Vm *vm);
 
-static InterpretResult run();
+static void push(Vm *vm, Value value);
+static Value pop(Vm *vm);
+static Value peek(Vm *vm, usize offset);
 
-static void push(Value value);
-static Value pop();
-static Value peek(usize offset);
+static void fiber_init(Fiber *fiber);
+static void fiber_reset(Fiber *fiber);
+static void fiber_free(Fiber *fiber);
+static void free_coroutine_fiber(Fiber *fiber);
+static void grow_stack(Fiber *fiber);
 
-void vm_init()
+static Entry *find_global(Vm *vm, InlineCache *cache, Value name);
+static bool check_map_access(Vm *vm, Value target, Value *key);
+static Value *check_array_access(Value target, Value index);
+static bool call_value(Vm *vm, Value callee, u8 arg_count);
+static bool tail_call_function(Vm *vm, CompiledFunction *function,
+							   u8 arg_count);
+static bool resume_coroutine(Vm *vm, Value target, Value value);
+static void leave_coroutine(Vm *vm);
+static InterpretResult run_event_loop(Vm *vm);
+static void print_stack_trace(Vm *vm);
+static void mark_roots(Heap *heap, void *owner);
+static void mark_fiber(Heap *heap, Fiber *fiber);
+
+void vm_init(Vm *vm, StringTable *strings, const NativeRegistry *natives)
 {
-	vm.chunk = NULL;
-	vm.stack_top = vm.stack;
-	hash_table_init(&vm.globals);
+	vm->fiber = &vm->main_fiber;
+	vm->coroutine = NULL;
+	vm->strings = strings;
+	vm->natives = natives;
+	fiber_init(vm->fiber);
+	hash_table_init_as(&vm->globals, TABLE_GLOBALS);
+	event_loop_init(&vm->loop);
+	gc_heap_init(&vm->heap, strings, mark_roots, mark_fiber,
+				 free_coroutine_fiber, vm);
+	vm->profile = op_profile_enabled() ? op_profile_new() : NULL;
+	vm->instructions = 0;
 }
 
-void vm_free()
+void vm_free(Vm *vm)
 {
-	vm.chunk = NULL;
+	vm->fiber = NULL;
+	hash_table_free(&vm->globals);
+	event_loop_free(&vm->loop);
+	gc_heap_free(&vm->heap);
+	fiber_free(&vm->main_fiber);
+
+	if (vm->profile != NULL)
+	{
+		op_profile_merge(vm->profile);
+		vm->profile = NULL;
+	}
 }
 
-InterpretResult vm_interpret(Chunk *chunk)
+void vm_define_global(Vm *vm, String *name, Value value)
 {
-	vm.chunk = chunk;
-	vm.ip = vm.chunk->code;
+	hash_table_set(&vm->globals, value_cell((Cell *)name), value);
+}
 
-	return run();
+static i32 max_depth = VM_DEFAULT_MAX_DEPTH;
+
+void vm_set_max_depth(i32 depth)
+{
+	max_depth = MAX(depth, 1);
 }
 
-static InterpretResult run()
+void vm_flush_metrics(Vm *vm)
 {
-#define READ_BYTE() (*vm.ip++)
-#define READ_SHORT() (vm.ip += 2, (u16)((vm.ip[-2] << 8) | vm.ip[-1]))
-#define READ_CONSTANT() (vm.chunk->constants[READ_BYTE()])
-#define READ_STRING() as_string(READ_CONSTANT())
+	metrics_add(METRIC_INSTRUCTIONS, vm->instructions);
+	vm->instructions = 0;
+}
+
+InterpretResult vm_interpret(Vm *vm, const Chunk *chunk)
+{
+	Heap *previous = gc_enter(&vm->heap);
+	u64 start = metrics_now();
+
+	vm->fiber = &vm->main_fiber;
+	vm->coroutine = NULL;
+	fiber_reset(vm->fiber);
+
+	CallFrame *frame = &vm->fiber->frames[vm->fiber->frame_count++];
+	frame->chunk = chunk;
+	frame->ip = chunk->code;
+	frame->slots = vm->fiber->stack;
+
+	InterpretResult result = run(vm);
+
+	if (result == INTERPRET_OK)
+	{
+		result = run_event_loop(vm);
+	}
+	else if (result == INTERPRET_RUNTIME_ERROR)
+	{
+		print_stack_trace(vm);
+	}
+
+	vm_flush_metrics(vm);
+	metrics_end(PHASE_RUN, start);
+	gc_enter(previous);
+
+	return result;
+}
+
+static InterpretResult call(Vm *vm, Value callee, Value *args, i32 arg_count,
+							Value *result)
+{
+	vm->fiber = &vm->main_fiber;
+	vm->coroutine = NULL;
+	fiber_reset(vm->fiber);
+
+	push(vm, callee);
+	for (i32 i = 0; i < arg_count; i++)
+	{
+		gc_adopt(args[i]);
+		push(vm, args[i]);
+	}
+
+	if (!call_value(vm, callee, (u8)arg_count))
+	{
+		return INTERPRET_RUNTIME_ERROR;
+	}
+
+	// Natives are done already, and leave no frame to run
+	InterpretResult status = run(vm);
+
+	if (status != INTERPRET_OK)
+	{
+		if (status == INTERPRET_RUNTIME_ERROR)
+		{
+			print_stack_trace(vm);
+		}
+
+		return status;
+	}
+
+	// Kept on the stack while the tasks run, so that it isn't collected
+	status = run_event_loop(vm);
+	Value value = pop(vm);
+
+	if (result != NULL)
+	{
+		*result = value;
+	}
+
+	return status;
+}
+
+InterpretResult vm_call(Vm *vm, Value callee, Value *args, i32 arg_count,
+						Value *result)
+{
+	Heap *previous = gc_enter(&vm->heap);
+	u64 start = metrics_now();
+
+	InterpretResult status = call(vm, callee, args, arg_count, result);
+
+	vm_flush_metrics(vm);
+	metrics_end(PHASE_RUN, start);
+	gc_enter(previous);
+
+	return status;
+}
+
+static InterpretResult run(Vm *vm)
+{
+// The current frame is cached, and must be reloaded whenever the frame count
+// or the fiber changes. Tasks are resumed by the event loop once the main
+// fiber has no frame left, which gets control back when they leave.
+#define LOAD_FRAME()                                            \
+	do                                                          \
+	{                                                           \
+		if (vm->fiber->frame_count == 0)                        \
+		{                                                       \
+			return INTERPRET_OK;                                \
+		}                                                       \
+		frame = &vm->fiber->frames[vm->fiber->frame_count - 1]; \
+	} while (false)
+
+// Calls and loop back edges are safe points, where every live value is on a
+// fiber or in a global
+#define GC_SAFE_POINT()            \
+	do                             \
+	{                              \
+		if (vm->heap.step_pending) \
+		{                          \
+			gc_step(&vm->heap);    \
+		}                          \
+	} while (false)
 
-#define BINARY_OP(op, type)                             \
+#ifdef CHARM_PROFILE_OPS
+#define PROFILE_OP(instruction)                         \
 	do                                                  \
 	{                                                   \
-		if (!is_number(peek(0)) || !is_number(peek(1))) \
+		if (vm->profile != NULL)                        \
 		{                                               \
-			/* TODO: Typechecking */                    \
-			UNREACHABLE();                              \
+			op_profile_count(vm->profile, instruction); \
 		}                                               \
-		f64 b = as_number(pop());                       \
-		f64 a = as_number(pop());                       \
-		push(type(a op b));                             \
+	} while (false)
+#else
+#define PROFILE_OP(instruction) \
+	do                          \
+	{                           \
+	} while (false)
+#endif
+
+#define READ_BYTE() (*frame->ip++)
+#define READ_SHORT() \
+	(frame->ip += 2, (u16)((frame->ip[-2] << 8) | frame->ip[-1]))
+#define READ_CONSTANT() (frame->chunk->constants[READ_BYTE()])
+#define READ_STRING() as_string(READ_CONSTANT())
+#define READ_CACHE() (&frame->chunk->caches[READ_SHORT()])
+
+	CallFrame *frame;
+	LOAD_FRAME();
+
+	if (vm->profile != NULL)
+	{
+		op_profile_start(vm->profile);
+	}
+
+#define BINARY_OP(op, type)                                     \
+	do                                                          \
+	{                                                           \
+		if (!is_number(peek(vm, 0)) || !is_number(peek(vm, 1))) \
+		{                                                       \
+			/* TODO: Typechecking */                            \
+			UNREACHABLE();                                      \
+		}                                                       \
+		f64 b = as_number(pop(vm));                             \
+		f64 a = as_number(pop(vm));                             \
+		push(vm, type(a op b));                                 \
 	} while (false)
 
 	for (;;)
 	{
 #ifdef DEBUG_TRACE_EXECUTION
 		printf("          ");
-		for (Value *slot = vm.stack; slot < vm.stack_top; slot++)
+
+		// Only the top of deep stacks is shown, or tracing deep recursion
+		// would print a number of values quadratic in its depth
+		Value *slot = vm->fiber->stack;
+		isize hidden = vm->fiber->stack_top - slot - TRACE_STACK_SLOTS;
+
+		if (hidden > 0)
+		{
+			printf("[ ... %d more ]", (i32)hidden);
+			slot += hidden;
+		}
+
+		for (; slot < vm->fiber->stack_top; slot++)
 		{
 			printf("[ ");
-			print_value(slot);
+			if (is_any_string(*slot) &&
+				string_length(*slot) > TRACE_STRING_LEN)
+			{
+				printf("<%d bytes string>", string_length(*slot));
+			}
+			else
+			{
+				print_value(slot);
+			}
 			if (is_cell(*slot))
 			{
 				printf(" (%p)", as_cell(*slot));
@@ -76,51 +294,72 @@ static InterpretResult run()
 
 		printf("\n");
 
-		debug_disassemble_instruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+		debug_disassemble_instruction(frame->chunk,
+									  (int)(frame->ip - frame->chunk->code));
 #endif
 
-		u8 instruction;
+		u8 instruction = READ_BYTE();
+		PROFILE_OP(instruction);
+		vm->instructions += 1;
 
-		switch (instruction = READ_BYTE())
+		switch (instruction)
 		{
 			case OP_CONSTANT:
 			{
-				push(READ_CONSTANT());
+				push(vm, READ_CONSTANT());
 			}
 			break;
 
 			case OP_NIL:
 			{
-				push(value_nil());
+				push(vm, value_nil());
 			}
 			break;
 
 			case OP_TRUE:
 			{
-				push(value_bool(true));
+				push(vm, value_bool(true));
 			}
 			break;
 
 			case OP_FALSE:
 			{
-				push(value_bool(false));
+				push(vm, value_bool(false));
 			}
 			break;
 
 			case OP_NEGATE:
 			{
-				if (!is_number(peek(0)))
+				if (!is_number(peek(vm, 0)))
 				{
 					// TODO: Typecheck
 					UNREACHABLE();
 				}
-				push(value_number(-as_number(pop())));
+				push(vm, value_number(-as_number(pop(vm))));
 			}
 			break;
 
 			case OP_ADD:
 			{
-				BINARY_OP(+, value_number);
+				if (is_any_string(peek(vm, 0)) && is_any_string(peek(vm, 1)))
+				{
+					Value b = pop(vm);
+					Value a = pop(vm);
+					Value result;
+
+					if (!string_concat(a, b, &result))
+					{
+						printf("Strings can't be longer than %d bytes\n",
+							   STRING_MAX_LEN);
+						return INTERPRET_RUNTIME_ERROR;
+					}
+
+					push(vm, result);
+				}
+				else
+				{
+					BINARY_OP(+, value_number);
+				}
 			}
 			break;
 
@@ -144,13 +383,13 @@ static InterpretResult run()
 
 			case OP_NOT:
 			{
-				if (!is_bool(peek(0)))
+				if (!is_bool(peek(vm, 0)))
 				{
 					// TODO: Typecheck
 					UNREACHABLE();
 				}
 
-				push(value_bool(!as_bool(pop())));
+				push(vm, value_bool(!as_bool(pop(vm))));
 			}
 			break;
 
@@ -168,9 +407,9 @@ static InterpretResult run()
 
 			case OP_EQUAL:
 			{
-				Value b = pop();
-				Value a = pop();
-				push(value_bool(values_equal(a, b)));
+				Value b = pop(vm);
+				Value a = pop(vm);
+				push(vm, value_bool(values_equal(a, b)));
 			}
 			break;
 
@@ -180,51 +419,64 @@ static InterpretResult run()
 			}
 			break;
 
+			case OP_GREATER_EQUAL:
+			{
+				BINARY_OP(>=, value_bool);
+			}
+			break;
+
 			case OP_LESS:
 			{
 				BINARY_OP(<, value_bool);
 			}
 			break;
 
+			case OP_LESS_EQUAL:
+			{
+				BINARY_OP(<=, value_bool);
+			}
+			break;
+
 			case OP_POP:
 			{
-				pop();
+				pop(vm);
 			}
 			break;
 
 			case OP_DEFINE_GLOBAL:
 			{
-				String *name = READ_STRING();
-				hash_table_set(&vm.globals, name, peek(0));
-				pop();
+				Value name = READ_CONSTANT();
+				hash_table_set(&vm->globals, name, peek(vm, 0));
+				pop(vm);
 			}
 			break;
 
 			case OP_GET_GLOBAL:
 			{
-				String *name = READ_STRING();
-				Value value;
-				if (!hash_table_get(&vm.globals, name, &value))
+				Value name = READ_CONSTANT();
+				Entry *entry = find_global(vm, READ_CACHE(), name);
+				if (entry == NULL)
 				{
-					printf("Undefined variable %s\n", name->str);
+					printf("Undefined variable %s\n", as_cstring(name));
 					return INTERPRET_RUNTIME_ERROR;
 				}
-				push(value);
+				push(vm, entry->value);
 			}
 			break;
 
 			case OP_SET_GLOBAL:
 			{
-				String *name = READ_STRING();
-				Value value = peek(0);
+				Value name = READ_CONSTANT();
+				Value value = peek(vm, 0);
 
-				Value old_value;
-				if (!hash_table_get(&vm.globals, name, &old_value))
+				Entry *entry = find_global(vm, READ_CACHE(), name);
+				if (entry == NULL)
 				{
-					printf("Undefined variable %s\n", name->str);
+					printf("Undefined variable %s\n", as_cstring(name));
 					return INTERPRET_RUNTIME_ERROR;
 				}
 
+				Value old_value = entry->value;
 				if (!is_nil(old_value) && !values_share_type(old_value, value))
 				{
 					// TODO: This should be handled by typechecking
@@ -232,42 +484,44 @@ static InterpretResult run()
 					return INTERPRET_RUNTIME_ERROR;
 				}
 
-				hash_table_set(&vm.globals, name, value);
+				gc_write_barrier(value);
+				entry->value = value;
 			}
 			break;
 
 			case OP_GET_LOCAL:
 			{
 				u8 slot = READ_BYTE();
-				push(vm.stack[slot]);
+				push(vm, frame->slots[slot]);
 			}
 			break;
 
 			case OP_SET_LOCAL:
 			{
 				u8 slot = READ_BYTE();
-				vm.stack[slot] = peek(0);
+				frame->slots[slot] = peek(vm, 0);
 			}
 			break;
 
 			case OP_JUMP:
 			{
 				u16 offset = READ_SHORT();
-				vm.ip += offset;
+				frame->ip += offset;
 			}
 			break;
 
 			case OP_LOOP:
 			{
 				u16 offset = READ_SHORT();
-				vm.ip -= offset;
+				frame->ip -= offset;
+				GC_SAFE_POINT();
 			}
 			break;
 
 			case OP_JUMP_IF_FALSE:
 			{
 				u16 offset = READ_SHORT();
-				Value value = peek(0);
+				Value value = peek(vm, 0);
 
 				if (!is_bool(value))
 				{
@@ -277,39 +531,803 @@ static InterpretResult run()
 
 				if (!as_bool(value))
 				{
-					vm.ip += offset;
+					frame->ip += offset;
+				}
+			}
+			break;
+
+			case OP_CALL:
+			{
+				GC_SAFE_POINT();
+
+				u8 arg_count = READ_BYTE();
+				if (!call_value(vm, peek(vm, arg_count), arg_count))
+				{
+					return INTERPRET_RUNTIME_ERROR;
+				}
+
+				LOAD_FRAME();
+			}
+			break;
+
+			case OP_TAIL_CALL:
+			{
+				GC_SAFE_POINT();
+
+				u8 arg_count = READ_BYTE();
+				Value callee = peek(vm, arg_count);
+
+				if (is_compiled_function(callee))
+				{
+					if (!tail_call_function(vm, as_compiled_function(callee),
+											arg_count))
+					{
+						return INTERPRET_RUNTIME_ERROR;
+					}
+
+					break;
+				}
+
+				if (!call_value(vm, callee, arg_count))
+				{
+					return INTERPRET_RUNTIME_ERROR;
+				}
+
+				LOAD_FRAME();
+			}
+			break;
+
+			case OP_MAP:
+			{
+				u8 count = READ_BYTE();
+				Map *map = map_new();
+
+				Value *pairs = vm->fiber->stack_top - count * 2;
+				for (u8 i = 0; i < count; i++)
+				{
+					Value key = string_intern(vm->strings, pairs[i * 2]);
+					if (!hash_table_is_valid_key(key))
+					{
+						printf("Map keys must be booleans, strings or "
+							   "numbers but NaN\n");
+						return INTERPRET_RUNTIME_ERROR;
+					}
+
+					hash_table_set(&map->table, key, pairs[i * 2 + 1]);
+				}
+
+				vm->fiber->stack_top = pairs;
+				push(vm, value_cell((Cell *)map));
+			}
+			break;
+
+			case OP_ARRAY:
+			{
+				u8 count = READ_BYTE();
+				Array *array = array_new(count);
+
+				Value *items = vm->fiber->stack_top - count;
+				for (u8 i = 0; i < count; i++)
+				{
+					gc_write_barrier(items[i]);
+					arrpush(array->items, items[i]);
+				}
+
+				vm->fiber->stack_top = items;
+				push(vm, value_cell((Cell *)array));
+			}
+			break;
+
+			case OP_GET_INDEX:
+			{
+				if (is_array(peek(vm, 1)))
+				{
+					Value *item = check_array_access(peek(vm, 1), peek(vm, 0));
+					if (item == NULL)
+					{
+						return INTERPRET_RUNTIME_ERROR;
+					}
+
+					vm->fiber->stack_top -= 2;
+					push(vm, *item);
+					break;
+				}
+
+				Value key = peek(vm, 0);
+				if (!check_map_access(vm, peek(vm, 1), &key))
+				{
+					return INTERPRET_RUNTIME_ERROR;
+				}
+
+				pop(vm);
+				Map *map = as_map(pop(vm));
+
+				Value value = value_nil();
+				hash_table_get(&map->table, key, &value);
+				push(vm, value);
+			}
+			break;
+
+			case OP_SET_INDEX:
+			{
+				if (is_array(peek(vm, 2)))
+				{
+					Value *item = check_array_access(peek(vm, 2), peek(vm, 1));
+					if (item == NULL)
+					{
+						return INTERPRET_RUNTIME_ERROR;
+					}
+
+					Value value = pop(vm);
+					vm->fiber->stack_top -= 2;
+					gc_write_barrier(value);
+					*item = value;
+					push(vm, value);
+					break;
+				}
+
+				Value key = peek(vm, 1);
+				if (!check_map_access(vm, peek(vm, 2), &key))
+				{
+					return INTERPRET_RUNTIME_ERROR;
+				}
+
+				Value value = pop(vm);
+				pop(vm);
+				Map *map = as_map(pop(vm));
+
+				hash_table_set(&map->table, key, value);
+				push(vm, value);
+			}
+			break;
+
+			case OP_DELETE_INDEX:
+			{
+				Value key = peek(vm, 0);
+				if (!check_map_access(vm, peek(vm, 1), &key))
+				{
+					return INTERPRET_RUNTIME_ERROR;
+				}
+
+				pop(vm);
+				Map *map = as_map(pop(vm));
+
+				hash_table_delete(&map->table, key);
+			}
+			break;
+
+			case OP_MAP_NEXT:
+			{
+				u8 slot = READ_BYTE();
+				u16 offset = READ_SHORT();
+
+				if (!is_map(frame->slots[slot]))
+				{
+					printf("For in loops can only iterate over maps\n");
+					return INTERPRET_RUNTIME_ERROR;
+				}
+
+				HashTable *table = &as_map(frame->slots[slot])->table;
+				i32 cursor = (i32)as_number(frame->slots[slot + 1]);
+
+				Entry *entry = hash_table_next(table, &cursor);
+
+				if (entry == NULL)
+				{
+					frame->ip += offset;
+				}
+				else
+				{
+					frame->slots[slot + 1] = value_number(cursor);
+					frame->slots[slot + 2] = entry->key;
+				}
+			}
+			break;
+
+			case OP_YIELD:
+			{
+				Value value = pop(vm);
+
+				if (vm->coroutine == NULL)
+				{
+					printf("Cannot yield outside of a coroutine\n");
+					return INTERPRET_RUNTIME_ERROR;
 				}
+
+				vm->coroutine->state = COROUTINE_SUSPENDED;
+				leave_coroutine(vm);
+
+				// Becomes the result of `resume` on the caller's side
+				push(vm, value);
+				LOAD_FRAME();
+			}
+			break;
+
+			case OP_RESUME:
+			{
+				Value value = pop(vm);
+				Value target = pop(vm);
+
+				if (!resume_coroutine(vm, target, value))
+				{
+					return INTERPRET_RUNTIME_ERROR;
+				}
+
+				LOAD_FRAME();
 			}
 			break;
 
 			case OP_RETURN:
 			{
-				//Value result = pop();
-				//print_value(&result);
-				//printf("\n");
-				return INTERPRET_OK;
+				Value result = pop(vm);
+				Fiber *fiber = vm->fiber;
+
+				fiber->frame_count -= 1;
+
+				if (fiber->frame_count > 0)
+				{
+					fiber->stack_top = frame->slots;
+					push(vm, result);
+					LOAD_FRAME();
+					break;
+				}
+
+				if (vm->coroutine == NULL)
+				{
+					// Left for vm_call
+					push(vm, result);
+					return INTERPRET_OK;
+				}
+
+				// The function of the coroutine returned, so its fiber can go
+				Coroutine *coroutine = vm->coroutine;
+				coroutine->state = COROUTINE_DONE;
+				leave_coroutine(vm);
+
+				free_coroutine_fiber(coroutine->fiber);
+				coroutine->fiber = NULL;
+
+				push(vm, result);
+				LOAD_FRAME();
 			}
+			break;
 		}
 	}
 
 #undef BINARY_OP
+#undef GC_SAFE_POINT
+#undef PROFILE_OP
+#undef READ_CACHE
+#undef READ_STRING
 #undef READ_CONSTANT
 #undef READ_SHORT
 #undef READ_BYTE
+#undef LOAD_FRAME
+}
+
+static void push(Vm *vm, Value value)
+{
+	Fiber *fiber = vm->fiber;
+
+	if (fiber->stack_top == fiber->stack_end)
+	{
+		grow_stack(fiber);
+	}
+
+	*fiber->stack_top++ = value;
 }
 
-static void push(Value value)
+static Value pop(Vm *vm)
 {
-	*vm.stack_top++ = value;
+	vm->fiber->stack_top--;
+	return *vm->fiber->stack_top;
 }
 
-static Value pop()
+static Value peek(Vm *vm, usize offset)
 {
-	vm.stack_top--;
-	return *vm.stack_top;
+	return vm->fiber->stack_top[-1 - offset];
 }
 
-static Value peek(usize offset)
+static void fiber_init(Fiber *fiber)
 {
-	return vm.stack_top[-1 - offset];
+	fiber->stack =
+		mem_malloc_as(MEM_FRAMES, sizeof(Value) * FIBER_STACK_INITIAL);
+	fiber->stack_end = fiber->stack + FIBER_STACK_INITIAL;
+
+	fiber->frames =
+		mem_malloc_as(MEM_FRAMES, sizeof(CallFrame) * FIBER_FRAMES_INITIAL);
+	fiber->frame_capacity = FIBER_FRAMES_INITIAL;
+
+	fiber_reset(fiber);
+}
+
+static void fiber_reset(Fiber *fiber)
+{
+	fiber->stack_top = fiber->stack;
+	fiber->frame_count = 0;
+}
+
+static void fiber_free(Fiber *fiber)
+{
+	mem_free(fiber->stack);
+	mem_free(fiber->frames);
+	fiber->stack = NULL;
+	fiber->frames = NULL;
+}
+
+static void free_coroutine_fiber(Fiber *fiber)
+{
+	fiber_free(fiber);
+	mem_free(fiber);
+}
+
+// The sampler may interrupt the vm at any point, so the old buffers are only
+// freed once nothing points to them anymore, and the frames are hidden while
+// their slots move
+static void grow_stack(Fiber *fiber)
+{
+	isize capacity = fiber->stack_end - fiber->stack;
+	isize used = fiber->stack_top - fiber->stack;
+
+	Value *stack = mem_malloc_as(MEM_FRAMES, sizeof(Value) * capacity * 2);
+	memcpy(stack, fiber->stack, sizeof(Value) * used);
+
+	i32 frame_count = fiber->frame_count;
+	fiber->frame_count = 0;
+	atomic_signal_fence(memory_order_release);
+
+	for (i32 i = 0; i < frame_count; i++)
+	{
+		CallFrame *frame = &fiber->frames[i];
+		frame->slots = stack + (frame->slots - fiber->stack);
+	}
+
+	Value *old = fiber->stack;
+	fiber->stack = stack;
+	fiber->stack_top = stack + used;
+	fiber->stack_end = stack + capacity * 2;
+
+	atomic_signal_fence(memory_order_release);
+	fiber->frame_count = frame_count;
+
+	mem_free(old);
+}
+
+// Returns false once the fiber is as deep as allowed
+static bool grow_frames(Fiber *fiber)
+{
+	if (fiber->frame_capacity >= max_depth)
+	{
+		return false;
+	}
+
+	i32 capacity = MIN(fiber->frame_capacity * 2, max_depth);
+
+	CallFrame *frames = mem_malloc_as(MEM_FRAMES, sizeof(CallFrame) * capacity);
+	memcpy(frames, fiber->frames, sizeof(CallFrame) * fiber->frame_count);
+
+	CallFrame *old = fiber->frames;
+	atomic_signal_fence(memory_order_release);
+	fiber->frames = frames;
+	fiber->frame_capacity = capacity;
+	atomic_signal_fence(memory_order_release);
+
+	mem_free(old);
+
+	return true;
+}
+
+// Globals are only ever added, so an entry keeps its global until the table
+// grows, which the check of the key catches. Keys are compared by content when
+// they were interned elsewhere, e.g. by the parent of a child instance, or by
+// the instance that compiled a cached chunk.
+static Entry *find_global(Vm *vm, InlineCache *cache, Value name)
+{
+	HashTable *globals = &vm->globals;
+	i32 slot = atomic_load_explicit(&cache->global, memory_order_relaxed);
+
+	if ((u32)slot < (u32)globals->capacity)
+	{
+		Entry *entry = &globals->entries[slot];
+
+		if (is_string(entry->key) && (as_cell(entry->key) == as_cell(name) ||
+									  string_equal(entry->key, name)))
+		{
+			return entry;
+		}
+	}
+
+	Entry *entry = hash_table_get_entry(globals, name);
+
+	// Instances sharing the chunk usually agree on the slot, so the cache line
+	// is only written when they don't
+	if (entry != NULL && entry - globals->entries != slot)
+	{
+		atomic_store_explicit(&cache->global, (i32)(entry - globals->entries),
+							  memory_order_relaxed);
+	}
+
+	return entry;
+}
+
+static bool check_map_access(Vm *vm, Value target, Value *key)
+{
+	if (!is_map(target))
+	{
+		printf("Only maps can be indexed\n");
+		return false;
+	}
+
+	*key = string_intern(vm->strings, *key);
+
+	if (!hash_table_is_valid_key(*key))
+	{
+		printf("Map keys must be booleans, strings or numbers but NaN\n");
+		return false;
+	}
+
+	return true;
+}
+
+static Value *check_array_access(Value target, Value index)
+{
+	Value *item = array_at(as_array(target), index);
+
+	if (item == NULL)
+	{
+		printf("Array indices must be integers within bounds\n");
+	}
+
+	return item;
+}
+
+static bool check_arity(CompiledFunction *function, u8 arg_count)
+{
+	if (arg_count != function->arity)
+	{
+		printf("Function %s expects %d arguments, got %d\n",
+			   function->name->str, function->arity, arg_count);
+		return false;
+	}
+
+	return true;
+}
+
+static bool call_function(Vm *vm, CompiledFunction *function,
+						  u8 arg_count)
+{
+	if (!check_arity(function, arg_count))
+	{
+		return false;
+	}
+
+	Fiber *fiber = vm->fiber;
+
+	if (fiber->frame_count == fiber->frame_capacity && !grow_frames(fiber))
+	{
+		printf("Stack overflow\n");
+		return false;
+	}
+
+	CallFrame *frame = &fiber->frames[fiber->frame_count];
+	frame->chunk = function->chunk;
+	frame->ip = function->chunk->code;
+	frame->slots = fiber->stack_top - arg_count - 1;
+
+	// The sampler may read the frame as soon as it is counted
+	atomic_signal_fence(memory_order_release);
+	fiber->frame_count += 1;
+
+	return true;
+}
+
+// Runs the function in the frame of its caller, which is done with it, so that
+// tail recursion doesn't grow the stacks
+static bool tail_call_function(Vm *vm, CompiledFunction *function,
+							   u8 arg_count)
+{
+	if (!check_arity(function, arg_count))
+	{
+		return false;
+	}
+
+	Fiber *fiber = vm->fiber;
+	CallFrame *frame = &fiber->frames[fiber->frame_count - 1];
+
+	// Hidden from the sampler while it holds half of each function
+	fiber->frame_count -= 1;
+	atomic_signal_fence(memory_order_release);
+
+	memmove(frame->slots, fiber->stack_top - arg_count - 1,
+			sizeof(Value) * (arg_count + 1));
+	fiber->stack_top = frame->slots + arg_count + 1;
+
+	frame->chunk = function->chunk;
+	frame->ip = function->chunk->code;
+
+	atomic_signal_fence(memory_order_release);
+	fiber->frame_count += 1;
+
+	return true;
+}
+
+// Only tasks resumed by the event loop can wait for a request, so that
+// scripts never see a coroutine come back before it is done with its call.
+// Requests made anywhere else complete before returning.
+static void await_request(Vm *vm, AsyncRequest *request)
+{
+	if (request->task != NULL)
+	{
+		event_loop_submit(&vm->loop, request);
+		push(vm, value_cell((Cell *)request->task));
+		return;
+	}
+
+	Coroutine *task = vm->coroutine;
+	bool in_loop = vm->main_fiber.frame_count == 0 && task != NULL &&
+				   task->caller == NULL;
+
+	if (!in_loop)
+	{
+		push(vm, async_request_run(request));
+		return;
+	}
+
+	request->task = task;
+	event_loop_submit(&vm->loop, request);
+
+	task->state = COROUTINE_WAITING;
+	leave_coroutine(vm);
+	push(vm, value_nil());
+}
+
+static bool call_value(Vm *vm, Value callee, u8 arg_count)
+{
+	if (is_compiled_function(callee))
+	{
+		return call_function(vm, as_compiled_function(callee), arg_count);
+	}
+
+	switch (callee.type)
+	{
+		case VALUE_NATIVE_FUNCTION:
+		{
+			Native native = as_native_function(callee);
+			if (!native_check_arity(vm->natives, native, arg_count))
+			{
+				return false;
+			}
+
+			// Arguments are read straight from the stack
+			Result result =
+				native.function(vm->fiber->stack_top - arg_count, arg_count);
+
+			vm->fiber->stack_top -= arg_count + 1;
+
+			if (result.type == RESULT_ASYNC)
+			{
+				await_request(vm, result.as.async_request);
+				return true;
+			}
+
+			push(vm, result.type == RESULT_RETURN ? result.as.return_result
+											  : value_nil());
+			return true;
+		}
+
+		default:
+			printf("Only functions can be called\n");
+			return false;
+	}
+}
+
+static bool resume_coroutine(Vm *vm, Value target, Value value)
+{
+	if (!is_coroutine(target))
+	{
+		printf("Only coroutines can be resumed\n");
+		return false;
+	}
+
+	Coroutine *coroutine = as_coroutine(target);
+
+	switch (coroutine->state)
+	{
+		case COROUTINE_CREATED:
+		{
+			if (!is_compiled_function(coroutine->function))
+			{
+				printf("Coroutines can only run script functions\n");
+				return false;
+			}
+
+			coroutine->fiber = mem_malloc_as(MEM_FRAMES, sizeof(Fiber));
+			fiber_init(coroutine->fiber);
+		}
+		break;
+
+		case COROUTINE_SUSPENDED:
+			break;
+
+		case COROUTINE_RUNNING:
+			printf("Coroutine is already running\n");
+			return false;
+
+		case COROUTINE_WAITING:
+			printf("Coroutine is waiting for an async operation\n");
+			return false;
+
+		case COROUTINE_DONE:
+			printf("Cannot resume a finished coroutine\n");
+			return false;
+	}
+
+	bool first_resume = coroutine->state == COROUTINE_CREATED;
+
+	coroutine->caller = vm->coroutine;
+	coroutine->state = COROUTINE_RUNNING;
+	vm->coroutine = coroutine;
+	vm->fiber = coroutine->fiber;
+
+	if (!first_resume)
+	{
+		// Becomes the result of the `yield` that suspended the coroutine
+		push(vm, value);
+		return true;
+	}
+
+	// The resumed value is the argument of the function, if it takes one
+	CompiledFunction *function = as_compiled_function(coroutine->function);
+	u8 arg_count = function->arity > 0 ? 1 : 0;
+
+	push(vm, coroutine->function);
+	if (arg_count > 0)
+	{
+		push(vm, value);
+	}
+
+	return call_function(vm, function, arg_count);
+}
+
+// Switches back to the fiber that resumed the running coroutine
+static void leave_coroutine(Vm *vm)
+{
+	Coroutine *coroutine = vm->coroutine;
+
+	// Its fiber changed since it was marked
+	gc_retrace(&vm->heap, (Cell *)coroutine);
+
+	vm->coroutine = coroutine->caller;
+	vm->fiber = coroutine->caller != NULL ? coroutine->caller->fiber
+										  : &vm->main_fiber;
+	coroutine->caller = NULL;
+}
+
+// Frames are left as they were when run() failed, the innermost printed first
+// Traces of deep stacks only show the frames at both ends
+#define TRACE_EDGE_FRAMES 10
+
+static void print_stack_trace(Vm *vm)
+{
+	Fiber *fiber = vm->fiber;
+
+	for (i32 i = fiber->frame_count - 1; i >= 0; i--)
+	{
+		i32 elided = fiber->frame_count - 2 * TRACE_EDGE_FRAMES;
+
+		if (elided > 0 && i == fiber->frame_count - 1 - TRACE_EDGE_FRAMES)
+		{
+			printf("... %d more frames\n", elided);
+			i -= elided - 1;
+			continue;
+		}
+
+		const CallFrame *frame = &fiber->frames[i];
+		i32 offset = (i32)(frame->ip - frame->chunk->code) - 1;
+		printf("[line %d] in ", chunk_get_line(frame->chunk, offset));
+
+		// Slot 0 holds the function being called, but not for the program
+		Value callee = frame->slots[0];
+
+		if (is_compiled_function(callee) &&
+			as_compiled_function(callee)->chunk == frame->chunk)
+		{
+			String *name = as_compiled_function(callee)->name;
+			printf("%.*s()\n", name->len, name->str);
+		}
+		else
+		{
+			printf("script\n");
+		}
+	}
+}
+
+static InterpretResult run_event_loop(Vm *vm)
+{
+	AsyncRequest *request;
+
+	while ((request = event_loop_next(&vm->loop)) != NULL)
+	{
+		if (vm->heap.step_pending)
+		{
+			gc_step(&vm->heap);
+		}
+
+		Coroutine *task = request->task;
+		Value value = async_request_finish(request);
+
+		// Tasks are coroutines, which scripts may have run to the end already
+		if (task->state == COROUTINE_DONE)
+		{
+			continue;
+		}
+
+		if (task->state == COROUTINE_WAITING)
+		{
+			task->state = COROUTINE_SUSPENDED;
+		}
+
+		if (!resume_coroutine(vm, value_cell((Cell *)task), value))
+		{
+			return INTERPRET_RUNTIME_ERROR;
+		}
+
+		InterpretResult result = run(vm);
+
+		if (result != INTERPRET_OK)
+		{
+			if (result == INTERPRET_RUNTIME_ERROR)
+			{
+				print_stack_trace(vm);
+			}
+
+			return result;
+		}
+
+		// Whatever the task yielded or returned is left on the main fiber
+		pop(vm);
+
+		// Yielding from a task only lets the other tasks run first
+		if (task->state == COROUTINE_SUSPENDED)
+		{
+			AsyncRequest *next = async_request_sleep(0);
+			next->task = task;
+			event_loop_submit(&vm->loop, next);
+		}
+	}
+
+	return INTERPRET_OK;
+}
+
+static void mark_fiber(Heap *heap, Fiber *fiber)
+{
+	for (Value *slot = fiber->stack; slot < fiber->stack_top; slot++)
+	{
+		gc_mark_value(heap, *slot);
+	}
+}
+
+static void mark_roots(Heap *heap, void *owner)
+{
+	Vm *vm = owner;
+
+	mark_fiber(heap, &vm->main_fiber);
+
+	// Running fibers are changed without barriers
+	for (Coroutine *coroutine = vm->coroutine; coroutine != NULL;
+		 coroutine = coroutine->caller)
+	{
+		gc_retrace(heap, (Cell *)coroutine);
+	}
+
+	i32 cursor = 0;
+	Entry *entry;
+
+	while ((entry = hash_table_next(&vm->globals, &cursor)) != NULL)
+	{
+		gc_mark_value(heap, entry->key);
+		gc_mark_value(heap, entry->value);
+	}
+
+	event_loop_mark_tasks(&vm->loop, heap);
 }
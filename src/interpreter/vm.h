@@ -1,32 +1,93 @@
 #pragma once
 
 #include "core/common.h"
+#include "core/gc.h"
 #include "core/hash_table.h"
 #include "core/value.h"
 
+#include "interpreter/event_loop.h"
+
 struct Chunk;
+struct Coroutine;
+struct NativeRegistry;
+struct OpProfile;
+struct String;
+struct StringTable;
 
 typedef enum InterpretResult
 {
 	INTERPRET_OK,
+	INTERPRET_COMPILE_ERROR,
 	INTERPRET_RUNTIME_ERROR,
 } InterpretResult;
 
-// TODO: Dynamic stack at some point ?
-#define STACK_MAX 256
+// Fibers start small and double their stacks when full, which coroutines
+// benefit from the most. Only the depth of calls is bounded, as each frame
+// takes a bounded share of the value stack.
+#define FIBER_STACK_INITIAL 64
+#define FIBER_FRAMES_INITIAL 8
+#define VM_DEFAULT_MAX_DEPTH 10000
 
-typedef struct Vm
+typedef struct CallFrame
 {
-	struct Chunk *chunk;
-	u8 *ip;
+	const struct Chunk *chunk;
+	const u8 *ip;
+	Value *slots;
+} CallFrame;
 
-	Value stack[STACK_MAX];
+// The program runs on the main fiber of the vm, and each coroutine on a fiber
+// of its own, so that switching from one to the other only swaps `Vm.fiber`.
+typedef struct Fiber
+{
+	// Moved when grown, along with the slots of the frames
+	Value *stack;
 	Value *stack_top;
+	Value *stack_end;
+
+	CallFrame *frames;
+	i32 frame_count;
+	i32 frame_capacity;
+} Fiber;
+
+typedef struct Vm
+{
+	Fiber main_fiber;
+	Fiber *fiber;
+	struct Coroutine *coroutine; // NULL when running on the main fiber
 
 	HashTable globals;
+	struct StringTable *strings;
+	const struct NativeRegistry *natives; // Declared among the globals
+
+	// Drives the tasks started by the program once its main fiber is done
+	EventLoop loop;
+
+	// Current while the vm runs, so that everything it allocates is collected
+	Heap heap;
+
+	struct OpProfile *profile; // NULL unless profiling, see op_profile.h
+
+	u64 instructions; // Run since the last vm_flush_metrics
 } Vm;
 
-void vm_init();
-void vm_free();
+void vm_init(Vm *vm, struct StringTable *strings,
+			 const struct NativeRegistry *natives);
+void vm_free(Vm *vm);
+
+void vm_define_global(Vm *vm, struct String *name, Value value);
+
+// Calls nested deeper than `depth` fail with a stack overflow, 10000 by
+// default. Meant to be set before any vm runs.
+void vm_set_max_depth(i32 depth);
+
+// Adds the instructions run so far to the metrics, which the vm does itself
+// when a run ends
+void vm_flush_metrics(Vm *vm);
+
+InterpretResult vm_interpret(Vm *vm, const struct Chunk *chunk);
 
-InterpretResult vm_interpret(struct Chunk *chunk);
+// Calls `callee` with the given arguments, then runs the tasks it started.
+// `result` is optional, and may be collected by the next run of the vm.
+// Untracked arguments are adopted by the vm.
+InterpretResult vm_call(Vm *vm, Value callee, Value *args, i32 arg_count,
+						Value *result);
@@ -0,0 +1,295 @@
+#include "isolate_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "core/dyn_array.h"
+#include "core/memory.h"
+
+#include "compiler/chunk.h"
+
+typedef struct Job
+{
+	const Chunk *chunk;
+	InterpretResult *result;
+} Job;
+
+// The owner pushes and pops at the back while thieves take from the front,
+// so they only contend on the lock when the queue is about to run dry.
+typedef struct WorkQueue
+{
+	pthread_mutex_t lock;
+	Job *jobs;
+	i32 head;
+} WorkQueue;
+
+typedef struct Worker
+{
+	IsolatePool *pool;
+	i32 index;
+	pthread_t thread;
+	WorkQueue queue;
+} Worker;
+
+struct IsolatePool
+{
+	CharmVM *parent;
+
+	Worker *workers;
+	i32 worker_count; // Queues, which idle workers steal from
+	i32 started; // Workers running, which jobs are submitted to
+	i32 next_worker;
+
+	atomic_int queued;
+	atomic_int pending;
+	bool stopping;
+
+	// Only used to put idle workers and waiters to sleep
+	pthread_mutex_t lock;
+	pthread_cond_t work_available;
+	pthread_cond_t work_done;
+};
+
+static void *worker_main(void *arg);
+
+IsolatePool *isolate_pool_new(CharmVM *parent, i32 thread_count)
+{
+	if (thread_count <= 0)
+	{
+		thread_count = (i32)sysconf(_SC_NPROCESSORS_ONLN);
+		thread_count = MAX(thread_count, 1);
+	}
+
+	IsolatePool *pool = mem_malloc(sizeof(IsolatePool));
+	pool->parent = parent;
+	pool->workers = mem_allocate(Worker, thread_count);
+	pool->worker_count = thread_count;
+	pool->started = 0;
+	pool->next_worker = 0;
+	pool->stopping = false;
+
+	atomic_init(&pool->queued, 0);
+	atomic_init(&pool->pending, 0);
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_available, NULL);
+	pthread_cond_init(&pool->work_done, NULL);
+
+	for (i32 i = 0; i < thread_count; i++)
+	{
+		Worker *worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->index = i;
+		worker->queue.jobs = NULL;
+		worker->queue.head = 0;
+		pthread_mutex_init(&worker->queue.lock, NULL);
+	}
+
+	// Workers may steal from each other as soon as they start, so every queue
+	// has to be ready beforehand. The queues of workers that couldn't start
+	// stay empty.
+	for (i32 i = 0; i < thread_count; i++)
+	{
+		Worker *worker = &pool->workers[i];
+
+		if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+		{
+			break;
+		}
+
+		pool->started += 1;
+	}
+
+	if (pool->started == 0)
+	{
+		isolate_pool_free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+i32 isolate_pool_worker_count(IsolatePool *pool)
+{
+	return pool->started;
+}
+
+void isolate_pool_free(IsolatePool *pool)
+{
+	isolate_pool_wait(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->work_available);
+	pthread_mutex_unlock(&pool->lock);
+
+	// Queues can only go away once nobody can steal from them anymore
+	for (i32 i = 0; i < pool->started; i++)
+	{
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+
+	for (i32 i = 0; i < pool->worker_count; i++)
+	{
+		Worker *worker = &pool->workers[i];
+		pthread_mutex_destroy(&worker->queue.lock);
+		arrfree(worker->queue.jobs);
+	}
+
+	pthread_cond_destroy(&pool->work_done);
+	pthread_cond_destroy(&pool->work_available);
+	pthread_mutex_destroy(&pool->lock);
+
+	mem_free(pool->workers);
+	mem_free(pool);
+}
+
+void isolate_pool_submit(IsolatePool *pool, const Chunk *chunk,
+						 InterpretResult *result)
+{
+	Job job = { .chunk = chunk, .result = result };
+
+	Worker *worker = &pool->workers[pool->next_worker];
+	pool->next_worker = (pool->next_worker + 1) % pool->started;
+
+	atomic_fetch_add(&pool->pending, 1);
+
+	pthread_mutex_lock(&worker->queue.lock);
+	arrpush(worker->queue.jobs, job);
+	pthread_mutex_unlock(&worker->queue.lock);
+
+	pthread_mutex_lock(&pool->lock);
+	atomic_fetch_add(&pool->queued, 1);
+	pthread_cond_signal(&pool->work_available);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void isolate_pool_wait(IsolatePool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+
+	while (atomic_load(&pool->pending) > 0)
+	{
+		pthread_cond_wait(&pool->work_done, &pool->lock);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static bool pop_job(WorkQueue *queue, Job *job)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&queue->lock);
+
+	if (queue->head < arrlen(queue->jobs))
+	{
+		*job = arrpop(queue->jobs);
+		found = true;
+	}
+
+	if (queue->head == arrlen(queue->jobs))
+	{
+		arrsetlen(queue->jobs, 0);
+		queue->head = 0;
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return found;
+}
+
+static bool steal_job(WorkQueue *queue, Job *job)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&queue->lock);
+
+	if (queue->head < arrlen(queue->jobs))
+	{
+		*job = queue->jobs[queue->head++];
+		found = true;
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return found;
+}
+
+static bool take_job(Worker *worker, Job *job)
+{
+	IsolatePool *pool = worker->pool;
+
+	if (pop_job(&worker->queue, job))
+	{
+		return true;
+	}
+
+	for (i32 i = 1; i < pool->worker_count; i++)
+	{
+		i32 index = (worker->index + i) % pool->worker_count;
+		Worker *victim = &pool->workers[index];
+
+		if (steal_job(&victim->queue, job))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void run_job(IsolatePool *pool, Job job)
+{
+	CharmVM *isolate = charm_vm_new_isolate(pool->parent);
+
+	*job.result = charm_run_chunk(isolate, job.chunk);
+
+	charm_vm_free(isolate);
+}
+
+static void *worker_main(void *arg)
+{
+	Worker *worker = arg;
+	IsolatePool *pool = worker->pool;
+
+	while (true)
+	{
+		Job job;
+
+		if (take_job(worker, &job))
+		{
+			atomic_fetch_sub(&pool->queued, 1);
+
+			run_job(pool, job);
+
+			if (atomic_fetch_sub(&pool->pending, 1) == 1)
+			{
+				pthread_mutex_lock(&pool->lock);
+				pthread_cond_broadcast(&pool->work_done);
+				pthread_mutex_unlock(&pool->lock);
+			}
+
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+
+		while (atomic_load(&pool->queued) == 0 && !pool->stopping)
+		{
+			pthread_cond_wait(&pool->work_available, &pool->lock);
+		}
+
+		bool stop = pool->stopping && atomic_load(&pool->queued) == 0;
+
+		pthread_mutex_unlock(&pool->lock);
+
+		if (stop)
+		{
+			break;
+		}
+	}
+
+	return NULL;
+}
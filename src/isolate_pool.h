@@ -0,0 +1,28 @@
+#pragma once
+
+#include "charm.h"
+
+struct Chunk;
+
+typedef struct IsolatePool IsolatePool;
+
+// Runs compiled scripts concurrently, each one on a fresh isolate of `parent`,
+// so that scripts share their bytecode and the strings interned by `parent`
+// but none of their globals.
+// Jobs are spread over one queue per worker, and idle workers steal from the
+// other queues. `parent` must not be used while jobs are in flight.
+// A `thread_count` of 0 starts one worker per online core. Returns NULL if no
+// worker could be started.
+IsolatePool *isolate_pool_new(CharmVM *parent, i32 thread_count);
+void isolate_pool_free(IsolatePool *pool);
+
+// Workers that could actually start, at most `thread_count`
+i32 isolate_pool_worker_count(IsolatePool *pool);
+
+// `result` is written once the script has run. The chunk must stay alive until
+// then, and can be submitted any number of times.
+void isolate_pool_submit(IsolatePool *pool, const struct Chunk *chunk,
+						 InterpretResult *result);
+
+// Blocks until every submitted job has run
+void isolate_pool_wait(IsolatePool *pool);
@@ -1,71 +1,165 @@
 #include <stdio.h>
 
-#define STB_DS_IMPLEMENTATION
-#include "core/dyn_array.h"
+#include "charm.h"
 
+#include "core/hash_table.h"
 #include "core/memory.h"
+#include "core/metrics.h"
 
 #include "ast/ast.h"
-#include "ast/parser.h"
-#include "ast/lexer.h"
 
-#include "compiler/chunk.h"
-#include "compiler/compiler.h"
+#include "interpreter/op_profile.h"
+#include "interpreter/sampler.h"
 
 #include "debug/debug.h"
 
-#include "interpreter/treewalk.h"
-#include "interpreter/vm.h"
-
 static void usage(int argc, char **argv);
 static char *read_whole_file(const char *filename);
 
 int main(int argc, char **argv)
 {
-	if (argc != 2)
+	bool profile_ops = false;
+	bool stats = false;
+	bool vm_only = false;
+	const char *samples_path = NULL;
+	i32 sample_rate = SAMPLER_DEFAULT_RATE;
+	const char *filename = NULL;
+
+	for (i32 i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--profile-ops") == 0)
+		{
+			profile_ops = true;
+		}
+		else if (strcmp(argv[i], "--stats") == 0)
+		{
+			stats = true;
+		}
+		else if (strcmp(argv[i], "--vm-only") == 0)
+		{
+			vm_only = true;
+		}
+		else if (strcmp(argv[i], "--table-max-load") == 0 && i + 1 < argc)
+		{
+			hash_table_set_max_load(atof(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc)
+		{
+			vm_set_max_depth(atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc)
+		{
+			samples_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc)
+		{
+			sample_rate = atoi(argv[++i]);
+		}
+		else if (filename == NULL)
+		{
+			filename = argv[i];
+		}
+		else
+		{
+			usage(argc, argv);
+			return 1;
+		}
+	}
+
+	if (filename == NULL)
 	{
 		usage(argc, argv);
 		return 1;
 	}
 
-	const char *src = read_whole_file(argv[1]);
+	if (profile_ops && !op_profile_enable())
+	{
+		printf("--profile-ops needs a build with CHARM_PROFILE_OPS\n");
+		return 1;
+	}
+
+	FILE *samples = NULL;
+
+	if (samples_path != NULL)
+	{
+		samples = fopen(samples_path, "w");
+
+		if (samples == NULL || !sampler_start(sample_rate))
+		{
+			printf("Could not start sampling into '%s'\n", samples_path);
+			return 1;
+		}
+	}
+
+	mem_stats_install();
+
+	const char *src = read_whole_file(filename);
 
 	if (src == NULL)
 	{
 		return 2;
 	}
 
-	Lexer lexer = lexer_init(src);
-	Parser parser = parser_init(&lexer);
+	CharmVM *charm = charm_vm_new();
 
-	Program program = parser_parse_program(&parser);
+	Program program = charm_parse(charm, src);
 
-	printf("-*-*-*- AST -*-*-*-\n");
-	debug_print_program(program);
+	if (!vm_only)
+	{
+		printf("-*-*-*- AST -*-*-*-\n");
+		u64 start = metrics_now();
+		debug_print_program(program);
+		metrics_end(PHASE_PRINT_AST, start);
 
-	printf("\n-*-*-*- Treewalk Interpret -*-*-*-\n");
-	treewalk_interpreter_run(program);
+		printf("\n-*-*-*- Treewalk Interpret -*-*-*-\n");
+		charm_run_treewalk(charm, program);
 
-	printf("\n\n");
+		printf("\n\n");
+	}
 
-	Chunk chunk;
-	chunk_init(&chunk);
+	printf("\n-*-*-*- Running program -*-*-*-\n");
+	InterpretResult result = charm_run(charm, program);
 
-	compile_program(&chunk, program);
+	charm_vm_free(charm);
 
-	printf("\n-*-*-*- Running program -*-*-*-\n");
-	vm_init();
-	vm_interpret(&chunk);
+	if (profile_ops)
+	{
+		printf("\n-*-*-*- Opcode profile -*-*-*-\n");
+		op_profile_dump(stdout);
+	}
 
-	vm_free();
+	if (stats)
+	{
+		printf("\n-*-*-*- Stats -*-*-*-\n");
+		metrics_dump(stdout);
+
+		printf("\n");
+		hash_table_stats_dump(stdout);
+	}
+
+	if (samples != NULL)
+	{
+		sampler_stop();
+		sampler_write_collapsed(samples);
+		fclose(samples);
+
+		if (sampler_dropped() > 0)
+		{
+			printf("%llu samples were dropped\n",
+				   (unsigned long long)sampler_dropped());
+		}
+	}
 
-	chunk_free(&chunk);
+	return result == INTERPRET_OK ? 0 : 3;
 }
 
 static void usage(int argc, char **argv)
 {
 	UNUSED(argc);
-	printf("Usage: %s <filename.charm>\n", argv[0]);
+	printf("Usage: %s [--profile-ops] [--stats] [--vm-only] "
+		   "[--table-max-load <load>] [--max-depth <calls>] [--sample <file>] "
+		   "[--sample-rate <hz>] <filename.charm>\n",
+		   argv[0]);
 }
 
 static char *read_whole_file(const char *filename)
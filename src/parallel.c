@@ -0,0 +1,376 @@
+#include "parallel.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "core/cell.h"
+#include "core/dyn_array.h"
+#include "core/gc.h"
+#include "core/memory.h"
+
+typedef struct Job
+{
+	Value function;
+	bool reduce;
+
+	Value *items; // Copies, adopted by the instance of their partition
+	i32 item_count;
+
+	CharmVM **instances; // One per partition
+	i32 partition_count;
+
+	// One per item for maps, and one per partition for reduces
+	Value *results;
+
+	// Guarded by the pool lock
+	i32 next_partition;
+	i32 finished;
+	bool failed;
+} Job;
+
+// Workers are started on the first call and live as long as the process.
+// Jobs stay queued until all of their partitions are claimed.
+static struct
+{
+	pthread_once_t once;
+	pthread_mutex_t lock;
+	pthread_cond_t work_available;
+	pthread_cond_t work_done;
+	Job **jobs;
+	i32 worker_count;
+} pool = {
+	.once = PTHREAD_ONCE_INIT,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work_available = PTHREAD_COND_INITIALIZER,
+	.work_done = PTHREAD_COND_INITIALIZER,
+	.jobs = NULL,
+	.worker_count = 0,
+};
+
+// Returns -1 once every partition of `job` is claimed. Called with the lock.
+static i32 claim_partition(Job *job)
+{
+	if (job->next_partition == job->partition_count)
+	{
+		return -1;
+	}
+
+	i32 partition = job->next_partition++;
+
+	if (job->next_partition == job->partition_count)
+	{
+		for (i32 i = 0; i < arrlen(pool.jobs); i++)
+		{
+			if (pool.jobs[i] == job)
+			{
+				arrdel(pool.jobs, i);
+				break;
+			}
+		}
+	}
+
+	return partition;
+}
+
+// Copies are only freed by the heap that adopts them, so those left over by
+// failures have to be released
+static void release_copies(Value *copies, i32 count)
+{
+	for (i32 i = 0; i < count; i++)
+	{
+		gc_release(copies[i]);
+	}
+}
+
+// Items are adopted by the instance of their partition once passed to it, and
+// the ones it didn't get to are released on failures
+static bool run_partition(Job *job, i32 partition)
+{
+	CharmVM *charm = job->instances[partition];
+	i32 start = (i32)((i64)partition * job->item_count / job->partition_count);
+	i32 end =
+		(i32)((i64)(partition + 1) * job->item_count / job->partition_count);
+
+	if (job->reduce)
+	{
+		// A lone item is never passed to the instance, and is already a copy
+		if (end - start == 1)
+		{
+			job->results[partition] = job->items[start];
+			return true;
+		}
+
+		Value acc = job->items[start];
+
+		for (i32 i = start + 1; i < end; i++)
+		{
+			Value args[2] = { acc, job->items[i] };
+
+			if (charm_call(charm, job->function, args, 2, &acc) !=
+				INTERPRET_OK)
+			{
+				release_copies(&job->items[i + 1], end - i - 1);
+				return false;
+			}
+		}
+
+		return value_copy_deep(acc, &job->results[partition]);
+	}
+
+	for (i32 i = start; i < end; i++)
+	{
+		Value result;
+
+		if (charm_call(charm, job->function, &job->items[i], 1, &result) !=
+				INTERPRET_OK ||
+			!value_copy_deep(result, &job->results[i]))
+		{
+			release_copies(&job->items[i + 1], end - i - 1);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void finish_partition(Job *job, i32 partition)
+{
+	bool ok = run_partition(job, partition);
+
+	pthread_mutex_lock(&pool.lock);
+	job->finished += 1;
+	job->failed |= !ok;
+	pthread_cond_broadcast(&pool.work_done);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void *worker_main(void *arg)
+{
+	UNUSED(arg);
+
+	pthread_mutex_lock(&pool.lock);
+
+	for (;;)
+	{
+		if (arrempty(pool.jobs))
+		{
+			pthread_cond_wait(&pool.work_available, &pool.lock);
+			continue;
+		}
+
+		Job *job = pool.jobs[0];
+		i32 partition = claim_partition(job);
+
+		pthread_mutex_unlock(&pool.lock);
+		finish_partition(job, partition);
+		pthread_mutex_lock(&pool.lock);
+	}
+
+	return NULL;
+}
+
+// The caller runs partitions as well, hence one worker less than cores
+static void start_workers()
+{
+	i32 cores = (i32)sysconf(_SC_NPROCESSORS_ONLN);
+
+	// Jobs are split for the workers that could actually start
+	for (i32 i = 0; i < cores - 1; i++)
+	{
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, worker_main, NULL) != 0)
+		{
+			break;
+		}
+
+		pthread_detach(thread);
+		pool.worker_count += 1;
+	}
+}
+
+// Runs `job` on the pool and the calling thread, and returns once all of its
+// partitions are done. Partitions may themselves run jobs, as their callers
+// always make progress on their own job.
+static void run_job(Job *job)
+{
+	if (job->partition_count == 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	arrpush(pool.jobs, job);
+	pthread_cond_broadcast(&pool.work_available);
+
+	i32 partition;
+	while ((partition = claim_partition(job)) >= 0)
+	{
+		pthread_mutex_unlock(&pool.lock);
+		finish_partition(job, partition);
+		pthread_mutex_lock(&pool.lock);
+	}
+
+	while (job->finished < job->partition_count)
+	{
+		pthread_cond_wait(&pool.work_done, &pool.lock);
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static bool job_init(Job *job, Value array, Value function, bool reduce)
+{
+	if (!is_array(array))
+	{
+		printf("Expected an array\n");
+		return false;
+	}
+
+	if (!is_compiled_function(function))
+	{
+		printf("Only functions compiled for the bytecode vm run in "
+			   "parallel\n");
+		return false;
+	}
+
+	// Items are copied one by one, so that none is shared by two partitions
+	Value *items = as_array(array)->items;
+	job->item_count = (i32)arrlen(items);
+	job->items = mem_allocate(Value, job->item_count);
+
+	for (i32 i = 0; i < job->item_count; i++)
+	{
+		if (!value_copy_deep(items[i], &job->items[i]))
+		{
+			release_copies(job->items, i);
+			mem_free(job->items);
+			return false;
+		}
+	}
+
+	pthread_once(&pool.once, start_workers);
+
+	job->function = function;
+	job->reduce = reduce;
+	job->partition_count = MIN(job->item_count, pool.worker_count + 1);
+	job->instances = mem_allocate(CharmVM *, job->partition_count);
+	job->results = NULL;
+	job->next_partition = 0;
+	job->finished = 0;
+	job->failed = false;
+
+	for (i32 i = 0; i < job->partition_count; i++)
+	{
+		job->instances[i] = charm_vm_new_child(charm_current());
+	}
+
+	return true;
+}
+
+static void job_free(Job *job)
+{
+	for (i32 i = 0; i < job->partition_count; i++)
+	{
+		charm_vm_free(job->instances[i]);
+	}
+
+	mem_free(job->instances);
+	mem_free(job->items);
+}
+
+static Result native_parallel_map(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	Job job;
+	if (!job_init(&job, args[0], args[1], false))
+	{
+		return result_none();
+	}
+
+	Array *results = array_new(job.item_count);
+	for (i32 i = 0; i < job.item_count; i++)
+	{
+		arrpush(results->items, value_nil());
+	}
+
+	job.results = results->items;
+
+	run_job(&job);
+	job_free(&job);
+
+	// Results that were copied before the failure, the others being nil
+	if (job.failed)
+	{
+		release_copies(results->items, job.item_count);
+		return result_none();
+	}
+
+	for (i32 i = 0; i < job.item_count; i++)
+	{
+		gc_adopt(results->items[i]);
+	}
+
+	return result_return(value_cell((Cell *)results));
+}
+
+static Result native_parallel_reduce(Value *args, i32 arg_count)
+{
+	UNUSED(arg_count);
+
+	Job job;
+	if (!job_init(&job, args[0], args[1], true))
+	{
+		return result_none();
+	}
+
+	// One per core, so kept off the stack like the items
+	Value *partials = mem_allocate(Value, job.partition_count);
+
+	for (i32 i = 0; i < job.partition_count; i++)
+	{
+		partials[i] = value_nil();
+	}
+
+	job.results = partials;
+
+	run_job(&job);
+
+	// Partials are combined in order, from a copy of `init`, and are adopted
+	// by the first instance as they are
+	Value acc = value_nil();
+	bool ok = !job.failed && value_copy_deep(args[2], &acc);
+	i32 combined = 0;
+
+	for (; ok && combined < job.partition_count; combined++)
+	{
+		Value combine[2] = { acc, partials[combined] };
+		ok = charm_call(job.instances[0], job.function, combine, 2, &acc) ==
+			 INTERPRET_OK;
+	}
+
+	release_copies(&partials[combined], job.partition_count - combined);
+
+	// Without partitions, `acc` is still the copy of `init`, which no instance
+	// adopted
+	Value result = acc;
+	ok = ok && (job.partition_count == 0 || value_copy_deep(acc, &result));
+
+	job_free(&job);
+	mem_free(partials);
+
+	if (!ok)
+	{
+		return result_none();
+	}
+
+	gc_adopt(result);
+	return result_return(result);
+}
+
+void parallel_register_natives(NativeRegistry *registry)
+{
+	native_register(registry, "parallel_map", native_parallel_map, 2);
+	native_register(registry, "parallel_reduce", native_parallel_reduce, 3);
+}
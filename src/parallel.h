@@ -0,0 +1,14 @@
+#pragma once
+
+#include "charm.h"
+
+// parallel_map(array, fn) calls fn on every item and returns the results in
+// order, while parallel_reduce(array, fn, init) folds the items with fn, which
+// has to be associative as items are folded in parallel partitions first.
+//
+// The array is split into contiguous partitions, each one run on a child
+// instance of the caller by a process-wide pool of threads, which the caller
+// joins until its own call is over. Items and results are copied between
+// instances, so fn only sees the functions declared by the caller, and should
+// not rely on any other global.
+void parallel_register_natives(NativeRegistry *registry);
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "charm.h"
+#include "isolate_pool.h"
+
+#include "core/dyn_array.h"
+
+#include "compiler/chunk.h"
+#include "compiler/chunk_cache.h"
+
+// Tests of the embedding API, which scripts can't reach. Each test runs on new
+// instances, and failed checks are reported without stopping the others.
+
+static i32 failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static void check(bool ok, const char *condition, const char *file, i32 line)
+{
+	if (!ok)
+	{
+		printf("%s:%d: check failed: %s\n", file, line, condition);
+		failures += 1;
+	}
+}
+
+static InterpretResult run(CharmVM *charm, const char *source)
+{
+	Chunk chunk;
+	chunk_init(&chunk);
+
+	InterpretResult result = INTERPRET_COMPILE_ERROR;
+
+	if (charm_compile(charm, source, &chunk) == COMPILE_OK)
+	{
+		result = charm_run_chunk(charm, &chunk);
+	}
+
+	chunk_free(&chunk);
+
+	return result;
+}
+
+static void append(char **source, const char *str)
+{
+	usize len = strlen(str);
+
+	if (len > 0)
+	{
+		memcpy(arraddnptr(*source, len), str, len);
+	}
+}
+
+// Source reading one global more than a chunk has inline caches for, between
+// `before` and `after`. Freed with arrfree.
+static char *too_many_accesses(const char *before, const char *after)
+{
+	char *source = NULL;
+	append(&source, before);
+
+	for (i32 i = 0; i <= CHUNK_MAX_CACHES; i++)
+	{
+		append(&source, "time;\n");
+	}
+
+	append(&source, after);
+	arrpush(source, '\0');
+
+	return source;
+}
+
+static i32 answers = 0;
+
+static Result native_answer(Value *args, i32 arg_count)
+{
+	UNUSED(args);
+	UNUSED(arg_count);
+
+	answers += 1;
+
+	return result_return(value_number(42));
+}
+
+static void test_native_names()
+{
+	CharmVM *charm = charm_vm_new();
+
+	// Hosts may build names in buffers that they reuse
+	char name[16];
+	snprintf(name, sizeof(name), "answer");
+	charm_register_native(charm, name, native_answer, 0);
+	memset(name, 'x', sizeof(name) - 1);
+
+	const char *registered = native_name(&charm->natives, native_answer);
+	CHECK(registered != NULL && strcmp(registered, "answer") == 0);
+
+	answers = 0;
+	CHECK(run(charm, "answer(); answer();") == INTERPRET_OK);
+	CHECK(answers == 2);
+
+	CHECK(run(charm, "answer(1);") == INTERPRET_RUNTIME_ERROR);
+	CHECK(answers == 2);
+
+	charm_vm_free(charm);
+}
+
+#define POOL_JOBS 8
+
+static void test_isolate_pool()
+{
+	CharmVM *charm = charm_vm_new();
+
+	Chunk counts, fails;
+	chunk_init(&counts);
+	chunk_init(&fails);
+
+	CHECK(charm_compile(charm, "var n = 0; while n < 1000 { n = n + 1; }",
+						&counts) == COMPILE_OK);
+	CHECK(charm_compile(charm, "var n = missing + 1;", &fails) == COMPILE_OK);
+
+	IsolatePool *pool = isolate_pool_new(charm, 2);
+	CHECK(pool != NULL);
+
+	if (pool != NULL)
+	{
+		i32 workers = isolate_pool_worker_count(pool);
+		CHECK(workers >= 1 && workers <= 2);
+
+		// Globals aren't shared, so every job defines `n` on its own isolate
+		InterpretResult results[POOL_JOBS];
+
+		for (i32 i = 0; i < POOL_JOBS; i++)
+		{
+			isolate_pool_submit(pool, i % 2 == 0 ? &counts : &fails,
+								&results[i]);
+		}
+
+		isolate_pool_wait(pool);
+
+		for (i32 i = 0; i < POOL_JOBS; i++)
+		{
+			CHECK(results[i] == (i % 2 == 0 ? INTERPRET_OK
+											: INTERPRET_RUNTIME_ERROR));
+		}
+
+		isolate_pool_free(pool);
+	}
+
+	chunk_free(&counts);
+	chunk_free(&fails);
+	charm_vm_free(charm);
+}
+
+static void test_too_many_accesses()
+{
+	CharmVM *charm = charm_vm_new();
+
+	char *script = too_many_accesses("", "");
+	char *function = too_many_accesses("function f() {\n", "}\n");
+
+	CHECK(run(charm, script) == INTERPRET_COMPILE_ERROR);
+	CHECK(run(charm, function) == INTERPRET_COMPILE_ERROR);
+
+	arrfree(script);
+	arrfree(function);
+	charm_vm_free(charm);
+}
+
+static void test_nan_comparisons()
+{
+	CharmVM *charm = charm_vm_new();
+
+	// Negating the opposite comparison would make both true
+	CHECK(run(charm, "var nan = 0 / 0;"
+					 "if nan >= 1 or nan <= 1 or 1 >= nan or 1 <= nan {"
+					 "    missing();"
+					 "}") == INTERPRET_OK);
+
+	charm_vm_free(charm);
+}
+
+static void test_chunk_cache()
+{
+	CharmVM *charm = charm_vm_new();
+
+	const char *source = "var cached = 1 + 2;";
+	const Chunk *chunk = chunk_cache_get(source);
+	CHECK(chunk != NULL);
+	CHECK(chunk_cache_get(source) == chunk);
+
+	CHECK(charm_interpret(charm, source) == INTERPRET_OK);
+	CHECK(charm_interpret(charm, source) == INTERPRET_OK);
+
+	// Failures aren't cached, and are reported every time
+	char *fails = too_many_accesses("", "");
+	CHECK(chunk_cache_get(fails) == NULL);
+	CHECK(charm_interpret(charm, fails) == INTERPRET_COMPILE_ERROR);
+	CHECK(charm_interpret(charm, fails) == INTERPRET_COMPILE_ERROR);
+
+	arrfree(fails);
+	charm_vm_free(charm);
+	chunk_cache_clear();
+}
+
+int main()
+{
+	test_native_names();
+	test_too_many_accesses();
+	test_isolate_pool();
+	test_nan_comparisons();
+	test_chunk_cache();
+
+	if (failures > 0)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}